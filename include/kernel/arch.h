@@ -0,0 +1,113 @@
+#ifndef ARCH_H
+#define ARCH_H
+
+#include <stdint.h>
+
+// Virtual counter of the ARM generic timer
+static inline uint64_t arch_counter(void) {
+    uint64_t value;
+    __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(value) :: "memory");
+    return value;
+}
+
+// Frequency of the generic timer counter in Hz
+static inline uint64_t arch_counter_freq(void) {
+    uint64_t value;
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(value));
+    return value;
+}
+
+// Start the PMU cycle counter as a 64-bit counter that also counts at EL1
+static inline void arch_cycle_counter_enable(void) {
+    uint64_t pmcr;
+    __asm__ volatile("mrs %0, pmcr_el0" : "=r"(pmcr));
+    __asm__ volatile("msr pmccfiltr_el0, xzr");
+    __asm__ volatile("msr pmcr_el0, %0" :: "r"(pmcr | (1ull << 6) | 1)); // LC | E
+    __asm__ volatile("msr pmcntenset_el0, %0" :: "r"(1ull << 31));
+    __asm__ volatile("isb");
+}
+
+// CPU cycles from the PMU cycle counter
+static inline uint64_t arch_cycles(void) {
+    uint64_t value;
+    __asm__ volatile("isb; mrs %0, pmccntr_el0" : "=r"(value) :: "memory");
+    return value;
+}
+
+// Full-system barrier: orders memory and device accesses, e.g. around DMA rings
+static inline void arch_mb(void) {
+    __asm__ volatile("dsb sy" ::: "memory");
+}
+
+// Zero 'size' bytes at 'addr', both multiples of the DC ZVA block size (at most 2KB,
+// so page-granular ranges always qualify). DC ZVA faults on Device memory, so it is
+// only used once the MMU maps RAM as Normal memory.
+static inline void arch_zero_pages(void* addr, uint64_t size) {
+    uint64_t sctlr;
+    uint64_t dczid;
+    __asm__ volatile("mrs %0, sctlr_el1" : "=r"(sctlr));
+    __asm__ volatile("mrs %0, dczid_el0" : "=r"(dczid));
+
+    if ((sctlr & 1) && !(dczid & (1 << 4))) {
+        uint64_t block = 4ull << (dczid & 0xF);
+        for (uint8_t* p = addr; p < (uint8_t*)addr + size; p += block) {
+            __asm__ volatile("dc zva, %0" :: "r"(p) : "memory");
+        }
+        return;
+    }
+
+    uint64_t* words = addr;
+    for (uint64_t i = 0; i < size / sizeof(uint64_t); i++) {
+        words[i] = 0;
+    }
+}
+
+// Number of set bits in 'count' 64-bit words, two words per NEON CNT
+static inline uint64_t arch_popcount(const uint64_t* words, uint64_t count) {
+    uint64_t total = 0;
+    uint64_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        uint64_t bits;
+        __asm__ volatile("ld1 {v0.2d}, [%1]\n"
+                         "cnt v0.16b, v0.16b\n"
+                         "uaddlv h0, v0.16b\n"
+                         "umov %w0, v0.h[0]"
+                         : "=r"(bits) : "r"(&words[i]) : "v0", "memory");
+        total += bits;
+    }
+    if (i < count) {
+        total += __builtin_popcountll(words[i]);
+    }
+    return total;
+}
+
+#define DAIF_I (1 << 7) // IRQs masked
+
+static inline void arch_irq_enable(void) {
+    __asm__ volatile("msr daifclr, #2" ::: "memory");
+}
+
+static inline void arch_irq_disable(void) {
+    __asm__ volatile("msr daifset, #2" ::: "memory");
+}
+
+// Mask IRQs, returning the previous mask state for arch_irq_restore
+static inline uint64_t arch_irq_save(void) {
+    uint64_t daif;
+    __asm__ volatile("mrs %0, daif\n"
+                     "msr daifset, #2" : "=r"(daif) :: "memory");
+    return daif;
+}
+
+static inline void arch_irq_restore(uint64_t daif) {
+    __asm__ volatile("msr daif, %0" :: "r"(daif) : "memory");
+}
+
+// Sleep until an interrupt is pending. It wakes the CPU even while IRQs are
+// masked, so a caller can check for work with them masked, sleep, then
+// unmask to take the interrupt without missing one in between.
+static inline void arch_wait_for_interrupt(void) {
+    __asm__ volatile("wfi" ::: "memory");
+}
+
+#endif // ARCH_H
@@ -0,0 +1,32 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include "kernel/blkdev.h"
+
+#define BCACHE_BLOCK_SIZE 4096
+#define BCACHE_DEFAULT_BUFFERS 256
+#define BCACHE_READAHEAD 8 // Blocks fetched together once reads turn sequential
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t readahead;      // Blocks fetched ahead of demand
+    uint64_t readahead_hits; // Of those, blocks used before eviction
+    uint64_t evictions;
+    uint64_t flushes;        // Write-back passes
+    uint64_t flush_blocks;   // Dirty blocks written
+    uint64_t flush_requests; // Device requests they were merged into
+    uint32_t buffers;
+    uint32_t dirty;
+} bcache_stats_t;
+
+void bcache_init(uint32_t buffers);
+int bcache_read(blkdev_t* dev, uint64_t offset, void* buffer, uint32_t size);
+int bcache_write(blkdev_t* dev, uint64_t offset, const void* buffer, uint32_t size);
+int bcache_zero(blkdev_t* dev, uint64_t offset, uint32_t size);
+void bcache_discard(blkdev_t* dev, uint64_t offset, uint64_t size);
+int bcache_sync(void);
+void bcache_get_stats(bcache_stats_t* stats);
+
+#endif // BCACHE_H
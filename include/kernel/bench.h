@@ -0,0 +1,10 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+void bench_pmm(void);
+void bench_hot_paths(const char* label);
+int bench_string(void);
+void bench_blk(void);
+void bench_crc(void);
+
+#endif // BENCH_H
@@ -0,0 +1,53 @@
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include <stdint.h>
+
+#define BLK_SECTOR_SIZE 512
+#define BLK_MAX_SEGMENTS 16
+
+// Request status
+#define BLK_PENDING 0
+#define BLK_OK 1
+#define BLK_ERROR 2
+
+typedef struct {
+    void* buffer;    // Physical (identity-mapped) address
+    uint32_t length; // Multiple of BLK_SECTOR_SIZE
+} blk_segment_t;
+
+// One read or write of consecutive sectors, scattered over up to BLK_MAX_SEGMENTS buffers
+typedef struct blk_request {
+    uint64_t sector;
+    int write;
+    uint32_t segment_count;
+    blk_segment_t segments[BLK_MAX_SEGMENTS];
+    volatile int status;
+    void (*done)(struct blk_request* request); // Optional, called from blk_poll
+    void* context;
+    struct blk_request* next; // Driver use while the request is queued
+} blk_request_t;
+
+typedef struct blkdev {
+    char name[8];
+    uint64_t sectors;     // Capacity in BLK_SECTOR_SIZE sectors
+    uint32_t queue_depth; // Descriptors the device queue holds
+    // Queue up to 'count' requests and notify the device once; returns how many were taken
+    unsigned int (*submit)(struct blkdev* dev, blk_request_t** requests, unsigned int count);
+    // Complete finished requests; returns how many completed
+    unsigned int (*poll)(struct blkdev* dev);
+    // Optional: the sectors' contents are no longer needed and may read back as zeros
+    void (*discard)(struct blkdev* dev, uint64_t sector, uint64_t sectors);
+    void* driver;
+    struct blkdev* next;
+} blkdev_t;
+
+void blkdev_register(blkdev_t* dev);
+blkdev_t* blkdev_get(unsigned int index);
+unsigned int blk_submit(blkdev_t* dev, blk_request_t** requests, unsigned int count);
+unsigned int blk_poll(blkdev_t* dev);
+int blk_wait(blkdev_t* dev, blk_request_t* request);
+int blk_rw(blkdev_t* dev, uint64_t sector, void* buffer, uint32_t sectors, int write);
+void blk_discard(blkdev_t* dev, uint64_t sector, uint64_t sectors);
+
+#endif // BLKDEV_H
@@ -0,0 +1,26 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+// CRC-32C (Castagnoli), as used for the file system's block checksums. Uses
+// the ARMv8 CRC32 instructions when the CPU has them and a table otherwise.
+// Shared with tools/fsck, which always takes the table path.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Continue a checksum over 'size' more bytes; start from 0
+uint32_t crc32c(uint32_t crc, const void* data, size_t size);
+
+// The checksum of a 'length' byte message after its bytes [offset, offset +
+// size) changed from 'old' to 'new', given its checksum 'crc' before. Costs
+// time in 'size' rather than 'length'.
+uint32_t crc32c_patch(uint32_t crc, uint32_t length, uint32_t offset, const void* old, const void* new,
+                      uint32_t size);
+
+// The two implementations, for benchmarking. crc32c_hw needs crc32c_has_hw().
+uint32_t crc32c_hw(uint32_t crc, const void* data, size_t size);
+uint32_t crc32c_sw(uint32_t crc, const void* data, size_t size);
+bool crc32c_has_hw(void);
+
+#endif // CRC32C_H
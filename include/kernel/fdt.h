@@ -0,0 +1,24 @@
+#ifndef FDT_H
+#define FDT_H
+
+#include <stdint.h>
+
+#define FDT_MAX_REGIONS 16
+
+typedef struct {
+    uint64_t base;
+    uint64_t size;
+} fdt_region_t;
+
+// RAM and reserved ranges discovered from a flattened device tree
+typedef struct {
+    fdt_region_t memory[FDT_MAX_REGIONS];
+    unsigned int memory_count;
+    fdt_region_t reserved[FDT_MAX_REGIONS];
+    unsigned int reserved_count;
+} fdt_memory_map_t;
+
+int fdt_check(const void* dtb);
+int fdt_get_memory_map(const void* dtb, fdt_memory_map_t* map);
+
+#endif // FDT_H
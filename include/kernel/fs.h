@@ -3,32 +3,103 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "kernel/blkdev.h"
 
 #define MAX_FILENAME_LENGTH 32
-#define MAX_FS_ENTRIES 256
+#define FS_MAX_INODES 65536
 #define BLOCK_SIZE 512
-#define FS_SIZE (1024 * 1024) // 1 MB file system
+#define FS_MAX_CAPACITY (256ull * 1024 * 1024) // Largest data area a file system can have
+#define FS_MAX_OPEN_FILES 32
+
+// fs_open flags
+#define FS_O_READ 1
+#define FS_O_WRITE 2
+#define FS_O_RDWR (FS_O_READ | FS_O_WRITE)
 
 typedef enum {
     FS_FILE,
     FS_DIRECTORY
 } fs_entry_type_t;
 
+// File blocks [file_block, file_block + count) stored in disk blocks from 'start'
+typedef struct {
+    uint32_t file_block;
+    uint32_t start;
+    uint32_t count;
+} fs_extent_t;
+
 typedef struct {
     char name[MAX_FILENAME_LENGTH];
     fs_entry_type_t type;
     uint32_t parent;
-    uint32_t start_block;
     uint32_t size;
+    fs_extent_t* extents;     // Sorted by file block; gaps are holes. kmalloc'd
+    uint32_t extent_count;
+    uint32_t extent_capacity;
+    uint32_t* children;       // Directory inodes sorted by name. kmalloc'd
+    uint32_t child_count;
+    uint32_t child_capacity;
+    uint32_t* chain;          // Disk blocks holding extents past the inline ones. kmalloc'd
+    uint32_t chain_count;
+    uint32_t chain_capacity;
+    const uint8_t* image;     // Initramfs bytes holding the data until the first change, or NULL
     bool is_used;
+    bool dirty;          // Part of the running journal transaction
+    uint32_t index;      // Own inode number
+    uint32_t tx_next;    // Next dirty inode while this one is dirty
+    uint32_t generation; // Bumped on delete so open handles notice
+    uint32_t next_free;  // Next unused inode while this one is unused
 } fs_entry_t;
 
-void fs_init(void);
+typedef struct {
+    uint64_t hits;          // Full-path lookups answered by the path cache
+    uint64_t misses;        // Full-path lookups that walked the directories
+    uint64_t probes;        // Per-component directory searches
+    uint64_t invalidations; // Cached paths dropped by fs_delete
+} fs_cache_stats_t;
+
+typedef struct {
+    uint32_t total_blocks;
+    uint32_t free_blocks;
+    uint32_t free_extents;  // Separate runs of free blocks
+    uint32_t largest_free;  // Blocks in the largest free run
+    uint32_t file_extents;  // Extents held by all files together
+    uint32_t inodes_used;
+    uint32_t inodes_allocated; // Inode slots in allocated chunks
+    uint32_t journal_used;     // Journal sectors written since the last checkpoint
+    uint32_t journal_sectors;
+    uint32_t image_bytes;      // File data still read in place from the initramfs
+    uint32_t shared_blocks;    // Blocks used by more than one file through clones
+} fs_space_stats_t;
+
+typedef struct {
+    uint32_t blocks; // Data blocks checked
+    uint32_t errors; // Blocks that no longer match their checksum
+} fs_scrub_stats_t;
+
+int fs_format(blkdev_t* dev);
+int fs_mount(blkdev_t* dev);
+int fs_sync(void);
+int fs_load_initramfs(const void* archive, uint32_t size);
+int fs_clone(const char* source, const char* destination);
+int fs_snapshot(const char* name);
+int fs_scrub(fs_scrub_stats_t* stats);
 int fs_create(const char* path, uint32_t size, fs_entry_type_t type);
 int fs_delete(const char* path);
 int fs_read(const char* path, void* buffer, uint32_t size, uint32_t offset);
 int fs_write(const char* path, const void* buffer, uint32_t size, uint32_t offset);
+int fs_truncate(const char* path, uint32_t size);
 void fs_list(const char* path);
+int fs_open(const char* path, int flags);
+int fs_close(int fd);
+int fs_pread(int fd, void* buffer, uint32_t size, uint32_t offset);
+int fs_pwrite(int fd, const void* buffer, uint32_t size, uint32_t offset);
+int fs_fd_read(int fd, void* buffer, uint32_t size);
+int fs_fd_write(int fd, const void* buffer, uint32_t size);
+int fs_ftruncate(int fd, uint32_t size);
+int fs_seek(int fd, uint32_t offset);
 int find_entry(const char* path);
+void fs_get_cache_stats(fs_cache_stats_t* stats);
+void fs_get_space_stats(fs_space_stats_t* stats);
 
 #endif // FS_H
\ No newline at end of file
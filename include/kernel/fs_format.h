@@ -0,0 +1,179 @@
+#ifndef FS_FORMAT_H
+#define FS_FORMAT_H
+
+// On-disk layout of the file system, shared by the kernel and the host tools
+// in tools/. Fields are little-endian and every structure fills or evenly
+// divides one 512-byte sector. Positions are in sectors from the device start:
+//
+//   0                superblock (sectors 1-7 unused, keeping what follows 4 KB aligned)
+//   journal_start    write-ahead journal of metadata sector images
+//   inode_start      inode table, FS_DISK_INODES_PER_SECTOR inodes per sector
+//   bitmap_start     allocation bitmap, one bit per data block
+//   csum_start       CRC-32C of each data block, FS_DISK_CSUMS_PER_SECTOR per sector
+//   data_start       data blocks, numbered from 0; extent chain blocks live here too
+//
+// Directories have no blocks of their own: every inode records its parent, and
+// the sorted child lists are rebuilt from the inode table at mount.
+// Cloned files list the same data blocks in their extents; reference counts
+// are not stored but rebuilt from the extents at mount.
+// Checksums are indexed by data block, so clones share them with the blocks.
+// Extent chain blocks are journaled metadata and have no checksum.
+
+#include <stdint.h>
+
+#define FS_DISK_SECTOR 512
+#define FS_DISK_MAGIC 0x474F5246 // "FROG"
+#define FS_DISK_VERSION 2
+#define FS_DISK_NAME_LENGTH 32
+#define FS_DISK_NO_BLOCK 0xFFFFFFFF
+#define FS_DISK_FILE 0
+#define FS_DISK_DIRECTORY 1
+#define FS_DISK_INLINE_EXTENTS 5
+#define FS_DISK_CHAIN_EXTENTS 42
+#define FS_DISK_INODES_PER_SECTOR 4
+#define FS_DISK_BITS_PER_SECTOR (FS_DISK_SECTOR * 8)
+#define FS_DISK_CSUMS_PER_SECTOR (FS_DISK_SECTOR / 4)
+#define FS_DISK_SECTORS_PER_INODE 8 // Inode table sized at one inode per 4 KB of disk
+#define FS_DISK_MIN_INODES 64
+#define FS_DISK_MAX_INODES 65536
+#define FS_DISK_MAX_DATA_BLOCKS (256u * 1024 * 1024 / FS_DISK_SECTOR)
+
+#define FS_JOURNAL_DESCRIPTOR 0x4A445343 // "CSDJ"
+#define FS_JOURNAL_COMMIT 0x4A4D4F43     // "COMJ"
+#define FS_JOURNAL_TAGS 124              // Home sectors listed by one descriptor
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sectors;          // Device size the layout was made for
+    uint32_t journal_start;
+    uint32_t journal_sectors;
+    uint32_t inode_start;
+    uint32_t inode_count;      // Slots in the inode table
+    uint32_t bitmap_start;
+    uint32_t bitmap_sectors;
+    uint32_t csum_start;
+    uint32_t csum_sectors;
+    uint32_t data_start;
+    uint32_t data_blocks;
+    uint32_t inode_limit;      // Slots from here on have never been used
+    uint32_t journal_sequence; // Sequence of the first transaction to replay
+    uint8_t reserved[448];
+} fs_disk_super_t;
+
+typedef struct {
+    uint32_t file_block;
+    uint32_t start;
+    uint32_t count;
+} fs_disk_extent_t;
+
+typedef struct {
+    char name[FS_DISK_NAME_LENGTH];
+    uint32_t type;
+    uint32_t used;
+    uint32_t parent;
+    uint32_t size;
+    uint32_t generation;
+    uint32_t extent_count;
+    uint32_t extent_chain; // First chain block holding extents past the inline ones
+    fs_disk_extent_t extents[FS_DISK_INLINE_EXTENTS];
+    uint32_t reserved[2];
+} fs_disk_inode_t;
+
+// Extents FS_DISK_INLINE_EXTENTS onwards, FS_DISK_CHAIN_EXTENTS per data block
+typedef struct {
+    uint32_t next; // FS_DISK_NO_BLOCK at the end of the chain
+    uint32_t reserved;
+    fs_disk_extent_t extents[FS_DISK_CHAIN_EXTENTS];
+} fs_disk_chain_t;
+
+// A transaction is one or more descriptors, each followed by the images it
+// lists, then a commit block. Replay stops at the first block that does not
+// continue the expected sequence.
+typedef struct {
+    uint32_t magic;    // FS_JOURNAL_DESCRIPTOR
+    uint32_t sequence;
+    uint32_t count;    // Images following this descriptor
+    uint32_t reserved;
+    uint32_t home[FS_JOURNAL_TAGS];
+} fs_journal_descriptor_t;
+
+typedef struct {
+    uint32_t magic;    // FS_JOURNAL_COMMIT
+    uint32_t sequence;
+    uint32_t count;    // Images in the whole transaction
+    uint32_t checksum; // fs_disk_checksum over the transaction's descriptors and images
+    uint8_t reserved[496];
+} fs_journal_commit_t;
+
+// FNV-1a, continued from 'hash'; start from FS_DISK_CHECKSUM_SEED
+#define FS_DISK_CHECKSUM_SEED 2166136261u
+static inline uint32_t fs_disk_checksum(uint32_t hash, const void* data, uint32_t size) {
+    const uint8_t* bytes = data;
+    for (uint32_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Chain blocks needed to hold 'extents' extents
+static inline uint32_t fs_disk_chain_blocks(uint32_t extents) {
+    if (extents <= FS_DISK_INLINE_EXTENTS) {
+        return 0;
+    }
+    return (extents - FS_DISK_INLINE_EXTENTS + FS_DISK_CHAIN_EXTENTS - 1) / FS_DISK_CHAIN_EXTENTS;
+}
+
+// Sectors a journal transaction of 'images' images takes, descriptors and commit included
+static inline uint32_t fs_journal_sectors(uint32_t images) {
+    return images + (images + FS_JOURNAL_TAGS - 1) / FS_JOURNAL_TAGS + 1;
+}
+
+// Fill in the layout fields of 'super' for a device of 'sectors' sectors.
+// Returns -1 if the device is too small to hold a file system.
+static inline int fs_disk_layout(uint64_t sectors, fs_disk_super_t* super) {
+    uint64_t usable = sectors & ~7ull;
+
+    uint64_t journal = usable / 64;
+    journal = journal < 256 ? 256 : journal > 8192 ? 8192 : journal;
+    uint64_t inodes = usable / FS_DISK_SECTORS_PER_INODE;
+    inodes = inodes < FS_DISK_MIN_INODES ? FS_DISK_MIN_INODES
+           : inodes > FS_DISK_MAX_INODES ? FS_DISK_MAX_INODES : inodes;
+    inodes &= ~(uint64_t)(FS_DISK_MIN_INODES - 1);
+
+    uint64_t inode_start = 8 + (journal & ~7ull);
+    uint64_t bitmap_start = inode_start + inodes / FS_DISK_INODES_PER_SECTOR;
+    if (usable <= bitmap_start + 16) {
+        return -1;
+    }
+    // Size the bitmap and checksums for everything after them, then round each to whole 4 KB
+    uint64_t blocks = usable - bitmap_start;
+    blocks = blocks > FS_DISK_MAX_DATA_BLOCKS ? FS_DISK_MAX_DATA_BLOCKS : blocks;
+    uint64_t bitmap = (blocks + FS_DISK_BITS_PER_SECTOR - 1) / FS_DISK_BITS_PER_SECTOR;
+    bitmap = (bitmap + 7) & ~7ull;
+    uint64_t csums = (blocks + FS_DISK_CSUMS_PER_SECTOR - 1) / FS_DISK_CSUMS_PER_SECTOR;
+    csums = (csums + 7) & ~7ull;
+    uint64_t data_start = bitmap_start + bitmap + csums;
+    if (usable <= data_start + 8) {
+        return -1;
+    }
+    blocks = usable - data_start;
+    blocks = blocks > FS_DISK_MAX_DATA_BLOCKS ? FS_DISK_MAX_DATA_BLOCKS : blocks;
+
+    super->magic = FS_DISK_MAGIC;
+    super->version = FS_DISK_VERSION;
+    super->sectors = sectors;
+    super->journal_start = 8;
+    super->journal_sectors = journal & ~7ull;
+    super->inode_start = inode_start;
+    super->inode_count = inodes;
+    super->bitmap_start = bitmap_start;
+    super->bitmap_sectors = bitmap;
+    super->csum_start = bitmap_start + bitmap;
+    super->csum_sectors = csums;
+    super->data_start = data_start;
+    super->data_blocks = blocks & ~7ull;
+    return 0;
+}
+
+#endif // FS_FORMAT_H
@@ -0,0 +1,14 @@
+#ifndef GIC_H
+#define GIC_H
+
+#include <stdint.h>
+
+#define GIC_SPURIOUS 1020 // Interrupt IDs from here on mean nothing is pending
+
+void gic_init(void);
+void gic_enable(uint32_t irq);
+void gic_disable(uint32_t irq);
+uint32_t gic_acknowledge(void);
+void gic_end(uint32_t iar);
+
+#endif // GIC_H
@@ -0,0 +1,36 @@
+#ifndef INITRAMFS_H
+#define INITRAMFS_H
+
+// Archive format of the initramfs linked into the kernel image, shared with
+// tools/mkinitramfs. A header is followed by 'count' entry records, parents
+// before their children, then the file contents. Directories have no data.
+
+#include <stdint.h>
+
+#define INITRAMFS_MAGIC 0x53464E49 // "INFS"
+#define INITRAMFS_VERSION 1
+#define INITRAMFS_NAME_LENGTH 32
+#define INITRAMFS_ROOT 0xFFFFFFFF // Parent of entries in the top directory
+#define INITRAMFS_FILE 0
+#define INITRAMFS_DIRECTORY 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count; // Entry records after the header
+    uint32_t size;  // Whole archive, header included
+} initramfs_header_t;
+
+typedef struct {
+    char name[INITRAMFS_NAME_LENGTH];
+    uint32_t parent; // Index of the parent record, or INITRAMFS_ROOT
+    uint32_t type;
+    uint32_t size;   // Bytes of file data
+    uint32_t offset; // Of the data from the start of the archive
+} initramfs_entry_t;
+
+// Bounds of the archive in the kernel image, set by linker/linker.ld
+extern const uint8_t __initramfs_start[];
+extern const uint8_t __initramfs_end[];
+
+#endif // INITRAMFS_H
@@ -2,9 +2,25 @@
 #define IO_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+#define KPRINTF_BUFFER 256 // Longer kprintf output is cut short
 
 void print(const char* str);
 void print_hex(uint64_t num);
+void print_dec(uint64_t num);
 void system_shutdown(void);
 
-#endif // IO_H
\ No newline at end of file
+// printf subset: %d %i %u %x %X %p %s %c %%, the '0' and '-' flags, a field
+// width and the l, ll and z length modifiers. Return the length the whole
+// output would have had, like snprintf.
+int kvsnprintf(char* buffer, size_t size, const char* format, va_list args);
+int ksnprintf(char* buffer, size_t size, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// Format on the stack and hand the result to the UART in one write
+int kvprintf(const char* format, va_list args);
+int kprintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+#endif // IO_H
@@ -0,0 +1,32 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+
+#define IRQ_MAX 128 // Interrupt IDs handlers can be registered for
+
+typedef void (*irq_handler_t)(uint32_t irq);
+
+// Registers at the time of a fault, as saved by src/boot/vectors.S
+typedef struct {
+    uint64_t x[31];
+    uint64_t sp;
+    uint64_t elr;
+    uint64_t spsr;
+    uint64_t esr;
+    uint64_t far;
+} exception_frame_t;
+
+void irq_init(void);
+int irq_register(uint32_t irq, irq_handler_t handler);
+
+// For the interrupt being served: the counter value read as the exception
+// vector was entered, and the PC it interrupted
+uint64_t irq_entry_time(void);
+uint64_t irq_interrupted_pc(void);
+
+// Entry points for src/boot/vectors.S
+void irq_handle(uint64_t entry_time, uint64_t pc);
+void exception_fault(uint64_t kind, const exception_frame_t* frame);
+
+#endif // IRQ_H
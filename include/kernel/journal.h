@@ -0,0 +1,26 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include "kernel/blkdev.h"
+
+// A write-ahead log of metadata sector images in a fixed region of a device.
+// Transactions are appended from the start of the region until the owner
+// checkpoints and resets it.
+typedef struct {
+    blkdev_t* dev;
+    uint32_t start;    // First sector of the journal region
+    uint32_t sectors;  // Length of the region
+    uint32_t head;     // Next sector to write, relative to 'start'
+    uint32_t sequence; // Sequence of the next transaction
+} journal_t;
+
+// Produce the current image of the index'th home sector passed to journal_commit
+typedef void (*journal_fill_t)(uint32_t index, uint8_t* image);
+
+void journal_open(journal_t* journal, blkdev_t* dev, uint32_t start, uint32_t sectors, uint32_t sequence);
+int journal_replay(journal_t* journal);
+int journal_commit(journal_t* journal, const uint32_t* homes, uint32_t count, journal_fill_t fill);
+void journal_reset(journal_t* journal);
+
+#endif // JOURNAL_H
@@ -0,0 +1,17 @@
+#ifndef KSYMS_H
+#define KSYMS_H
+
+#include <stdint.h>
+
+// Kernel function symbols, generated from the first pass of the kernel link
+// by tools/mkksyms and linked into the .ksyms section by the second
+
+uint32_t ksyms_count(void);
+// Index of the function containing 'address', or -1 outside the kernel text
+int ksyms_index(uint64_t address);
+const char* ksyms_name(int index);
+uint64_t ksyms_address(int index);
+// Name of the function containing 'address' and the offset into it, or NULL
+const char* ksyms_lookup(uint64_t address, uint64_t* offset);
+
+#endif // KSYMS_H
@@ -0,0 +1,58 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "kernel/io.h"
+
+// Levels are plain numbers so LOG_LEVEL can be tested with #if
+#define LOG_ERROR 0
+#define LOG_WARN  1
+#define LOG_INFO  2
+#define LOG_DEBUG 3
+
+// Calls above this level compile to nothing, arguments included. Set it with
+// e.g. make LOG_LEVEL=LOG_DEBUG.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_INFO
+#endif
+
+typedef enum {
+    LOG_BOOT,  // Bring-up: kernel.c, device tree, interrupts, devices
+    LOG_PMM,   // Page allocator, slab and MMU
+    LOG_FS,    // File system, journal, buffer cache and block devices
+    LOG_SHELL,
+    LOG_SUBSYSTEMS
+} log_subsystem_t;
+
+void log_write(log_subsystem_t subsystem, int level, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// Runtime threshold per subsystem; starts at LOG_LEVEL and can only let
+// through what was compiled in
+int log_get_level(log_subsystem_t subsystem);
+void log_set_level(log_subsystem_t subsystem, int level);
+const char* log_subsystem_name(log_subsystem_t subsystem);
+const char* log_level_name(int level);
+int log_parse_subsystem(const char* name); // -1 when unknown
+int log_parse_level(const char* name);     // -1 when unknown
+
+#define log_error(subsystem, ...) log_write(subsystem, LOG_ERROR, __VA_ARGS__)
+
+#if LOG_LEVEL >= LOG_WARN
+#define log_warn(subsystem, ...) log_write(subsystem, LOG_WARN, __VA_ARGS__)
+#else
+#define log_warn(subsystem, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_INFO
+#define log_info(subsystem, ...) log_write(subsystem, LOG_INFO, __VA_ARGS__)
+#else
+#define log_info(subsystem, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_DEBUG
+#define log_debug(subsystem, ...) log_write(subsystem, LOG_DEBUG, __VA_ARGS__)
+#else
+#define log_debug(subsystem, ...) ((void)0)
+#endif
+
+#endif // LOG_H
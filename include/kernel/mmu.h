@@ -0,0 +1,10 @@
+#ifndef MMU_H
+#define MMU_H
+
+#include <stdint.h>
+#include "kernel/fdt.h"
+
+void mmu_init(const fdt_memory_map_t* map);
+int mmu_is_enabled(void);
+
+#endif // MMU_H
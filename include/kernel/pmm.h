@@ -2,10 +2,45 @@
 #define PMM_H
 
 #include <stdint.h>
+#include "kernel/fdt.h"
 
-void pmm_init(uint64_t mem_size);
+#define PAGE_SIZE 4096
+#define PMM_MAX_ORDER 11 // Orders 0..10, largest block is 4 MB
+#define PMM_ZERO_POOL_MAX 512 // Upper bound for the pre-zeroed page pool depth
+
+typedef struct {
+    uint64_t total_pages;
+    uint64_t free_pages;
+    uint64_t used_pages;
+    uint64_t free_blocks[PMM_MAX_ORDER]; // Free blocks currently held at each order
+    uint64_t allocs[PMM_MAX_ORDER];      // Successful allocations per requested order
+    uint64_t frees[PMM_MAX_ORDER];       // Frees per order
+    uint64_t failed_allocs;
+} pmm_stats_t;
+
+typedef struct {
+    unsigned int depth; // Pages the pool is refilled up to
+    unsigned int count; // Pages currently in the pool
+    uint64_t hits;      // Zeroed allocations served from the pool
+    uint64_t misses;    // Zeroed allocations that had to zero on the spot
+} pmm_zero_pool_stats_t;
+
+void pmm_init(const fdt_memory_map_t* map);
 void* pmm_alloc_page();
 void pmm_free_page(void* page_address);
+void* pmm_alloc_pages(unsigned int order);
+void pmm_free_pages(void* address, unsigned int order);
+unsigned int pmm_size_to_order(uint64_t size);
+void* pmm_alloc_zeroed_page(void);
+unsigned int pmm_zero_pool_refill(unsigned int budget);
+void pmm_zero_pool_set_depth(unsigned int depth);
+void pmm_zero_pool_get_stats(pmm_zero_pool_stats_t* stats);
 uint64_t pmm_get_free_memory();
+uint64_t pmm_get_total_memory(void);
+uint64_t pmm_get_metadata_size(void);
+void pmm_get_stats(pmm_stats_t* stats);
+unsigned int pmm_zone_count(void);
+int pmm_get_zone_stats(unsigned int zone_index, uint64_t* base, pmm_stats_t* stats);
+int pmm_audit(void);
 
 #endif // PMM_H
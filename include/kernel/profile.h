@@ -0,0 +1,21 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+#define PROFILE_TIMER_HZ 1000          // Default timer sampling rate
+#define PROFILE_PMU_PERIOD 1000000     // Default CPU cycles between PMU samples
+#define PROFILE_REPORT_LINES 20
+
+typedef enum {
+    PROFILE_TIMER, // Generic timer tick; takes the timer over while profiling
+    PROFILE_PMU,   // Overflow of a PMU event counter counting CPU cycles
+} profile_source_t;
+
+// 'rate' is samples per second for the timer, cycles per sample for the PMU;
+// 0 picks the default. Starting clears the previous profile.
+int profile_start(profile_source_t source, uint32_t rate);
+void profile_stop(void);
+void profile_report(void);
+
+#endif // PROFILE_H
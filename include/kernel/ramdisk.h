@@ -0,0 +1,9 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include <stdint.h>
+#include "kernel/blkdev.h"
+
+blkdev_t* ramdisk_create(uint64_t size);
+
+#endif // RAMDISK_H
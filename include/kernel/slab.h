@@ -0,0 +1,43 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define KMEM_NAME_LENGTH 16
+#define KMALLOC_MIN_SIZE 16
+#define KMALLOC_MAX_SIZE 2048 // Larger kmalloc requests go straight to the PMM
+
+typedef void (*kmem_ctor_t)(void* object);
+
+typedef struct kmem_cache kmem_cache_t;
+
+typedef struct {
+    char name[KMEM_NAME_LENGTH];
+    uint32_t object_size;
+    uint32_t objects_per_slab;
+    uint64_t slabs;
+    uint64_t active_objects;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t hits;   // Allocations served from a slab the cache already had
+    uint64_t misses; // Allocations that needed a new page from the PMM
+    uint64_t pages_released;
+} kmem_cache_stats_t;
+
+void slab_init(void);
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size, uint32_t align, kmem_ctor_t ctor);
+void kmem_cache_destroy(kmem_cache_t* cache);
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* object);
+uint64_t kmem_cache_shrink(kmem_cache_t* cache);
+uint64_t slab_reclaim(void);
+
+void* kmalloc(size_t size);
+void* kzalloc(size_t size);
+void kfree(void* ptr);
+
+// Iterate over caches: returns 0 and fills 'stats' for cache 'index', -1 past the end
+int kmem_cache_get_stats(unsigned int index, kmem_cache_stats_t* stats);
+
+#endif // SLAB_H
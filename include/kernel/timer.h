@@ -0,0 +1,46 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#define TIMER_IRQ 27 // EL1 virtual timer: PPI 11 on the QEMU virt GIC
+#define TIMER_LATENCY_BUCKETS 32
+
+typedef void (*timer_handler_t)(void);
+
+typedef enum {
+    TIMER_OFF,
+    TIMER_PERIODIC,
+    TIMER_ONESHOT,
+} timer_mode_t;
+
+// Interrupt latency: counter ticks from the timer's compare value to the
+// exception vector being entered. Bucket n counts latencies below 2^n ticks
+// and not below 2^(n-1); the last one also takes everything longer.
+typedef struct {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t total;
+    uint64_t buckets[TIMER_LATENCY_BUCKETS];
+} timer_latency_t;
+
+typedef struct {
+    timer_mode_t mode;
+    uint64_t period; // Counter ticks between periodic interrupts
+    uint64_t ticks;  // Timer interrupts taken
+    uint64_t missed; // Periodic deadlines that passed before the interrupt was served
+} timer_stats_t;
+
+void timer_init(void);
+int timer_start_periodic(uint32_t hz);
+int timer_start_oneshot(uint64_t us);
+void timer_stop(void);
+void timer_set_handler(timer_handler_t handler); // Called on every tick, in IRQ context
+void timer_get_stats(timer_stats_t* stats);
+void timer_get_latency(timer_latency_t* latency);
+void timer_reset_latency(void);
+uint64_t timer_ticks_to_ns(uint64_t ticks);
+void timer_delay_us(uint64_t us);
+
+#endif // TIMER_H
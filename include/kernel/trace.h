@@ -0,0 +1,46 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "kernel/trace_format.h"
+
+#define TRACE_RECORDS 2048 // Power of two; the oldest records are overwritten
+
+// Bit n enables event n. A disabled tracepoint costs a load and a branch, and
+// its arguments are not evaluated.
+extern uint32_t trace_mask;
+
+static inline int trace_enabled(trace_event_t event) {
+    return __builtin_expect((trace_mask >> event) & 1, 0);
+}
+
+void trace_record(trace_event_t event, uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3);
+void trace_record_text(trace_event_t event, uint64_t arg, const char* text);
+
+#define trace_point(event, arg0, arg1, arg2, arg3)               \
+    do {                                                         \
+        if (trace_enabled(event)) {                              \
+            trace_record(event, arg0, arg1, arg2, arg3);         \
+        }                                                        \
+    } while (0)
+
+// 'text' is cut to TRACE_TEXT_LENGTH bytes
+#define trace_point_text(event, arg, text)                       \
+    do {                                                         \
+        if (trace_enabled(event)) {                              \
+            trace_record_text(event, arg, text);                 \
+        }                                                        \
+    } while (0)
+
+void trace_enable(uint32_t mask);
+void trace_disable(uint32_t mask);
+void trace_clear(void);
+uint64_t trace_count(void); // Records written since the last clear, overwritten ones included
+int trace_parse_event(const char* name); // -1 when unknown
+const char* trace_event_name(trace_event_t event);
+
+// Print the ring oldest first, decoded or in the trace_format.h text form
+void trace_dump(void);
+void trace_dump_raw(void);
+
+#endif // TRACE_H
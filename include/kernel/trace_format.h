@@ -0,0 +1,82 @@
+#ifndef TRACE_FORMAT_H
+#define TRACE_FORMAT_H
+
+// Trace records, shared by the kernel and tools/tracedecode. The kernel keeps
+// them in a ring in RAM; "trace raw" prints the ring oldest first as
+//
+//   TRACE <counter frequency in Hz> <records>
+//   T <timestamp> <event> <arg0> <arg1> <arg2> <arg3>
+//
+// with every T field in hex, one line per record, so a console log captured
+// on the host can be turned back into records and decoded there.
+
+#include <stdint.h>
+
+#define TRACE_ARGS 4
+#define TRACE_TEXT_LENGTH 24 // Bytes of text in args 1-3 of text events
+
+// Arguments of each event
+typedef enum {
+    TRACE_PMM_ALLOC,  // Page address (0 on failure), order
+    TRACE_PMM_FREE,   // Page address, order
+    TRACE_FIND_ENTRY, // Inode or -1; text: path
+    TRACE_FS_READ,    // fs_read and fs_pread: inode, offset, size, result
+    TRACE_FS_WRITE,   // fs_write and fs_pwrite: inode, offset, size, result
+    TRACE_SHELL,      // Command length; text: command line
+    TRACE_EVENTS
+} trace_event_t;
+
+#define TRACE_EVENT_NAMES { "pmm_alloc", "pmm_free", "find_entry", "fs_read", "fs_write", "shell" }
+
+// What an event's printf format is given: its four arguments, or its text
+// followed by args[0]. Where args[0] is the full text length, text that was
+// cut short ends in "...".
+typedef enum {
+    TRACE_LAYOUT_ARGS,
+    TRACE_LAYOUT_TEXT,
+    TRACE_LAYOUT_TEXT_LENGTH,
+} trace_layout_t;
+
+typedef struct {
+    trace_layout_t layout;
+    const char* format;
+} trace_event_format_t;
+
+// How "trace dump" and tools/tracedecode describe each event, indexed like
+// TRACE_EVENT_NAMES. Arguments are passed as unsigned long long, so the
+// formats use ll, which ksnprintf and the host's snprintf both take.
+#define TRACE_EVENT_FORMATS {                                          \
+    { TRACE_LAYOUT_ARGS, "page 0x%llx order %llu" },                   \
+    { TRACE_LAYOUT_ARGS, "page 0x%llx order %llu" },                   \
+    { TRACE_LAYOUT_TEXT, "\"%s\" -> %lld" },                            \
+    { TRACE_LAYOUT_ARGS, "inode %llu offset %llu size %llu -> %lld" }, \
+    { TRACE_LAYOUT_ARGS, "inode %llu offset %llu size %llu -> %lld" }, \
+    { TRACE_LAYOUT_TEXT_LENGTH, "\"%s\"" },                             \
+}
+
+typedef struct {
+    uint64_t timestamp; // CNTVCT_EL0
+    uint32_t event;
+    uint32_t reserved;
+    uint64_t args[TRACE_ARGS];
+} trace_record_t;
+
+#define TRACE_TEXT_SIZE (TRACE_TEXT_LENGTH + 4) // Room for "..." and the terminator
+
+// Unpack the text of a text event into 'text', TRACE_TEXT_SIZE bytes
+static inline void trace_event_text(const trace_record_t* record, trace_layout_t layout, char* text) {
+    const char* packed = (const char*)&record->args[1];
+    int length = 0;
+    while (length < TRACE_TEXT_LENGTH && packed[length]) {
+        text[length] = packed[length];
+        length++;
+    }
+    if (layout == TRACE_LAYOUT_TEXT_LENGTH && record->args[0] > TRACE_TEXT_LENGTH) {
+        for (int i = 0; i < 3; i++) {
+            text[length++] = '.';
+        }
+    }
+    text[length] = '\0';
+}
+
+#endif // TRACE_FORMAT_H
@@ -1,9 +1,15 @@
 #ifndef UART_H
 #define UART_H
 
+#include <stddef.h>
+
 void uart_init(void);
+void uart_irq_init(void);
 void uart_putc(unsigned char c);
 unsigned char uart_getc(void);
+int uart_poll(void);
 void uart_puts(const char* str);
+void uart_write(const char* data, size_t size);
+void uart_flush(void);
 
 #endif // UART_H
\ No newline at end of file
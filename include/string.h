@@ -7,6 +7,8 @@ int strcmp(const char *s1, const char *s2);
 char *strncpy(char *dest, const char *src, size_t n);
 void *memset(void *s, int c, size_t n);
 void *memcpy(void *dest, const void *src, size_t n);
+void *memmove(void *dest, const void *src, size_t n);
+int memcmp(const void *s1, const void *s2, size_t n);
 char *strcpy(char *dest, const char *src);
 char *strcat(char *dest, const char *src);
 char *strchr(const char *s, int c);
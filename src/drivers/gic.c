@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include "kernel/gic.h"
+#include "kernel/log.h"
+
+// GICv2 on the QEMU virt board: distributor and CPU interface
+#define GICD_BASE 0x08000000
+#define GICC_BASE 0x08010000
+
+#define GICD_CTLR       0x000
+#define GICD_TYPER      0x004
+#define GICD_ISENABLER  0x100
+#define GICD_ICENABLER  0x180
+#define GICD_ICPENDR    0x280
+#define GICD_IPRIORITYR 0x400
+#define GICD_ITARGETSR  0x800
+#define GICD_ICFGR      0xC00
+
+#define GICC_CTLR 0x000
+#define GICC_PMR  0x004
+#define GICC_BPR  0x008
+#define GICC_IAR  0x00C
+#define GICC_EOIR 0x010
+
+#define GIC_FIRST_SPI 32
+#define GIC_PRIORITY 0xA0      // Every interrupt at the same priority: no preemption
+#define GIC_PRIORITY_MASK 0xF0 // Lets GIC_PRIORITY through
+
+static inline volatile uint32_t* gicd(uint32_t reg) {
+    return (volatile uint32_t*)(uintptr_t)(GICD_BASE + reg);
+}
+
+static inline volatile uint32_t* gicc(uint32_t reg) {
+    return (volatile uint32_t*)(uintptr_t)(GICC_BASE + reg);
+}
+
+// Route every shared interrupt to CPU 0 as level-triggered, all disabled
+void gic_init(void) {
+    *gicd(GICD_CTLR) = 0;
+    uint32_t lines = 32 * ((*gicd(GICD_TYPER) & 0x1F) + 1);
+
+    for (uint32_t i = 0; i < lines / 32; i++) {
+        *gicd(GICD_ICENABLER + i * 4) = 0xFFFFFFFF;
+        *gicd(GICD_ICPENDR + i * 4) = 0xFFFFFFFF;
+    }
+    for (uint32_t i = 0; i < lines / 4; i++) {
+        *gicd(GICD_IPRIORITYR + i * 4) = GIC_PRIORITY * 0x01010101u;
+    }
+    for (uint32_t i = GIC_FIRST_SPI / 4; i < lines / 4; i++) {
+        *gicd(GICD_ITARGETSR + i * 4) = 0x01010101; // CPU 0
+    }
+    for (uint32_t i = GIC_FIRST_SPI / 16; i < lines / 16; i++) {
+        *gicd(GICD_ICFGR + i * 4) = 0; // Level-sensitive
+    }
+    *gicd(GICD_CTLR) = 1;
+
+    *gicc(GICC_PMR) = GIC_PRIORITY_MASK;
+    *gicc(GICC_BPR) = 0;
+    *gicc(GICC_CTLR) = 1;
+
+    log_info(LOG_BOOT, "GIC: %u interrupt lines\n", lines);
+}
+
+void gic_enable(uint32_t irq) {
+    *gicd(GICD_ISENABLER + (irq / 32) * 4) = 1u << (irq % 32);
+}
+
+void gic_disable(uint32_t irq) {
+    *gicd(GICD_ICENABLER + (irq / 32) * 4) = 1u << (irq % 32);
+}
+
+// Claim the highest priority pending interrupt. The low 10 bits are its ID;
+// the whole value goes back to gic_end.
+uint32_t gic_acknowledge(void) {
+    return *gicc(GICC_IAR);
+}
+
+void gic_end(uint32_t iar) {
+    *gicc(GICC_EOIR) = iar;
+}
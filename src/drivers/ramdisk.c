@@ -0,0 +1,139 @@
+#include "kernel/ramdisk.h"
+#include "kernel/pmm.h"
+#include "kernel/slab.h"
+#include "kernel/log.h"
+#include "string.h"
+
+#define SECTORS_PER_PAGE (PAGE_SIZE / BLK_SECTOR_SIZE)
+#define RAMDISK_QUEUE_DEPTH 256 // Advisory; submit never refuses a request
+
+// A block device in PMM pages. Pages are allocated on the first write to them and
+// returned on discard, so unwritten sectors cost nothing and read as zeros.
+// Submit only queues requests; the next poll carries them out.
+typedef struct {
+    blkdev_t dev;
+    uint8_t** pages;
+    uint64_t page_count;
+    uint64_t pages_used;
+    blk_request_t* queue; // Submitted requests waiting for poll
+    blk_request_t* queue_tail;
+} ramdisk_t;
+
+static unsigned int ramdisk_count;
+
+// Copy 'length' bytes between 'buffer' and the disk from byte 'offset'
+static int ramdisk_copy(ramdisk_t* rd, uint64_t offset, uint8_t* buffer, uint32_t length, int write) {
+    while (length > 0) {
+        uint64_t page = offset / PAGE_SIZE;
+        uint32_t within = offset % PAGE_SIZE;
+        uint32_t chunk = PAGE_SIZE - within < length ? PAGE_SIZE - within : length;
+        if (write) {
+            if (!rd->pages[page]) {
+                rd->pages[page] = pmm_alloc_page();
+                if (!rd->pages[page]) {
+                    return -1;
+                }
+                rd->pages_used++;
+                if (chunk != PAGE_SIZE) {
+                    memset(rd->pages[page], 0, PAGE_SIZE);
+                }
+            }
+            memcpy(rd->pages[page] + within, buffer, chunk);
+        } else if (rd->pages[page]) {
+            memcpy(buffer, rd->pages[page] + within, chunk);
+        } else {
+            memset(buffer, 0, chunk);
+        }
+        buffer += chunk;
+        offset += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+static unsigned int ramdisk_submit(blkdev_t* dev, blk_request_t** requests, unsigned int count) {
+    ramdisk_t* rd = dev->driver;
+    for (unsigned int i = 0; i < count; i++) {
+        blk_request_t* request = requests[i];
+        request->status = BLK_PENDING;
+        request->next = NULL;
+        if (rd->queue_tail) {
+            rd->queue_tail->next = request;
+        } else {
+            rd->queue = request;
+        }
+        rd->queue_tail = request;
+    }
+    return count;
+}
+
+static unsigned int ramdisk_poll(blkdev_t* dev) {
+    ramdisk_t* rd = dev->driver;
+    unsigned int completed = 0;
+    while (rd->queue) {
+        blk_request_t* request = rd->queue;
+        rd->queue = request->next;
+        if (!rd->queue) {
+            rd->queue_tail = NULL;
+        }
+
+        uint64_t offset = request->sector * BLK_SECTOR_SIZE;
+        int status = BLK_OK;
+        for (uint32_t s = 0; s < request->segment_count && status == BLK_OK; s++) {
+            blk_segment_t* segment = &request->segments[s];
+            if (offset + segment->length > dev->sectors * BLK_SECTOR_SIZE ||
+                ramdisk_copy(rd, offset, segment->buffer, segment->length, request->write) != 0) {
+                status = BLK_ERROR;
+            }
+            offset += segment->length;
+        }
+        request->status = status;
+        if (request->done) {
+            request->done(request);
+        }
+        completed++;
+    }
+    return completed;
+}
+
+// Return the pages wholly inside the discarded range
+static void ramdisk_discard(blkdev_t* dev, uint64_t sector, uint64_t sectors) {
+    ramdisk_t* rd = dev->driver;
+    uint64_t first = (sector + SECTORS_PER_PAGE - 1) / SECTORS_PER_PAGE;
+    uint64_t end = (sector + sectors) / SECTORS_PER_PAGE;
+    for (uint64_t page = first; page < end; page++) {
+        if (rd->pages[page]) {
+            pmm_free_page(rd->pages[page]);
+            rd->pages[page] = NULL;
+            rd->pages_used--;
+        }
+    }
+}
+
+blkdev_t* ramdisk_create(uint64_t size) {
+    uint64_t page_count = size / PAGE_SIZE;
+    ramdisk_t* rd = kzalloc(sizeof(ramdisk_t));
+    uint8_t** pages = page_count ? kzalloc(page_count * sizeof(uint8_t*)) : NULL;
+    if (!rd || !pages) {
+        log_error(LOG_FS, "RAMDISK: Failed to allocate the page table\n");
+        kfree(rd);
+        kfree(pages);
+        return NULL;
+    }
+
+    rd->pages = pages;
+    rd->page_count = page_count;
+    rd->dev.name[0] = 'r';
+    rd->dev.name[1] = 'a';
+    rd->dev.name[2] = 'm';
+    rd->dev.name[3] = '0' + ramdisk_count++;
+    rd->dev.name[4] = '\0';
+    rd->dev.sectors = page_count * SECTORS_PER_PAGE;
+    rd->dev.queue_depth = RAMDISK_QUEUE_DEPTH;
+    rd->dev.submit = ramdisk_submit;
+    rd->dev.poll = ramdisk_poll;
+    rd->dev.discard = ramdisk_discard;
+    rd->dev.driver = rd;
+    blkdev_register(&rd->dev);
+    return &rd->dev;
+}
@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include "kernel/timer.h"
+#include "kernel/irq.h"
+#include "kernel/arch.h"
+#include "kernel/log.h"
+#include "string.h"
+
+// CNTV_CTL_EL0
+#define CTL_ENABLE (1 << 0)
+#define CTL_IMASK  (1 << 1)
+
+static timer_stats_t stats;
+static timer_latency_t latency;
+static uint64_t deadline; // Compare value of the interrupt in flight
+static timer_handler_t tick_handler;
+
+static inline void write_cval(uint64_t value) {
+    __asm__ volatile("msr cntv_cval_el0, %0\n"
+                     "isb" :: "r"(value) : "memory");
+}
+
+static inline void write_ctl(uint64_t value) {
+    __asm__ volatile("msr cntv_ctl_el0, %0\n"
+                     "isb" :: "r"(value) : "memory");
+}
+
+static uint64_t us_to_ticks(uint64_t us) {
+    uint64_t freq = arch_counter_freq();
+    return us / 1000000 * freq + us % 1000000 * freq / 1000000;
+}
+
+static void latency_record(uint64_t ticks) {
+    unsigned int bucket = ticks ? 64 - __builtin_clzll(ticks) : 0;
+    if (bucket >= TIMER_LATENCY_BUCKETS) {
+        bucket = TIMER_LATENCY_BUCKETS - 1;
+    }
+    latency.buckets[bucket]++;
+    if (latency.count == 0 || ticks < latency.min) {
+        latency.min = ticks;
+    }
+    if (ticks > latency.max) {
+        latency.max = ticks;
+    }
+    latency.count++;
+    latency.total += ticks;
+}
+
+static void timer_irq(uint32_t irq) {
+    (void)irq;
+    // The timer may have fired while irq_handle was already serving an earlier
+    // interrupt; then the vector was entered before the deadline
+    uint64_t entry = irq_entry_time();
+    latency_record(entry >= deadline ? entry - deadline : arch_counter() - deadline);
+    stats.ticks++;
+
+    if (stats.mode == TIMER_PERIODIC) {
+        // Keep to the original schedule, skipping deadlines that already passed
+        uint64_t now = arch_counter();
+        deadline += stats.period;
+        while (deadline <= now) {
+            deadline += stats.period;
+            stats.missed++;
+        }
+        write_cval(deadline);
+    } else {
+        stats.mode = TIMER_OFF;
+        write_ctl(CTL_IMASK);
+    }
+
+    if (tick_handler) {
+        tick_handler();
+    }
+}
+
+void timer_init(void) {
+    write_ctl(CTL_IMASK);
+    irq_register(TIMER_IRQ, timer_irq);
+    log_info(LOG_BOOT, "TIMER: Generic timer at %lu Hz\n", arch_counter_freq());
+}
+
+int timer_start_periodic(uint32_t hz) {
+    uint64_t freq = arch_counter_freq();
+    if (hz == 0 || hz > freq) {
+        return -1;
+    }
+    uint64_t daif = arch_irq_save();
+    stats.mode = TIMER_PERIODIC;
+    stats.period = freq / hz;
+    deadline = arch_counter() + stats.period;
+    write_cval(deadline);
+    write_ctl(CTL_ENABLE);
+    arch_irq_restore(daif);
+    return 0;
+}
+
+int timer_start_oneshot(uint64_t us) {
+    uint64_t daif = arch_irq_save();
+    stats.mode = TIMER_ONESHOT;
+    stats.period = 0;
+    deadline = arch_counter() + us_to_ticks(us);
+    write_cval(deadline);
+    write_ctl(CTL_ENABLE);
+    arch_irq_restore(daif);
+    return 0;
+}
+
+void timer_stop(void) {
+    uint64_t daif = arch_irq_save();
+    stats.mode = TIMER_OFF;
+    write_ctl(CTL_IMASK);
+    arch_irq_restore(daif);
+}
+
+void timer_set_handler(timer_handler_t handler) {
+    tick_handler = handler;
+}
+
+void timer_get_stats(timer_stats_t* out) {
+    uint64_t daif = arch_irq_save();
+    *out = stats;
+    arch_irq_restore(daif);
+}
+
+void timer_get_latency(timer_latency_t* out) {
+    uint64_t daif = arch_irq_save();
+    *out = latency;
+    arch_irq_restore(daif);
+}
+
+void timer_reset_latency(void) {
+    uint64_t daif = arch_irq_save();
+    memset(&latency, 0, sizeof(latency));
+    arch_irq_restore(daif);
+}
+
+uint64_t timer_ticks_to_ns(uint64_t ticks) {
+    uint64_t freq = arch_counter_freq();
+    return ticks / freq * 1000000000 + ticks % freq * 1000000000 / freq;
+}
+
+// Busy-wait on the counter; usable before interrupts are up
+void timer_delay_us(uint64_t us) {
+    uint64_t end = arch_counter() + us_to_ticks(us);
+    while (arch_counter() < end);
+}
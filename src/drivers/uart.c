@@ -1,6 +1,9 @@
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include "kernel/uart.h"
+#include "kernel/irq.h"
+#include "kernel/arch.h"
 
 // UART registers
 #define UART0_BASE 0x09000000
@@ -10,7 +13,63 @@
 #define UART0_FBRD (UART0_BASE + 0x28)
 #define UART0_LCRH (UART0_BASE + 0x2C)
 #define UART0_CR   (UART0_BASE + 0x30)
+#define UART0_IFLS (UART0_BASE + 0x34)
 #define UART0_IMSC (UART0_BASE + 0x38)
+#define UART0_MIS  (UART0_BASE + 0x40)
+#define UART0_ICR  (UART0_BASE + 0x44)
+
+#define UART0_IRQ 33 // SPI 1 on the QEMU virt GIC
+
+#define FR_BUSY (1 << 3)
+#define FR_RXFE (1 << 4)
+#define FR_TXFF (1 << 5)
+#define INT_RX (1 << 4)
+#define INT_TX (1 << 5)
+#define INT_RT (1 << 6) // Receive timeout: bytes below the RX threshold sat in the FIFO
+#define IFLS_HALF 2     // Interrupt at the FIFO half way mark, for both directions
+
+#define UART_RING_SIZE 4096 // Power of two
+
+// Single-producer single-consumer byte ring. Head and tail run freely and
+// each is only written by its own side; the release store publishing one and
+// the acquire load reading the other order the data accesses around them.
+typedef struct {
+    uint8_t data[UART_RING_SIZE];
+    uint32_t head; // Written by the producer
+    uint32_t tail; // Written by the consumer
+} uart_ring_t;
+
+// TX: print() produces, the interrupt handler consumes. Interrupt handlers
+// print too, so uart_write masks IRQs to keep to a single producer at a time.
+// RX: the interrupt handler produces, uart_getc() consumes.
+static uart_ring_t tx_ring;
+static uart_ring_t rx_ring;
+static bool irq_mode;          // The rings are in use; before uart_irq_init everything polls
+static volatile bool tx_active; // TX interrupt unmasked, the handler is draining tx_ring
+
+static bool ring_push(uart_ring_t* ring, uint8_t c) {
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == UART_RING_SIZE) {
+        return false;
+    }
+    ring->data[head % UART_RING_SIZE] = c;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool ring_pop(uart_ring_t* ring, uint8_t* c) {
+    uint32_t tail = ring->tail;
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+        return false;
+    }
+    *c = ring->data[tail % UART_RING_SIZE];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool ring_empty(uart_ring_t* ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
 
 void uart_init() {
     // Disable UART0
@@ -34,20 +93,148 @@ void uart_init() {
     *((volatile uint32_t*)(UART0_DR)) = 'D';
 }
 
+// Move queued bytes into the TX FIFO until it is full or the ring is empty,
+// and leave the TX interrupt unmasked only while bytes remain. Runs with IRQs
+// masked, which keeps it the ring's only consumer.
+static void uart_tx_fill(void) {
+    uint8_t c;
+    while (!(*((volatile uint32_t*)(UART0_FR)) & FR_TXFF) && ring_pop(&tx_ring, &c)) {
+        *((volatile uint32_t*)(UART0_DR)) = c;
+    }
+    if (ring_empty(&tx_ring)) {
+        *((volatile uint32_t*)(UART0_IMSC)) &= ~INT_TX;
+        tx_active = false;
+    } else {
+        *((volatile uint32_t*)(UART0_IMSC)) |= INT_TX;
+        tx_active = true;
+    }
+}
+
+// The TX ring is full and draining: wait for room. Runs with IRQs masked;
+// 'daif' is the mask state from before the caller masked them. WFI still
+// wakes for the TX interrupt, and the handler makes room once the caller
+// restores 'daif'. A caller that had IRQs masked already gets no handler, so
+// push bytes out by polling instead.
+static void uart_tx_wait(uint64_t daif) {
+    if (daif & DAIF_I) {
+        while (*((volatile uint32_t*)(UART0_FR)) & FR_TXFF);
+        uart_tx_fill();
+    } else if (tx_ring.head - tx_ring.tail == UART_RING_SIZE) {
+        arch_wait_for_interrupt();
+    }
+}
+
+static void uart_irq(uint32_t irq) {
+    (void)irq;
+    uint32_t status = *((volatile uint32_t*)(UART0_MIS));
+    // Clear first: refilling the TX FIFO below may raise the next TX interrupt
+    *((volatile uint32_t*)(UART0_ICR)) = status;
+    if (status & (INT_RX | INT_RT)) {
+        while (!(*((volatile uint32_t*)(UART0_FR)) & FR_RXFE)) {
+            uint8_t c = *((volatile uint32_t*)(UART0_DR));
+            ring_push(&rx_ring, c); // Dropped when nobody has read the last 4 KB
+        }
+    }
+    if (status & INT_TX) {
+        uart_tx_fill();
+    }
+}
+
+// Switch from polling to the interrupt-driven rings. Needs irq_init first.
+void uart_irq_init(void) {
+    *((volatile uint32_t*)(UART0_IFLS)) = (IFLS_HALF << 3) | IFLS_HALF;
+    *((volatile uint32_t*)(UART0_ICR)) = 0x7FF;
+    *((volatile uint32_t*)(UART0_IMSC)) = INT_RX | INT_RT;
+    irq_mode = true;
+    irq_register(UART0_IRQ, uart_irq);
+}
+
+// Queue a byte; returns at once unless the TX ring is full
 void uart_putc(unsigned char c) {
-    // Wait for UART to become ready to transmit
-    while (*((volatile uint32_t*)(UART0_FR)) & (1 << 5));
-    *((volatile uint32_t*)(UART0_DR)) = c;
+    uart_write((const char*)&c, 1);
+}
+
+// Queue a buffer and kick the transmitter. Bytes are pushed with IRQs masked,
+// so a message that fits in the ring is never split by output from an
+// interrupt handler. A longer one is queued as room appears, with IRQs back
+// on while waiting for it.
+void uart_write(const char* data, size_t size) {
+    if (!irq_mode) {
+        for (size_t i = 0; i < size; i++) {
+            // Wait for UART to become ready to transmit
+            while (*((volatile uint32_t*)(UART0_FR)) & FR_TXFF);
+            *((volatile uint32_t*)(UART0_DR)) = (uint8_t)data[i];
+        }
+        return;
+    }
+    size_t done = 0;
+    while (done < size) {
+        uint64_t daif = arch_irq_save();
+        while (done < size && ring_push(&tx_ring, (uint8_t)data[done])) {
+            done++;
+        }
+        if (!tx_active) {
+            uart_tx_fill();
+        }
+        if (done < size) {
+            uart_tx_wait(daif);
+        }
+        arch_irq_restore(daif);
+    }
 }
 
+// Wait for a received byte, sleeping in WFI while there is none
 unsigned char uart_getc() {
-    // Wait for UART to have received something
-    while (*((volatile uint32_t*)(UART0_FR)) & (1 << 4));
-    return *((volatile uint32_t*)(UART0_DR));
+    if (!irq_mode) {
+        // Wait for UART to have received something
+        while (*((volatile uint32_t*)(UART0_FR)) & FR_RXFE);
+        return *((volatile uint32_t*)(UART0_DR));
+    }
+    uint8_t c;
+    while (!ring_pop(&rx_ring, &c)) {
+        uint64_t daif = arch_irq_save();
+        if (!(daif & DAIF_I) && ring_empty(&rx_ring)) {
+            arch_wait_for_interrupt();
+        }
+        arch_irq_restore(daif);
+        // Nothing fills the ring while the caller has IRQs masked: read the FIFO
+        if ((daif & DAIF_I) && !(*((volatile uint32_t*)(UART0_FR)) & FR_RXFE)) {
+            return *((volatile uint32_t*)(UART0_DR));
+        }
+    }
+    return c;
+}
+
+int uart_poll() {
+    if (irq_mode) {
+        return !ring_empty(&rx_ring);
+    }
+    // Receive FIFO not empty
+    return !(*((volatile uint32_t*)(UART0_FR)) & FR_RXFE);
 }
 
 void uart_puts(const char* str) {
-    for (size_t i = 0; str[i] != '\0'; i++) {
-        uart_putc((unsigned char)str[i]);
+    size_t length = 0;
+    while (str[length] != '\0') {
+        length++;
     }
-}
\ No newline at end of file
+    uart_write(str, length);
+}
+
+// Wait until everything queued has left the UART, e.g. before shutting down
+// or halting
+void uart_flush(void) {
+    while (irq_mode && !ring_empty(&tx_ring)) {
+        uint64_t daif = arch_irq_save();
+        if (daif & DAIF_I) {
+            while (*((volatile uint32_t*)(UART0_FR)) & FR_TXFF);
+            uart_tx_fill();
+        } else if (tx_active && !ring_empty(&tx_ring)) {
+            arch_wait_for_interrupt();
+        } else {
+            uart_tx_fill();
+        }
+        arch_irq_restore(daif);
+    }
+    while (*((volatile uint32_t*)(UART0_FR)) & FR_BUSY);
+}
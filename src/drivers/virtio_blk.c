@@ -0,0 +1,334 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "kernel/virtio_blk.h"
+#include "kernel/blkdev.h"
+#include "kernel/pmm.h"
+#include "kernel/slab.h"
+#include "kernel/arch.h"
+#include "kernel/log.h"
+#include "string.h"
+
+// virtio-mmio transports on the QEMU virt machine
+#define VIRTIO_MMIO_BASE   0x0a000000
+#define VIRTIO_MMIO_STRIDE 0x200
+#define VIRTIO_MMIO_COUNT  32
+
+// virtio-mmio registers
+#define VIRTIO_MAGIC               0x000
+#define VIRTIO_VERSION             0x004
+#define VIRTIO_DEVICE_ID           0x008
+#define VIRTIO_DEVICE_FEATURES     0x010
+#define VIRTIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_DRIVER_FEATURES     0x020
+#define VIRTIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_GUEST_PAGE_SIZE     0x028 // Legacy only
+#define VIRTIO_QUEUE_SEL           0x030
+#define VIRTIO_QUEUE_NUM_MAX       0x034
+#define VIRTIO_QUEUE_NUM           0x038
+#define VIRTIO_QUEUE_ALIGN         0x03c // Legacy only
+#define VIRTIO_QUEUE_PFN           0x040 // Legacy only
+#define VIRTIO_QUEUE_READY         0x044
+#define VIRTIO_QUEUE_NOTIFY        0x050
+#define VIRTIO_INTERRUPT_STATUS    0x060
+#define VIRTIO_INTERRUPT_ACK       0x064
+#define VIRTIO_STATUS              0x070
+#define VIRTIO_QUEUE_DESC_LOW      0x080
+#define VIRTIO_QUEUE_DESC_HIGH     0x084
+#define VIRTIO_QUEUE_DRIVER_LOW    0x090
+#define VIRTIO_QUEUE_DRIVER_HIGH   0x094
+#define VIRTIO_QUEUE_DEVICE_LOW    0x0a0
+#define VIRTIO_QUEUE_DEVICE_HIGH   0x0a4
+#define VIRTIO_CONFIG              0x100
+
+#define VIRTIO_MAGIC_VALUE  0x74726976 // "virt"
+#define VIRTIO_DEVICE_BLOCK 2
+
+// Device status bits
+#define STATUS_ACKNOWLEDGE 1
+#define STATUS_DRIVER      2
+#define STATUS_DRIVER_OK   4
+#define STATUS_FEATURES_OK 8
+
+#define VIRTIO_F_VERSION_1_HIGH (1 << 0) // Feature bit 32
+
+#define VIRTQ_MAX_SIZE     256
+#define VIRTQ_DESC_F_NEXT  1
+#define VIRTQ_DESC_F_WRITE 2 // Device writes this buffer
+
+#define VIRTIO_BLK_T_IN  0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_S_OK  0
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} virtq_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} virtq_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} virtq_used_elem_t;
+
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    virtq_used_elem_t ring[];
+} virtq_used_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} virtio_blk_header_t;
+
+// One device with a single split virtqueue. QEMU's DMA is coherent with the CPU
+// caches, so the rings only need ordering barriers. Per-request header and status
+// slots are indexed by the request's head descriptor.
+typedef struct {
+    blkdev_t dev;
+    uintptr_t base;
+    uint16_t size;
+    virtq_desc_t* desc;
+    virtq_avail_t* avail;
+    volatile virtq_used_t* used;
+    uint16_t free_head;
+    uint16_t free_count;
+    uint16_t last_used;
+    virtio_blk_header_t headers[VIRTQ_MAX_SIZE];
+    uint8_t statuses[VIRTQ_MAX_SIZE];
+    blk_request_t* inflight[VIRTQ_MAX_SIZE];
+} virtio_blk_t;
+
+static unsigned int device_count;
+
+static inline uint32_t virtio_read(virtio_blk_t* vb, uint32_t reg) {
+    return *(volatile uint32_t*)(vb->base + reg);
+}
+
+static inline void virtio_write(virtio_blk_t* vb, uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(vb->base + reg) = value;
+}
+
+static uint16_t desc_alloc(virtio_blk_t* vb) {
+    uint16_t index = vb->free_head;
+    vb->free_head = vb->desc[index].next;
+    vb->free_count--;
+    return index;
+}
+
+static void desc_free_chain(virtio_blk_t* vb, uint16_t head) {
+    uint16_t index = head;
+    while (1) {
+        uint16_t flags = vb->desc[index].flags;
+        uint16_t next = vb->desc[index].next;
+        vb->desc[index].next = vb->free_head;
+        vb->free_head = index;
+        vb->free_count++;
+        if (!(flags & VIRTQ_DESC_F_NEXT)) {
+            break;
+        }
+        index = next;
+    }
+}
+
+static unsigned int virtio_blk_submit(blkdev_t* dev, blk_request_t** requests, unsigned int count) {
+    virtio_blk_t* vb = dev->driver;
+    unsigned int accepted = 0;
+
+    for (; accepted < count; accepted++) {
+        blk_request_t* request = requests[accepted];
+        if (request->segment_count == 0 || request->segment_count > BLK_MAX_SEGMENTS ||
+            request->segment_count + 2 > vb->free_count) {
+            break;
+        }
+
+        // Header, data segments, then the status byte the device fills in
+        uint16_t head = desc_alloc(vb);
+        vb->headers[head].type = request->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+        vb->headers[head].reserved = 0;
+        vb->headers[head].sector = request->sector;
+        vb->desc[head].addr = (uintptr_t)&vb->headers[head];
+        vb->desc[head].len = sizeof(virtio_blk_header_t);
+        vb->desc[head].flags = VIRTQ_DESC_F_NEXT;
+
+        uint16_t prev = head;
+        for (uint32_t i = 0; i < request->segment_count; i++) {
+            uint16_t index = desc_alloc(vb);
+            vb->desc[index].addr = (uintptr_t)request->segments[i].buffer;
+            vb->desc[index].len = request->segments[i].length;
+            vb->desc[index].flags = VIRTQ_DESC_F_NEXT | (request->write ? 0 : VIRTQ_DESC_F_WRITE);
+            vb->desc[prev].next = index;
+            prev = index;
+        }
+
+        uint16_t status = desc_alloc(vb);
+        vb->statuses[head] = 0xFF;
+        vb->desc[status].addr = (uintptr_t)&vb->statuses[head];
+        vb->desc[status].len = 1;
+        vb->desc[status].flags = VIRTQ_DESC_F_WRITE;
+        vb->desc[prev].next = status;
+
+        request->status = BLK_PENDING;
+        vb->inflight[head] = request;
+        vb->avail->ring[(uint16_t)(vb->avail->idx + accepted) % vb->size] = head;
+    }
+
+    if (accepted > 0) {
+        // Descriptors must be visible before the index, and the index before the notify
+        arch_mb();
+        vb->avail->idx += accepted;
+        arch_mb();
+        virtio_write(vb, VIRTIO_QUEUE_NOTIFY, 0);
+    }
+    return accepted;
+}
+
+static unsigned int virtio_blk_poll(blkdev_t* dev) {
+    virtio_blk_t* vb = dev->driver;
+    uint32_t interrupts = virtio_read(vb, VIRTIO_INTERRUPT_STATUS);
+    if (interrupts) {
+        virtio_write(vb, VIRTIO_INTERRUPT_ACK, interrupts);
+    }
+
+    unsigned int completed = 0;
+    while (vb->last_used != vb->used->idx) {
+        arch_mb(); // Read the ring entry only after seeing the index move
+        uint16_t head = vb->used->ring[vb->last_used % vb->size].id;
+        blk_request_t* request = vb->inflight[head];
+        vb->inflight[head] = NULL;
+        desc_free_chain(vb, head);
+        vb->last_used++;
+        completed++;
+
+        if (request) {
+            request->status = vb->statuses[head] == VIRTIO_BLK_S_OK ? BLK_OK : BLK_ERROR;
+            if (request->done) {
+                request->done(request);
+            }
+        }
+    }
+    return completed;
+}
+
+static int virtio_blk_init(virtio_blk_t* vb) {
+    uint32_t version = virtio_read(vb, VIRTIO_VERSION);
+
+    virtio_write(vb, VIRTIO_STATUS, 0);
+    virtio_write(vb, VIRTIO_STATUS, STATUS_ACKNOWLEDGE);
+    virtio_write(vb, VIRTIO_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+
+    // No optional block features are needed; modern devices require VERSION_1
+    virtio_write(vb, VIRTIO_DEVICE_FEATURES_SEL, 1);
+    uint32_t features_high = virtio_read(vb, VIRTIO_DEVICE_FEATURES);
+    virtio_write(vb, VIRTIO_DRIVER_FEATURES_SEL, 0);
+    virtio_write(vb, VIRTIO_DRIVER_FEATURES, 0);
+    if (version >= 2) {
+        if (!(features_high & VIRTIO_F_VERSION_1_HIGH)) {
+            return -1;
+        }
+        virtio_write(vb, VIRTIO_DRIVER_FEATURES_SEL, 1);
+        virtio_write(vb, VIRTIO_DRIVER_FEATURES, VIRTIO_F_VERSION_1_HIGH);
+        virtio_write(vb, VIRTIO_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_FEATURES_OK);
+        if (!(virtio_read(vb, VIRTIO_STATUS) & STATUS_FEATURES_OK)) {
+            return -1;
+        }
+    } else {
+        virtio_write(vb, VIRTIO_GUEST_PAGE_SIZE, PAGE_SIZE);
+    }
+
+    virtio_write(vb, VIRTIO_QUEUE_SEL, 0);
+    uint32_t max = virtio_read(vb, VIRTIO_QUEUE_NUM_MAX);
+    if (max == 0) {
+        return -1;
+    }
+    vb->size = max < VIRTQ_MAX_SIZE ? max : VIRTQ_MAX_SIZE;
+    while (vb->size & (vb->size - 1)) {
+        vb->size &= vb->size - 1; // Ring indices wrap at 2^16, so the size must be a power of two
+    }
+
+    // Legacy layout: descriptors, then the avail ring, then the used ring on the next page
+    uint64_t avail_offset = vb->size * sizeof(virtq_desc_t);
+    uint64_t used_offset = (avail_offset + sizeof(virtq_avail_t) + (vb->size + 1) * sizeof(uint16_t) +
+                            PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    uint64_t ring_size = used_offset + sizeof(virtq_used_t) + vb->size * sizeof(virtq_used_elem_t) +
+                         sizeof(uint16_t);
+    unsigned int order = pmm_size_to_order(ring_size);
+    uint8_t* rings = pmm_alloc_pages(order);
+    if (!rings) {
+        return -1;
+    }
+    memset(rings, 0, (uint64_t)PAGE_SIZE << order);
+    vb->desc = (virtq_desc_t*)rings;
+    vb->avail = (virtq_avail_t*)(rings + avail_offset);
+    vb->used = (virtq_used_t*)(rings + used_offset);
+
+    for (uint16_t i = 0; i < vb->size; i++) {
+        vb->desc[i].next = i + 1;
+    }
+    vb->free_head = 0;
+    vb->free_count = vb->size;
+    vb->last_used = 0;
+
+    virtio_write(vb, VIRTIO_QUEUE_NUM, vb->size);
+    if (version >= 2) {
+        virtio_write(vb, VIRTIO_QUEUE_DESC_LOW, (uintptr_t)vb->desc);
+        virtio_write(vb, VIRTIO_QUEUE_DESC_HIGH, (uint64_t)(uintptr_t)vb->desc >> 32);
+        virtio_write(vb, VIRTIO_QUEUE_DRIVER_LOW, (uintptr_t)vb->avail);
+        virtio_write(vb, VIRTIO_QUEUE_DRIVER_HIGH, (uint64_t)(uintptr_t)vb->avail >> 32);
+        virtio_write(vb, VIRTIO_QUEUE_DEVICE_LOW, (uintptr_t)vb->used);
+        virtio_write(vb, VIRTIO_QUEUE_DEVICE_HIGH, (uint64_t)(uintptr_t)vb->used >> 32);
+        virtio_write(vb, VIRTIO_QUEUE_READY, 1);
+    } else {
+        virtio_write(vb, VIRTIO_QUEUE_ALIGN, PAGE_SIZE);
+        virtio_write(vb, VIRTIO_QUEUE_PFN, (uintptr_t)rings / PAGE_SIZE);
+    }
+
+    // Capacity in 512-byte sectors is the first config field
+    uint64_t capacity_low = virtio_read(vb, VIRTIO_CONFIG);
+    uint64_t capacity_high = virtio_read(vb, VIRTIO_CONFIG + 4);
+    vb->dev.sectors = capacity_low | (capacity_high << 32);
+
+    virtio_write(vb, VIRTIO_STATUS, virtio_read(vb, VIRTIO_STATUS) | STATUS_DRIVER_OK);
+    return 0;
+}
+
+void virtio_blk_probe(void) {
+    for (int slot = 0; slot < VIRTIO_MMIO_COUNT; slot++) {
+        uintptr_t base = VIRTIO_MMIO_BASE + slot * VIRTIO_MMIO_STRIDE;
+        if (*(volatile uint32_t*)(base + VIRTIO_MAGIC) != VIRTIO_MAGIC_VALUE ||
+            *(volatile uint32_t*)(base + VIRTIO_DEVICE_ID) != VIRTIO_DEVICE_BLOCK) {
+            continue;
+        }
+
+        virtio_blk_t* vb = kzalloc(sizeof(virtio_blk_t));
+        if (!vb) {
+            log_error(LOG_FS, "VIRTIO: Out of memory\n");
+            return;
+        }
+        vb->base = base;
+        if (virtio_blk_init(vb) != 0) {
+            log_error(LOG_FS, "VIRTIO: Failed to initialize block device at 0x%016lx\n", base);
+            virtio_write(vb, VIRTIO_STATUS, 0);
+            kfree(vb);
+            continue;
+        }
+
+        vb->dev.name[0] = 'v';
+        vb->dev.name[1] = 'd';
+        vb->dev.name[2] = 'a' + device_count++;
+        vb->dev.name[3] = '\0';
+        vb->dev.queue_depth = vb->size;
+        vb->dev.submit = virtio_blk_submit;
+        vb->dev.poll = virtio_blk_poll;
+        vb->dev.driver = vb;
+        blkdev_register(&vb->dev);
+    }
+}
@@ -0,0 +1,385 @@
+#include "kernel/bcache.h"
+#include "kernel/pmm.h"
+#include "kernel/slab.h"
+#include "kernel/log.h"
+#include "string.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SECTORS_PER_BLOCK (BCACHE_BLOCK_SIZE / BLK_SECTOR_SIZE)
+#define HASH_BUCKETS 256   // Power of two
+#define FLUSH_BATCH 32     // Write-back requests submitted together
+
+// One cached device block. Buffers are found by (device, block) through the
+// hash table and reclaimed by a CLOCK hand sweeping the buffer array.
+typedef struct buffer {
+    blkdev_t* dev;    // NULL while the buffer holds nothing
+    uint64_t block;
+    uint8_t* data;    // One PMM page
+    bool dirty;
+    bool referenced;  // Set on use, cleared as the clock hand passes
+    bool readahead;   // Fetched ahead of demand and not used yet
+    bool busy;        // Being filled; not a candidate for eviction
+    struct buffer* hash_next;
+} buffer_t;
+
+static buffer_t* buffers;
+static uint32_t buffer_count;
+static uint32_t clock_hand;
+static buffer_t* hash_table[HASH_BUCKETS];
+static buffer_t** flush_order; // Scratch for sorting dirty buffers
+static bcache_stats_t stats;
+
+// Last block read, to spot sequential access
+static blkdev_t* last_dev;
+static uint64_t last_block;
+
+static inline uint32_t hash_block(blkdev_t* dev, uint64_t block) {
+    return ((uint32_t)block * 2654435761u ^ (uint32_t)((uintptr_t)dev >> 4)) % HASH_BUCKETS;
+}
+
+static buffer_t* hash_lookup(blkdev_t* dev, uint64_t block) {
+    for (buffer_t* buf = hash_table[hash_block(dev, block)]; buf; buf = buf->hash_next) {
+        if (buf->dev == dev && buf->block == block) {
+            return buf;
+        }
+    }
+    return NULL;
+}
+
+static void hash_insert(buffer_t* buf) {
+    uint32_t bucket = hash_block(buf->dev, buf->block);
+    buf->hash_next = hash_table[bucket];
+    hash_table[bucket] = buf;
+}
+
+static void hash_remove(buffer_t* buf) {
+    buffer_t** link = &hash_table[hash_block(buf->dev, buf->block)];
+    while (*link != buf) {
+        link = &(*link)->hash_next;
+    }
+    *link = buf->hash_next;
+}
+
+static void buffer_drop(buffer_t* buf) {
+    hash_remove(buf);
+    buf->dev = NULL;
+    buf->dirty = false;
+    buf->readahead = false;
+}
+
+// Order by device, then by block
+static inline bool buffer_before(const buffer_t* a, const buffer_t* b) {
+    if (a->dev != b->dev) {
+        return (uintptr_t)a->dev < (uintptr_t)b->dev;
+    }
+    return a->block < b->block;
+}
+
+// Submit 'count' requests to 'dev' and wait for all of them
+static void submit_and_wait(blkdev_t* dev, blk_request_t** requests, unsigned int count) {
+    unsigned int submitted = 0;
+    while (submitted < count) {
+        submitted += blk_submit(dev, requests + submitted, count - submitted);
+        if (submitted < count) {
+            blk_poll(dev); // Queue full; make room
+        }
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        blk_wait(dev, requests[i]);
+    }
+}
+
+// Write every dirty buffer back. Sorting by block lets neighbours merge into
+// multi-segment requests and gives the device one ascending sweep per pass.
+static int bcache_flush(void) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < buffer_count; i++) {
+        if (buffers[i].dirty) {
+            // Insertion sort; dirty buffers are usually few
+            uint32_t j = count++;
+            while (j > 0 && buffer_before(&buffers[i], flush_order[j - 1])) {
+                flush_order[j] = flush_order[j - 1];
+                j--;
+            }
+            flush_order[j] = &buffers[i];
+        }
+    }
+    if (count == 0) {
+        return 0;
+    }
+    stats.flushes++;
+
+    static blk_request_t requests[FLUSH_BATCH];
+    blk_request_t* batch[FLUSH_BATCH];
+    int result = 0;
+    uint32_t next = 0;
+    while (next < count) {
+        blkdev_t* dev = flush_order[next]->dev;
+        uint32_t first = next;
+        unsigned int used = 0;
+        while (next < count && used < FLUSH_BATCH && flush_order[next]->dev == dev) {
+            blk_request_t* request = &requests[used];
+            request->sector = flush_order[next]->block * SECTORS_PER_BLOCK;
+            request->write = 1;
+            request->segment_count = 0;
+            request->status = BLK_PENDING;
+            request->done = NULL;
+            do {
+                request->segments[request->segment_count].buffer = flush_order[next]->data;
+                request->segments[request->segment_count].length = BCACHE_BLOCK_SIZE;
+                request->segment_count++;
+                next++;
+            } while (next < count && request->segment_count < BLK_MAX_SEGMENTS &&
+                     flush_order[next]->dev == dev &&
+                     flush_order[next]->block == flush_order[next - 1]->block + 1);
+            batch[used++] = request;
+        }
+        submit_and_wait(dev, batch, used);
+
+        // Requests cover the sorted buffers in order
+        for (unsigned int r = 0; r < used; r++) {
+            for (uint32_t s = 0; s < requests[r].segment_count; s++, first++) {
+                if (requests[r].status == BLK_OK) {
+                    flush_order[first]->dirty = false;
+                    stats.flush_blocks++;
+                } else {
+                    result = -1;
+                }
+            }
+        }
+        stats.flush_requests += used;
+    }
+    return result;
+}
+
+// Find a buffer to reuse. Dirty candidates trigger one write-back pass of
+// everything dirty instead of being written one at a time.
+static buffer_t* clock_victim(void) {
+    bool flushed = false;
+    for (uint32_t step = 0; step < 2 * buffer_count; step++) {
+        buffer_t* buf = &buffers[clock_hand];
+        clock_hand = (clock_hand + 1) % buffer_count;
+        if (buf->busy) {
+            continue;
+        }
+        if (buf->referenced) {
+            buf->referenced = false;
+            continue;
+        }
+        if (buf->dirty && !flushed) {
+            bcache_flush();
+            flushed = true;
+        }
+        if (buf->dirty) {
+            continue; // Its write-back failed
+        }
+        if (buf->dev) {
+            buffer_drop(buf);
+            stats.evictions++;
+        }
+        return buf;
+    }
+    return NULL;
+}
+
+// Take a buffer for 'block' of 'dev'; its contents are not valid yet
+static buffer_t* buffer_claim(blkdev_t* dev, uint64_t block) {
+    buffer_t* buf = clock_victim();
+    if (!buf) {
+        return NULL;
+    }
+    buf->dev = dev;
+    buf->block = block;
+    buf->dirty = false;
+    buf->readahead = false;
+    buf->referenced = false;
+    buf->busy = true;
+    hash_insert(buf);
+    return buf;
+}
+
+// The buffer holding 'block' of 'dev'. With 'read' false the caller overwrites
+// the whole block, so a miss skips the device read. Sequential misses also
+// fetch the following uncached blocks in the same request.
+static buffer_t* buffer_get(blkdev_t* dev, uint64_t block, bool read, bool sequential) {
+    buffer_t* buf = hash_lookup(dev, block);
+    if (buf) {
+        stats.hits++;
+        if (buf->readahead) {
+            stats.readahead_hits++;
+            buf->readahead = false;
+        }
+        buf->referenced = true;
+        return buf;
+    }
+
+    stats.misses++;
+    buf = buffer_claim(dev, block);
+    if (!buf) {
+        return NULL;
+    }
+    if (!read) {
+        buf->busy = false;
+        buf->referenced = true;
+        return buf;
+    }
+
+    buffer_t* fill[BCACHE_READAHEAD];
+    uint32_t count = 0;
+    fill[count++] = buf;
+    if (sequential) {
+        uint64_t blocks = dev->sectors / SECTORS_PER_BLOCK;
+        while (count < BCACHE_READAHEAD && block + count < blocks && !hash_lookup(dev, block + count)) {
+            buffer_t* ahead = buffer_claim(dev, block + count);
+            if (!ahead) {
+                break;
+            }
+            ahead->readahead = true;
+            fill[count++] = ahead;
+        }
+        stats.readahead += count - 1;
+    }
+
+    blk_request_t request;
+    request.sector = block * SECTORS_PER_BLOCK;
+    request.write = 0;
+    request.segment_count = count;
+    request.status = BLK_PENDING;
+    request.done = NULL;
+    for (uint32_t i = 0; i < count; i++) {
+        request.segments[i].buffer = fill[i]->data;
+        request.segments[i].length = BCACHE_BLOCK_SIZE;
+    }
+    blk_request_t* batch = &request;
+    submit_and_wait(dev, &batch, 1);
+
+    for (uint32_t i = 0; i < count; i++) {
+        fill[i]->busy = false;
+        if (request.status != BLK_OK) {
+            buffer_drop(fill[i]);
+        }
+    }
+    if (request.status != BLK_OK) {
+        return NULL;
+    }
+    buf->referenced = true;
+    return buf;
+}
+
+// Copy, write or zero bytes [offset, offset + size) of 'dev' through the cache
+static int bcache_access(blkdev_t* dev, uint64_t offset, uint8_t* buffer, uint32_t size, bool write,
+                         bool zero) {
+    if (offset + size > dev->sectors * BLK_SECTOR_SIZE) {
+        return -1;
+    }
+    while (size > 0) {
+        uint64_t block = offset / BCACHE_BLOCK_SIZE;
+        uint32_t within = offset % BCACHE_BLOCK_SIZE;
+        uint32_t chunk = BCACHE_BLOCK_SIZE - within < size ? BCACHE_BLOCK_SIZE - within : size;
+        buffer_t* buf;
+        if (write) {
+            buf = buffer_get(dev, block, chunk != BCACHE_BLOCK_SIZE, false);
+        } else {
+            buf = buffer_get(dev, block, true, dev == last_dev && block == last_block + 1);
+            last_dev = dev;
+            last_block = block;
+        }
+        if (!buf) {
+            return -1;
+        }
+
+        if (zero) {
+            memset(buf->data + within, 0, chunk);
+        } else if (write) {
+            memcpy(buf->data + within, buffer, chunk);
+        } else {
+            memcpy(buffer, buf->data + within, chunk);
+        }
+        if (write) {
+            buf->dirty = true;
+        }
+        if (buffer) {
+            buffer += chunk;
+        }
+        offset += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+int bcache_read(blkdev_t* dev, uint64_t offset, void* buffer, uint32_t size) {
+    return bcache_access(dev, offset, buffer, size, false, false);
+}
+
+int bcache_write(blkdev_t* dev, uint64_t offset, const void* buffer, uint32_t size) {
+    return bcache_access(dev, offset, (uint8_t*)buffer, size, true, false);
+}
+
+int bcache_zero(blkdev_t* dev, uint64_t offset, uint32_t size) {
+    return bcache_access(dev, offset, NULL, size, true, true);
+}
+
+// Forget cached blocks wholly inside the range without writing them back, and
+// let the device drop the sectors too
+void bcache_discard(blkdev_t* dev, uint64_t offset, uint64_t size) {
+    uint64_t first = (offset + BCACHE_BLOCK_SIZE - 1) / BCACHE_BLOCK_SIZE;
+    uint64_t end = (offset + size) / BCACHE_BLOCK_SIZE;
+    if (end - first < buffer_count) {
+        for (uint64_t block = first; block < end; block++) {
+            buffer_t* buf = hash_lookup(dev, block);
+            if (buf && !buf->busy) {
+                buffer_drop(buf);
+            }
+        }
+    } else {
+        for (uint32_t i = 0; i < buffer_count; i++) {
+            buffer_t* buf = &buffers[i];
+            if (buf->dev == dev && !buf->busy && buf->block >= first && buf->block < end) {
+                buffer_drop(buf);
+            }
+        }
+    }
+    blk_discard(dev, offset / BLK_SECTOR_SIZE, size / BLK_SECTOR_SIZE);
+}
+
+int bcache_sync(void) {
+    return bcache_flush();
+}
+
+void bcache_get_stats(bcache_stats_t* out) {
+    *out = stats;
+    out->buffers = buffer_count;
+    out->dirty = 0;
+    for (uint32_t i = 0; i < buffer_count; i++) {
+        if (buffers[i].dirty) {
+            out->dirty++;
+        }
+    }
+}
+
+void bcache_init(uint32_t count) {
+    buffers = kzalloc(count * sizeof(buffer_t));
+    flush_order = kmalloc(count * sizeof(buffer_t*));
+    if (!buffers || !flush_order) {
+        log_error(LOG_FS, "BCACHE: Failed to allocate buffer headers\n");
+        kfree(buffers);
+        kfree(flush_order);
+        buffers = NULL;
+        return;
+    }
+
+    buffer_count = 0;
+    while (buffer_count < count) {
+        uint8_t* data = pmm_alloc_page();
+        if (!data) {
+            break;
+        }
+        buffers[buffer_count++].data = data;
+    }
+    clock_hand = 0;
+    memset(hash_table, 0, sizeof(hash_table));
+    memset(&stats, 0, sizeof(stats));
+
+    log_info(LOG_FS, "BCACHE: %u buffers of %u bytes\n", buffer_count, BCACHE_BLOCK_SIZE);
+}
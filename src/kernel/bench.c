@@ -0,0 +1,571 @@
+#include "kernel/bench.h"
+#include "kernel/pmm.h"
+#include "kernel/io.h"
+#include "kernel/arch.h"
+#include "kernel/fs.h"
+#include "kernel/blkdev.h"
+#include "kernel/crc32c.h"
+#include "string.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define BENCH_PMM_BATCH 64
+#define BENCH_PMM_ROUNDS 256
+#define BENCH_PATH_PAIRS 1024
+#define BENCH_FS_SIZE (256 * 1024)
+#define BENCH_FS_PATH "/bench.dat"
+#define BENCH_FS_CHUNK 512
+#define BENCH_STR_CHECK 300  // Sizes 0..BENCH_STR_CHECK are cross-checked
+#define BENCH_STR_GUARD 16   // Guard bytes on each side of a checked region
+#define BENCH_STR_BYTES (8 * 1024 * 1024) // Bytes moved per throughput measurement
+#define BENCH_STR_BUFFER (1024 * 1024)
+#define BENCH_BLK_OPS 2048
+#define BENCH_BLK_MAX_DEPTH 32
+#define BENCH_BLK_LARGE (64 * 1024)
+#define BENCH_BLK_SEGMENT (16 * 1024) // Large requests are scattered over 16 KB pieces
+#define BENCH_CRC_BYTES (4 * 1024 * 1024) // Bytes summed per throughput measurement
+#define BENCH_CRC_BUFFER (64 * 1024)
+#define BENCH_CRC_BLOCK 512 // File system block
+#define BENCH_CRC_PATCHES 4096
+
+// Print "<label><ops per second>/s" for 'ops' operations that took 'ticks' counter ticks
+static void bench_print_rate(const char* label, uint64_t ops, uint64_t ticks) {
+    print(label);
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    print_dec(ops * arch_counter_freq() / ticks);
+    print("/s");
+}
+
+// Time batched alloc/free of single pages with 'percent' of the tracked pages in use.
+// The free pages are spread evenly over the tracked ones so they cannot coalesce.
+static void bench_pmm_occupancy(unsigned int percent, void** pages, uint64_t count) {
+    uint64_t to_free = count * (100 - percent) / 100;
+    for (uint64_t i = 0; i < count; i++) {
+        if ((i + 1) * to_free / count != i * to_free / count) {
+            pmm_free_page(pages[i]);
+            pages[i] = NULL;
+        }
+    }
+
+    uint64_t batch = to_free < BENCH_PMM_BATCH ? to_free : BENCH_PMM_BATCH;
+    void* held[BENCH_PMM_BATCH];
+    uint64_t alloc_ticks = 0;
+    uint64_t free_ticks = 0;
+
+    for (int round = 0; round < BENCH_PMM_ROUNDS; round++) {
+        uint64_t start = arch_counter();
+        for (uint64_t i = 0; i < batch; i++) {
+            held[i] = pmm_alloc_page();
+        }
+        uint64_t mid = arch_counter();
+        for (uint64_t i = 0; i < batch; i++) {
+            pmm_free_page(held[i]);
+        }
+        uint64_t end = arch_counter();
+        alloc_ticks += mid - start;
+        free_ticks += end - mid;
+    }
+
+    print("  ");
+    print_dec(percent);
+    print("% occupancy: ");
+    bench_print_rate("alloc ", batch * BENCH_PMM_ROUNDS, alloc_ticks);
+    bench_print_rate(", free ", batch * BENCH_PMM_ROUNDS, free_ticks);
+    print("\n");
+
+    // Refill so the next run starts from full memory again
+    for (uint64_t i = 0; i < count; i++) {
+        if (!pages[i]) {
+            pages[i] = pmm_alloc_page();
+        }
+    }
+}
+
+void bench_pmm(void) {
+    // Array holding every page the benchmark takes, as large as the PMM can give us
+    unsigned int order = PMM_MAX_ORDER - 1;
+    void** pages = pmm_alloc_pages(order);
+    while (!pages && order > 0) {
+        pages = pmm_alloc_pages(--order);
+    }
+    if (!pages) {
+        print("bench: out of memory\n");
+        return;
+    }
+    uint64_t capacity = ((uint64_t)PAGE_SIZE << order) / sizeof(void*);
+
+    uint64_t count = 0;
+    while (count < capacity && (pages[count] = pmm_alloc_page()) != NULL) {
+        count++;
+    }
+
+    print("PMM benchmark (");
+    print_dec(count);
+    print(" pages):\n");
+
+    static const unsigned int occupancy[] = { 10, 50, 99 };
+    for (size_t i = 0; i < sizeof(occupancy) / sizeof(occupancy[0]); i++) {
+        bench_pmm_occupancy(occupancy[i], pages, count);
+    }
+
+    for (uint64_t i = 0; i < count; i++) {
+        if (pages[i]) {
+            pmm_free_page(pages[i]);
+        }
+    }
+    pmm_free_pages(pages, order);
+}
+
+static void bench_print_cycles(const char* label, uint64_t cycles, uint64_t ops, const char* unit) {
+    print("  ");
+    print(label);
+    print(": ");
+    print_dec(cycles / (ops ? ops : 1));
+    print(" cycles/");
+    print(unit);
+    print("\n");
+}
+
+void bench_hot_paths(const char* label) {
+    arch_cycle_counter_enable();
+    print("Hot path cycle counts (");
+    print(label);
+    print("):\n");
+
+    uint64_t start = arch_cycles();
+    for (int i = 0; i < BENCH_PATH_PAIRS; i++) {
+        pmm_free_page(pmm_alloc_page());
+    }
+    bench_print_cycles("pmm alloc+free", arch_cycles() - start, BENCH_PATH_PAIRS, "pair");
+
+    start = arch_cycles();
+    pmm_audit();
+    bench_print_cycles("pmm bitmap scan", arch_cycles() - start, 1, "scan");
+
+    unsigned int order = pmm_size_to_order(BENCH_FS_SIZE);
+    uint8_t* buffer = pmm_alloc_pages(order);
+    if (!buffer) {
+        print("bench: out of memory\n");
+        return;
+    }
+    if (fs_create(BENCH_FS_PATH, BENCH_FS_SIZE, FS_FILE) == 0) {
+        start = arch_cycles();
+        fs_write(BENCH_FS_PATH, buffer, BENCH_FS_SIZE, 0);
+        bench_print_cycles("fs_write", arch_cycles() - start, BENCH_FS_SIZE / 1024, "KB");
+
+        start = arch_cycles();
+        fs_read(BENCH_FS_PATH, buffer, BENCH_FS_SIZE, 0);
+        bench_print_cycles("fs_read", arch_cycles() - start, BENCH_FS_SIZE / 1024, "KB");
+
+        // Streaming in small chunks: by path resolves every time, a handle does not
+        uint32_t chunks = BENCH_FS_SIZE / BENCH_FS_CHUNK;
+        start = arch_cycles();
+        for (uint32_t i = 0; i < chunks; i++) {
+            fs_read(BENCH_FS_PATH, buffer, BENCH_FS_CHUNK, i * BENCH_FS_CHUNK);
+        }
+        bench_print_cycles("fs_read 512B chunks", arch_cycles() - start, chunks, "chunk");
+
+        int fd = fs_open(BENCH_FS_PATH, FS_O_READ);
+        if (fd >= 0) {
+            start = arch_cycles();
+            for (uint32_t i = 0; i < chunks; i++) {
+                fs_pread(fd, buffer, BENCH_FS_CHUNK, i * BENCH_FS_CHUNK);
+            }
+            bench_print_cycles("fs_pread 512B chunks", arch_cycles() - start, chunks, "chunk");
+            fs_close(fd);
+        }
+
+        fs_delete(BENCH_FS_PATH);
+    }
+    pmm_free_pages(buffer, order);
+}
+
+// Byte-at-a-time reference versions the optimized routines are checked against
+static void ref_memcpy(uint8_t* dest, const uint8_t* src, size_t n) {
+    while (n--) {
+        *dest++ = *src++;
+    }
+}
+
+static int ref_memcmp(const uint8_t* s1, const uint8_t* s2, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (s1[i] != s2[i]) {
+            return s1[i] - s2[i];
+        }
+    }
+    return 0;
+}
+
+static int sign(int value) {
+    return (value > 0) - (value < 0);
+}
+
+static void fill_pattern(uint8_t* buffer, size_t size, uint32_t seed) {
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        buffer[i] = (uint8_t)(seed >> 16) | 1; // Never zero, so strings run on
+    }
+}
+
+static int string_fail(const char* what, size_t size, size_t offset) {
+    print("  FAIL ");
+    print(what);
+    print(" size ");
+    print_dec(size);
+    print(" offset ");
+    print_dec(offset);
+    print("\n");
+    return -1;
+}
+
+// Check every routine against the reference over small sizes and all alignments
+static int string_selftest(uint8_t* a, uint8_t* b, uint8_t* expect) {
+    size_t span = BENCH_STR_CHECK + 2 * BENCH_STR_GUARD + 16;
+
+    for (size_t size = 0; size <= BENCH_STR_CHECK; size++) {
+        for (size_t offset = 0; offset < 16; offset++) {
+            uint8_t* dest = a + BENCH_STR_GUARD + offset;
+            uint8_t* src = b + BENCH_STR_GUARD + (offset * 7) % 16;
+
+            fill_pattern(a, span, size);
+            fill_pattern(b, span, size + 1);
+            ref_memcpy(expect, a, span);
+            ref_memcpy(expect + (dest - a), src, size);
+            memcpy(dest, src, size);
+            if (ref_memcmp(a, expect, span) != 0) {
+                return string_fail("memcpy", size, offset);
+            }
+
+            fill_pattern(a, span, size);
+            ref_memcpy(expect, a, span);
+            for (size_t i = 0; i < size; i++) {
+                expect[dest - a + i] = (uint8_t)(offset * 17);
+            }
+            memset(dest, (int)(offset * 17), size);
+            if (ref_memcmp(a, expect, span) != 0) {
+                return string_fail("memset", size, offset);
+            }
+
+            // Overlapping moves, forwards and backwards by a few bytes
+            for (int shift = -9; shift <= 9; shift += 6) {
+                fill_pattern(a, span, size + offset);
+                ref_memcpy(expect, a, span);
+                uint8_t* from = dest + shift;
+                for (size_t i = 0; i < size; i++) {
+                    size_t j = shift > 0 ? i : size - 1 - i;
+                    expect[dest - a + j] = expect[from - a + j];
+                }
+                memmove(dest, from, size);
+                if (ref_memcmp(a, expect, span) != 0) {
+                    return string_fail("memmove", size, offset);
+                }
+            }
+
+            fill_pattern(a, span, size);
+            ref_memcpy(b, a, span);
+            if (memcmp(dest, b + (dest - a), size) != 0) {
+                return string_fail("memcmp equal", size, offset);
+            }
+            if (size > 0) {
+                b[dest - a + size / 2] ^= 0x80;
+                if (sign(memcmp(dest, b + (dest - a), size)) !=
+                    sign(ref_memcmp(dest, b + (dest - a), size))) {
+                    return string_fail("memcmp order", size, offset);
+                }
+            }
+
+            // Strings of 'size' characters
+            fill_pattern(a, span, size);
+            dest[size] = '\0';
+            char* s = (char*)dest;
+            if (strlen(s) != size) {
+                return string_fail("strlen", size, offset);
+            }
+            char* end = strchr(s, '\0');
+            if (end != s + size) {
+                return string_fail("strchr end", size, offset);
+            }
+            if (size > 0 && strchr(s, s[size - 1]) - s > (long)(size - 1)) {
+                return string_fail("strchr", size, offset);
+            }
+            char* t = (char*)b + BENCH_STR_GUARD + (15 - offset);
+            ref_memcpy((uint8_t*)t, dest, size + 1);
+            if (strcmp(s, t) != 0) {
+                return string_fail("strcmp equal", size, offset);
+            }
+            if (size > 0) {
+                t[size - 1] ^= 0x80;
+                int expected = (uint8_t)s[size - 1] - (uint8_t)t[size - 1];
+                if (sign(strcmp(s, t)) != sign(expected)) {
+                    return string_fail("strcmp order", size, offset);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static void bench_string_rate(const char* label, uint64_t bytes, uint64_t ticks) {
+    print(label);
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    print_dec(bytes * arch_counter_freq() / ticks / (1024 * 1024));
+    print(" MB/s");
+}
+
+int bench_string(void) {
+    unsigned int order = pmm_size_to_order(BENCH_STR_BUFFER);
+    uint8_t* a = pmm_alloc_pages(order);
+    uint8_t* b = pmm_alloc_pages(order);
+    uint8_t* expect = pmm_alloc_pages(0);
+    if (!a || !b || !expect) {
+        print("bench: out of memory\n");
+        if (a) pmm_free_pages(a, order);
+        if (b) pmm_free_pages(b, order);
+        if (expect) pmm_free_page(expect);
+        return -1;
+    }
+
+    print("String routine selftest... ");
+    int result = string_selftest(a, b, expect);
+    print(result == 0 ? "passed\n" : "failed\n");
+
+    print("String throughput:\n");
+    static const uint64_t sizes[] = { 1, 16, 256, 4096, 65536, BENCH_STR_BUFFER };
+    fill_pattern(b, BENCH_STR_BUFFER, 1);
+    b[BENCH_STR_BUFFER - 1] = '\0';
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint64_t size = sizes[i];
+        uint64_t reps = BENCH_STR_BYTES / size;
+        if (reps > 1000000) {
+            reps = 1000000;
+        }
+
+        uint64_t start = arch_counter();
+        for (uint64_t r = 0; r < reps; r++) {
+            memcpy(a, b, size);
+        }
+        uint64_t copy_ticks = arch_counter() - start;
+
+        start = arch_counter();
+        for (uint64_t r = 0; r < reps; r++) {
+            memset(a, 0, size);
+        }
+        uint64_t set_ticks = arch_counter() - start;
+
+        // strlen over a string of 'size' - 1 characters
+        uint8_t saved = b[size - 1];
+        b[size - 1] = '\0';
+        volatile size_t length = 0;
+        start = arch_counter();
+        for (uint64_t r = 0; r < reps; r++) {
+            length += strlen((const char*)b);
+        }
+        uint64_t len_ticks = arch_counter() - start;
+        b[size - 1] = saved;
+
+        print("  ");
+        print_dec(size);
+        print(" B: ");
+        bench_string_rate("memcpy ", size * reps, copy_ticks);
+        bench_string_rate(", memset ", size * reps, set_ticks);
+        bench_string_rate(", strlen ", size * reps, len_ticks);
+        print("\n");
+    }
+
+    pmm_free_pages(a, order);
+    pmm_free_pages(b, order);
+    pmm_free_page(expect);
+    return result;
+}
+
+// Random reads of 'size' bytes keeping 'depth' requests in flight
+static void bench_blk_run(blkdev_t* dev, uint8_t* buffers, uint32_t size, unsigned int depth) {
+    static blk_request_t requests[BENCH_BLK_MAX_DEPTH];
+    blk_request_t* batch[BENCH_BLK_MAX_DEPTH];
+    uint64_t span = dev->sectors - size / BLK_SECTOR_SIZE;
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    unsigned int issued = 0;
+    unsigned int completed = 0;
+    unsigned int errors = 0;
+
+    for (unsigned int i = 0; i < depth; i++) {
+        blk_request_t* request = &requests[i];
+        request->write = 0;
+        request->done = NULL;
+        request->segment_count = 0;
+        for (uint32_t offset = 0; offset < size; offset += BENCH_BLK_SEGMENT) {
+            blk_segment_t* segment = &request->segments[request->segment_count++];
+            segment->buffer = buffers + i * BENCH_BLK_LARGE + offset;
+            segment->length = size - offset < BENCH_BLK_SEGMENT ? size - offset : BENCH_BLK_SEGMENT;
+        }
+        request->status = BLK_OK; // Idle
+    }
+
+    uint64_t start = arch_counter();
+    while (completed < BENCH_BLK_OPS) {
+        // Refill every idle slot, then hand the whole batch to the device at once
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < depth && issued + count < BENCH_BLK_OPS; i++) {
+            if (requests[i].status != BLK_PENDING) {
+                seed ^= seed << 13;
+                seed ^= seed >> 7;
+                seed ^= seed << 17;
+                requests[i].sector = (seed % span) & ~(uint64_t)(PAGE_SIZE / BLK_SECTOR_SIZE - 1);
+                batch[count++] = &requests[i];
+            }
+        }
+        if (count > 0) {
+            issued += blk_submit(dev, batch, count);
+        }
+        completed += blk_poll(dev);
+    }
+    uint64_t ticks = arch_counter() - start;
+    for (unsigned int i = 0; i < depth; i++) {
+        if (requests[i].status == BLK_ERROR) {
+            errors++;
+        }
+    }
+
+    print("  ");
+    print_dec(size / 1024);
+    print(" KB QD ");
+    print_dec(depth);
+    print(": ");
+    print_dec((uint64_t)completed * arch_counter_freq() / (ticks ? ticks : 1));
+    print(" IOPS, ");
+    bench_string_rate("", (uint64_t)completed * size, ticks);
+    if (errors) {
+        print(", errors");
+    }
+    print("\n");
+}
+
+void bench_blk(void) {
+    blkdev_t* dev = blkdev_get(0);
+    if (!dev) {
+        print("bench: no block device (make run DISK=disk.img)\n");
+        return;
+    }
+    if (dev->sectors < 2 * BENCH_BLK_LARGE / BLK_SECTOR_SIZE) {
+        print("bench: block device too small\n");
+        return;
+    }
+
+    unsigned int order = pmm_size_to_order(BENCH_BLK_MAX_DEPTH * BENCH_BLK_LARGE);
+    uint8_t* buffers = pmm_alloc_pages(order);
+    if (!buffers) {
+        print("bench: out of memory\n");
+        return;
+    }
+
+    print("Block device ");
+    print(dev->name);
+    print(" random reads:\n");
+    static const unsigned int depths[] = { 1, 4, 16, 32 };
+    static const uint32_t sizes[] = { 4096, BENCH_BLK_LARGE };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+            bench_blk_run(dev, buffers, sizes[s], depths[d]);
+        }
+    }
+    pmm_free_pages(buffers, order);
+}
+
+// Print "<label><cycles per byte to two places>" for 'bytes' bytes that took 'cycles'
+static void bench_print_per_byte(const char* label, uint64_t cycles, uint64_t bytes) {
+    uint64_t hundredths = cycles * 100 / (bytes ? bytes : 1);
+    print(label);
+    print_dec(hundredths / 100);
+    print(hundredths % 100 < 10 ? ".0" : ".");
+    print_dec(hundredths % 100);
+}
+
+// Checksum cost next to the copy every file read and write already pays, and
+// patching a block's checksum for a small write against summing it again
+void bench_crc(void) {
+    unsigned int order = pmm_size_to_order(BENCH_CRC_BUFFER);
+    uint8_t* a = pmm_alloc_pages(order);
+    uint8_t* b = pmm_alloc_pages(order);
+    if (!a || !b) {
+        print("bench: out of memory\n");
+        if (a) pmm_free_pages(a, order);
+        if (b) pmm_free_pages(b, order);
+        return;
+    }
+    arch_cycle_counter_enable();
+    fill_pattern(a, BENCH_CRC_BUFFER, 7);
+    bool hw = crc32c_has_hw();
+    print("CRC32C instructions: ");
+    print(hw ? "present\n" : "absent, using the table\n");
+    if (hw && crc32c_hw(0, a + 3, BENCH_CRC_BUFFER - 5) != crc32c_sw(0, a + 3, BENCH_CRC_BUFFER - 5)) {
+        print("bench: hardware and table CRCs disagree\n");
+    }
+
+    print("Cycles per byte:\n");
+    static const uint32_t sizes[] = { BENCH_CRC_BLOCK, 4096, BENCH_CRC_BUFFER };
+    volatile uint32_t sink = 0;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint32_t size = sizes[i];
+        uint64_t reps = BENCH_CRC_BYTES / size;
+
+        uint64_t start = arch_cycles();
+        for (uint64_t r = 0; r < reps; r++) {
+            memcpy(b, a, size);
+        }
+        uint64_t copy_cycles = arch_cycles() - start;
+
+        uint64_t hw_cycles = 0;
+        if (hw) {
+            start = arch_cycles();
+            for (uint64_t r = 0; r < reps; r++) {
+                sink += crc32c_hw(0, a, size);
+            }
+            hw_cycles = arch_cycles() - start;
+        }
+
+        start = arch_cycles();
+        for (uint64_t r = 0; r < reps; r++) {
+            sink += crc32c_sw(0, a, size);
+        }
+        uint64_t sw_cycles = arch_cycles() - start;
+
+        print("  ");
+        print_dec(size);
+        print(" B: ");
+        bench_print_per_byte("memcpy ", copy_cycles, size * reps);
+        if (hw) {
+            bench_print_per_byte(", crc32c ", hw_cycles, size * reps);
+        }
+        bench_print_per_byte(", table ", sw_cycles, size * reps);
+        print("\n");
+    }
+
+    // A 16-byte write into a block: patch the old checksum or sum the whole block
+    fill_pattern(b, BENCH_CRC_BLOCK, 8);
+    uint32_t crc = crc32c(0, a, BENCH_CRC_BLOCK);
+    uint64_t start = arch_cycles();
+    for (uint32_t i = 0; i < BENCH_CRC_PATCHES; i++) {
+        uint32_t offset = (i * 16) % BENCH_CRC_BLOCK;
+        crc = crc32c_patch(crc, BENCH_CRC_BLOCK, offset, a + offset, b + offset, 16);
+        memcpy(a + offset, b + offset, 16);
+    }
+    uint64_t patch_cycles = arch_cycles() - start;
+    if (crc != crc32c(0, a, BENCH_CRC_BLOCK)) {
+        print("bench: patched CRC is wrong\n");
+    }
+    start = arch_cycles();
+    for (uint32_t i = 0; i < BENCH_CRC_PATCHES; i++) {
+        sink += crc32c(0, a, BENCH_CRC_BLOCK);
+    }
+    uint64_t full_cycles = arch_cycles() - start;
+    print("16 B write into a 512 B block:\n");
+    bench_print_cycles("patch checksum", patch_cycles, BENCH_CRC_PATCHES, "write");
+    bench_print_cycles("sum whole block", full_cycles, BENCH_CRC_PATCHES, "write");
+
+    pmm_free_pages(a, order);
+    pmm_free_pages(b, order);
+}
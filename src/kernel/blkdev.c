@@ -0,0 +1,69 @@
+#include "kernel/blkdev.h"
+#include "kernel/log.h"
+#include <stddef.h>
+
+static blkdev_t* blkdev_list;
+
+void blkdev_register(blkdev_t* dev) {
+    blkdev_t** link = &blkdev_list;
+    while (*link) {
+        link = &(*link)->next;
+    }
+    dev->next = NULL;
+    *link = dev;
+
+    log_info(LOG_FS, "BLK: %s: %lu sectors (%lu MB), queue depth %u\n", dev->name, dev->sectors,
+             dev->sectors * BLK_SECTOR_SIZE / (1024 * 1024), dev->queue_depth);
+}
+
+blkdev_t* blkdev_get(unsigned int index) {
+    blkdev_t* dev = blkdev_list;
+    while (dev && index > 0) {
+        dev = dev->next;
+        index--;
+    }
+    return dev;
+}
+
+unsigned int blk_submit(blkdev_t* dev, blk_request_t** requests, unsigned int count) {
+    return dev->submit(dev, requests, count);
+}
+
+unsigned int blk_poll(blkdev_t* dev) {
+    return dev->poll(dev);
+}
+
+// Poll until 'request' completes
+int blk_wait(blkdev_t* dev, blk_request_t* request) {
+    while (request->status == BLK_PENDING) {
+        dev->poll(dev);
+    }
+    return request->status == BLK_OK ? 0 : -1;
+}
+
+// Synchronous transfer of 'sectors' sectors to or from one contiguous buffer
+int blk_rw(blkdev_t* dev, uint64_t sector, void* buffer, uint32_t sectors, int write) {
+    if (sector + sectors > dev->sectors) {
+        return -1;
+    }
+
+    blk_request_t request;
+    request.sector = sector;
+    request.write = write;
+    request.segment_count = 1;
+    request.segments[0].buffer = buffer;
+    request.segments[0].length = sectors * BLK_SECTOR_SIZE;
+    request.done = NULL;
+
+    blk_request_t* batch = &request;
+    while (dev->submit(dev, &batch, 1) == 0) {
+        dev->poll(dev); // Queue full; make room
+    }
+    return blk_wait(dev, &request);
+}
+
+void blk_discard(blkdev_t* dev, uint64_t sector, uint64_t sectors) {
+    if (dev->discard && sector + sectors <= dev->sectors) {
+        dev->discard(dev, sector, sectors);
+    }
+}
@@ -0,0 +1,180 @@
+#include "kernel/fdt.h"
+#include "kernel/log.h"
+#include "string.h"
+#include <stddef.h>
+
+#define FDT_MAGIC 0xD00DFEED
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE 2
+#define FDT_PROP 3
+#define FDT_NOP 4
+#define FDT_END 9
+
+#define FDT_MAX_DEPTH 16
+
+// Header at the start of every flattened device tree, all fields big-endian
+typedef struct {
+    uint32_t magic;
+    uint32_t totalsize;
+    uint32_t off_dt_struct;
+    uint32_t off_dt_strings;
+    uint32_t off_mem_rsvmap;
+    uint32_t version;
+    uint32_t last_comp_version;
+    uint32_t boot_cpuid_phys;
+    uint32_t size_dt_strings;
+    uint32_t size_dt_struct;
+} fdt_header_t;
+
+static inline uint32_t be32(const void* p) {
+    const uint8_t* b = p;
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+// Read a value made of 'cells' big-endian 32-bit cells
+static uint64_t read_cells(const uint8_t* p, uint32_t cells) {
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < cells; i++) {
+        value = (value << 32) | be32(p + i * 4);
+    }
+    return value;
+}
+
+// True if a node name is 'base' or 'base@unit-address'
+static int node_name_is(const char* name, const char* base) {
+    while (*base) {
+        if (*name++ != *base++) {
+            return 0;
+        }
+    }
+    return *name == '\0' || *name == '@';
+}
+
+static void add_region(fdt_region_t* regions, unsigned int* count, uint64_t base, uint64_t size) {
+    if (size == 0) {
+        return;
+    }
+    if (*count >= FDT_MAX_REGIONS) {
+        log_warn(LOG_BOOT, "FDT: Too many regions, ignoring 0x%016lx\n", base);
+        return;
+    }
+    regions[*count].base = base;
+    regions[*count].size = size;
+    (*count)++;
+}
+
+// Decode every (address, size) pair of a 'reg' property
+static void add_reg(fdt_region_t* regions, unsigned int* count, const uint8_t* reg, uint32_t len,
+                    uint32_t address_cells, uint32_t size_cells) {
+    uint32_t entry_size = (address_cells + size_cells) * 4;
+    if (entry_size == 0) {
+        return;
+    }
+    for (uint32_t offset = 0; offset + entry_size <= len; offset += entry_size) {
+        uint64_t base = read_cells(reg + offset, address_cells);
+        uint64_t size = read_cells(reg + offset + address_cells * 4, size_cells);
+        add_region(regions, count, base, size);
+    }
+}
+
+int fdt_check(const void* dtb) {
+    if (!dtb || ((uintptr_t)dtb & 3) != 0) {
+        return -1;
+    }
+    const fdt_header_t* header = dtb;
+    if (be32(&header->magic) != FDT_MAGIC || be32(&header->last_comp_version) > 17) {
+        return -1;
+    }
+    return 0;
+}
+
+int fdt_get_memory_map(const void* dtb, fdt_memory_map_t* map) {
+    map->memory_count = 0;
+    map->reserved_count = 0;
+
+    if (fdt_check(dtb) != 0) {
+        return -1;
+    }
+
+    const uint8_t* base = dtb;
+    const fdt_header_t* header = dtb;
+    const uint8_t* structure = base + be32(&header->off_dt_struct);
+    const uint8_t* structure_end = structure + be32(&header->size_dt_struct);
+    const char* strings = (const char*)base + be32(&header->off_dt_strings);
+
+    // The blob itself must survive until everything has been parsed out of it
+    add_region(map->reserved, &map->reserved_count, (uintptr_t)dtb, be32(&header->totalsize));
+
+    // Memory reservation block: (address, size) pairs terminated by a zero entry
+    const uint8_t* rsv = base + be32(&header->off_mem_rsvmap);
+    while (1) {
+        uint64_t address = read_cells(rsv, 2);
+        uint64_t size = read_cells(rsv + 8, 2);
+        if (address == 0 && size == 0) {
+            break;
+        }
+        add_region(map->reserved, &map->reserved_count, address, size);
+        rsv += 16;
+    }
+
+    // #address-cells/#size-cells that apply to the children of each open node
+    uint32_t address_cells[FDT_MAX_DEPTH];
+    uint32_t size_cells[FDT_MAX_DEPTH];
+    int is_memory[FDT_MAX_DEPTH];
+    int is_reserved[FDT_MAX_DEPTH];
+    int depth = -1;
+
+    const uint8_t* p = structure;
+    while (p < structure_end) {
+        uint32_t token = be32(p);
+        p += 4;
+
+        if (token == FDT_BEGIN_NODE) {
+            const char* name = (const char*)p;
+            p += (strlen(name) + 1 + 3) & ~3u;
+            depth++;
+            if (depth >= FDT_MAX_DEPTH) {
+                log_error(LOG_BOOT, "FDT: Tree too deep\n");
+                return -1;
+            }
+            // Defaults from the devicetree specification
+            address_cells[depth] = 2;
+            size_cells[depth] = 1;
+            is_memory[depth] = depth == 1 && node_name_is(name, "memory");
+            is_reserved[depth] = depth == 1 && node_name_is(name, "reserved-memory");
+        } else if (token == FDT_END_NODE) {
+            depth--;
+        } else if (token == FDT_PROP) {
+            uint32_t len = be32(p);
+            const char* name = strings + be32(p + 4);
+            const uint8_t* value = p + 8;
+            p += (8 + len + 3) & ~3u;
+            if (depth < 0) {
+                continue;
+            }
+
+            if (strcmp(name, "#address-cells") == 0 && len == 4) {
+                address_cells[depth] = be32(value);
+            } else if (strcmp(name, "#size-cells") == 0 && len == 4) {
+                size_cells[depth] = be32(value);
+            } else if (strcmp(name, "reg") == 0 && depth >= 1) {
+                if (is_memory[depth]) {
+                    add_reg(map->memory, &map->memory_count, value, len,
+                            address_cells[depth - 1], size_cells[depth - 1]);
+                } else if (depth == 2 && is_reserved[1]) {
+                    add_reg(map->reserved, &map->reserved_count, value, len,
+                            address_cells[1], size_cells[1]);
+                }
+            }
+        } else if (token == FDT_NOP) {
+            continue;
+        } else if (token == FDT_END) {
+            break;
+        } else {
+            log_error(LOG_BOOT, "FDT: Bad structure token\n");
+            return -1;
+        }
+    }
+
+    return map->memory_count > 0 ? 0 : -1;
+}
@@ -1,110 +1,1708 @@
 #include "kernel/fs.h"
-#include "kernel/pmm.h"
 #include "kernel/io.h"
+#include "kernel/log.h"
+#include "kernel/trace.h"
+#include "kernel/slab.h"
+#include "kernel/bcache.h"
+#include "kernel/fs_format.h"
+#include "kernel/journal.h"
+#include "kernel/initramfs.h"
+#include "kernel/crc32c.h"
 #include "string.h"
 
 #define MAX_PATH_LENGTH 256
+#define PATH_CACHE_SLOTS 64  // Power of two
+#define NO_ENTRY -1
+#define NO_INODE 0xFFFFFFFF
+#define INITIAL_EXTENTS 4
+#define INITIAL_CHILDREN 4
+#define INODES_PER_CHUNK 64
+#define INODE_CHUNKS (FS_MAX_INODES / INODES_PER_CHUNK)
+#define BLOCKS_PER_GROUP (BCACHE_BLOCK_SIZE / BLOCK_SIZE)
+#define INODE_SECTORS_PER_CHUNK (INODES_PER_CHUNK / FS_DISK_INODES_PER_SECTOR)
+#define GROUP_COMMIT_OPS 64      // Operations batched into one journal transaction
+#define GROUP_COMMIT_SECTORS 128 // Changed metadata sectors that force an early commit
+#define SNAPSHOT_DIRECTORY ".snapshots" // In the root directory
 
-static fs_entry_t fs_entries[MAX_FS_ENTRIES];
-static uint8_t* fs_data;
-static uint32_t free_block;
+// Full paths that resolved recently, direct-mapped by path hash
+typedef struct {
+    uint32_t hash;
+    int entry;  // NO_ENTRY when the slot is empty
+    char path[MAX_PATH_LENGTH];
+} path_cache_slot_t;
 
-void fs_init(void) {
-    print("FS: Allocating memory for file system...\n");
-    fs_data = pmm_alloc_page();
-    if (!fs_data) {
-        print("FS: Failed to allocate memory for file system\n");
+// An open file: the resolved entry, checked against its generation on each use
+typedef struct {
+    bool in_use;
+    int flags;
+    uint32_t entry;
+    uint32_t generation;
+    uint32_t position; // Cursor for fs_fd_read and fs_fd_write
+} fs_file_t;
+
+// Inodes live in chunks allocated as the table grows; unused ones form a free list
+static fs_entry_t* inode_chunks[INODE_CHUNKS];
+static uint32_t inode_chunk_count;
+static uint32_t free_inode;
+static uint32_t inodes_used;
+
+static fs_file_t open_files[FS_MAX_OPEN_FILES];
+static path_cache_slot_t path_cache[PATH_CACHE_SLOTS];
+static fs_cache_stats_t cache_stats;
+
+// Free space as runs sorted by start block; neighbouring runs are always merged
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+} free_run_t;
+
+static free_run_t* free_extents; // Room for the worst case, every other block free
+static uint32_t free_extent_count;
+static uint32_t free_blocks;
+static uint32_t total_blocks;
+
+// File data lives on 'fs_dev' behind the buffer cache. Blocks are counted per
+// cache block sized group, and a group is discarded when its last block is freed.
+static blkdev_t* fs_dev;
+static uint8_t* group_blocks_used;
+
+// References to each block from file extents and extent chains. Clones share
+// blocks until one side writes them. Rebuilt from the extents at mount.
+static uint16_t* block_refs;
+
+// On-disk state: the superblock, the journal and the allocation bitmap as of now
+static fs_disk_super_t super;
+static journal_t journal;
+static uint8_t* block_bitmap;
+
+// CRC-32C of every data block, as in the checksum sectors. Allocated blocks
+// start out with the checksum of zeros, and every data write updates it.
+static uint32_t* block_csums;
+static uint32_t zero_block_csum;
+static const uint8_t zero_block[BLOCK_SIZE];
+
+// The running transaction: metadata changed since the last commit. Dirty inodes
+// are linked through tx_next; bitmap and checksum sectors have a flag each.
+static uint32_t tx_head = NO_INODE;
+static uint8_t* tx_bitmap_sectors;
+static uint8_t* tx_csum_sectors;
+static bool tx_super;
+static uint32_t tx_sectors;
+static uint32_t tx_ops;
+
+// Data blocks allocated in the running transaction, one bit each. Only these
+// are written in place: new data for any other block could reach the disk
+// before the transaction holding its new checksum, so it goes to a copy.
+static uint8_t* tx_new_blocks;
+
+// Runs of blocks freed since the last checkpoint, as start and count pairs.
+// Until the freeing transaction is on disk a crash brings back the old owner,
+// and a journal transaction may still hold an image of a freed chain block, so
+// they are only reused once the journal is retired.
+static uint32_t* deferred_runs;
+static uint32_t deferred_count; // Entries in deferred_runs, two per run
+static uint32_t deferred_capacity;
+
+// Scratch for fs_commit: home sectors of the transaction and the inode owning each
+static uint32_t* commit_homes;
+static uint32_t* commit_owners;
+
+static inline fs_entry_t* inode(uint32_t index) {
+    return &inode_chunks[index / INODES_PER_CHUNK][index % INODES_PER_CHUNK];
+}
+
+static inline uint64_t block_offset(uint32_t block) {
+    return (uint64_t)(super.data_start + block) * BLOCK_SIZE;
+}
+
+// Grow a kmalloc'd array to hold at least 'needed' entries
+static int array_reserve(uint32_t** array, uint32_t* capacity, uint32_t needed) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    uint32_t grown = *capacity ? *capacity * 2 : INITIAL_EXTENTS;
+    while (grown < needed) {
+        grown *= 2;
+    }
+    uint32_t* copy = kmalloc(grown * sizeof(uint32_t));
+    if (!copy) {
+        return -1;
+    }
+    if (*array) {
+        memcpy(copy, *array, *capacity * sizeof(uint32_t));
+        kfree(*array);
+    }
+    *array = copy;
+    *capacity = grown;
+    return 0;
+}
+
+// Record that an inode changed in the running transaction
+static void tx_inode(fs_entry_t* entry) {
+    if (!entry->dirty) {
+        entry->dirty = true;
+        entry->tx_next = tx_head;
+        tx_head = entry->index;
+        tx_sectors++;
+    }
+}
+
+static void tx_bitmap(uint32_t block) {
+    uint32_t sector = block / FS_DISK_BITS_PER_SECTOR;
+    if (!tx_bitmap_sectors[sector]) {
+        tx_bitmap_sectors[sector] = 1;
+        tx_sectors++;
+    }
+}
+
+static void tx_csum(uint32_t block) {
+    uint32_t sector = block / FS_DISK_CSUMS_PER_SECTOR;
+    if (!tx_csum_sectors[sector]) {
+        tx_csum_sectors[sector] = 1;
+        tx_sectors++;
+    }
+}
+
+static void tx_end(void);
+
+// FNV-1a over at most 'length' bytes of 'name'
+static uint32_t hash_name(const char* name, uint32_t length) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < length && name[i]; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Drop the cached path of a deleted entry. Only its own path can be cached,
+// since a directory must be empty to be deleted.
+static void path_cache_invalidate(uint32_t entry) {
+    for (int i = 0; i < PATH_CACHE_SLOTS; i++) {
+        if (path_cache[i].entry == (int)entry) {
+            path_cache[i].entry = NO_ENTRY;
+            cache_stats.invalidations++;
+        }
+    }
+}
+
+// Order an entry name against the first 'length' bytes of 'name'
+static int name_compare(const char* entry_name, const char* name, uint32_t length) {
+    int result = memcmp(entry_name, name, length);
+    if (result == 0 && entry_name[length] != '\0') {
+        return 1; // 'name' is a prefix of the entry name
+    }
+    return result;
+}
+
+// Binary search a directory for a child named by the first 'length' bytes of 'name'.
+// Returns the child inode or NO_ENTRY; 'position' receives where it is or would go.
+static int dir_lookup(const fs_entry_t* dir, const char* name, uint32_t length, uint32_t* position) {
+    cache_stats.probes++;
+    uint32_t low = 0;
+    uint32_t high = dir->child_count;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        int result = name_compare(inode(dir->children[mid])->name, name, length);
+        if (result == 0) {
+            low = mid;
+            break;
+        }
+        if (result < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (position) {
+        *position = low;
+    }
+    if (low < dir->child_count && name_compare(inode(dir->children[low])->name, name, length) == 0) {
+        return dir->children[low];
+    }
+    return NO_ENTRY;
+}
+
+static int dir_add_child(fs_entry_t* dir, uint32_t position, uint32_t child) {
+    if (dir->child_count == dir->child_capacity) {
+        uint32_t capacity = dir->child_capacity ? dir->child_capacity * 2 : INITIAL_CHILDREN;
+        uint32_t* children = kmalloc(capacity * sizeof(uint32_t));
+        if (!children) {
+            return -1;
+        }
+        if (dir->children) {
+            memcpy(children, dir->children, dir->child_count * sizeof(uint32_t));
+            kfree(dir->children);
+        }
+        dir->children = children;
+        dir->child_capacity = capacity;
+    }
+
+    memmove(&dir->children[position + 1], &dir->children[position],
+            (dir->child_count - position) * sizeof(uint32_t));
+    dir->children[position] = child;
+    dir->child_count++;
+    return 0;
+}
+
+static void dir_remove_child(fs_entry_t* dir, const char* name) {
+    uint32_t position;
+    if (dir_lookup(dir, name, strlen(name), &position) == NO_ENTRY) {
+        return;
+    }
+    dir->child_count--;
+    memmove(&dir->children[position], &dir->children[position + 1],
+            (dir->child_count - position) * sizeof(uint32_t));
+}
+
+static fs_entry_t* inode_chunk_alloc(uint32_t first) {
+    fs_entry_t* chunk = kzalloc(INODES_PER_CHUNK * sizeof(fs_entry_t));
+    if (!chunk) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < INODES_PER_CHUNK; i++) {
+        chunk[i].index = first + i;
+    }
+    inode_chunks[inode_chunk_count++] = chunk;
+    return chunk;
+}
+
+// Take an unused inode, growing the table by a chunk when none is left
+static uint32_t inode_alloc(void) {
+    if (free_inode == NO_INODE) {
+        uint32_t first = inode_chunk_count * INODES_PER_CHUNK;
+        if (first >= super.inode_count) {
+            return NO_INODE;
+        }
+        fs_entry_t* chunk = inode_chunk_alloc(first);
+        if (!chunk) {
+            return NO_INODE;
+        }
+        for (uint32_t i = 0; i < INODES_PER_CHUNK; i++) {
+            chunk[i].next_free = i + 1 < INODES_PER_CHUNK ? first + i + 1 : NO_INODE;
+        }
+        free_inode = first;
+
+        // Slots past the on-disk limit may hold anything, so clear them before
+        // the limit moves; both reach the disk through the next commit
+        if (first >= super.inode_limit) {
+            bcache_zero(fs_dev, (uint64_t)(super.inode_start + first / FS_DISK_INODES_PER_SECTOR) * BLOCK_SIZE,
+                        INODE_SECTORS_PER_CHUNK * BLOCK_SIZE);
+            super.inode_limit = first + INODES_PER_CHUNK;
+            if (!tx_super) {
+                tx_super = true;
+                tx_sectors++;
+            }
+        }
+    }
+
+    uint32_t index = free_inode;
+    free_inode = inode(index)->next_free;
+    inodes_used++;
+    return index;
+}
+
+static void inode_free(uint32_t index) {
+    fs_entry_t* entry = inode(index);
+    entry->is_used = false;
+    entry->generation++;
+    tx_inode(entry);
+    entry->next_free = free_inode;
+    free_inode = index;
+    inodes_used--;
+}
+
+static void dcache_reset(void) {
+    for (int i = 0; i < PATH_CACHE_SLOTS; i++) {
+        path_cache[i].entry = NO_ENTRY;
+    }
+    memset(&cache_stats, 0, sizeof(cache_stats));
+}
+
+void fs_get_cache_stats(fs_cache_stats_t* stats) {
+    *stats = cache_stats;
+}
+
+static void space_remove(uint32_t index) {
+    free_extent_count--;
+    memmove(&free_extents[index], &free_extents[index + 1],
+            (free_extent_count - index) * sizeof(free_run_t));
+}
+
+// Return a run of blocks, merging it with the free runs on either side
+static void space_free(uint32_t start, uint32_t count) {
+    uint32_t low = 0;
+    uint32_t high = free_extent_count;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        if (free_extents[mid].start < start) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    bool merge_prev = low > 0 && free_extents[low - 1].start + free_extents[low - 1].count == start;
+    bool merge_next = low < free_extent_count && start + count == free_extents[low].start;
+    if (merge_prev && merge_next) {
+        free_extents[low - 1].count += count + free_extents[low].count;
+        space_remove(low);
+    } else if (merge_prev) {
+        free_extents[low - 1].count += count;
+    } else if (merge_next) {
+        free_extents[low].start = start;
+        free_extents[low].count += count;
+    } else {
+        memmove(&free_extents[low + 1], &free_extents[low],
+                (free_extent_count - low) * sizeof(free_run_t));
+        free_extents[low].start = start;
+        free_extents[low].count = count;
+        free_extent_count++;
+    }
+    free_blocks += count;
+}
+
+// Mark blocks taken from the free runs as allocated
+static void blocks_attach(uint32_t start, uint32_t count) {
+    for (uint32_t block = start; block < start + count; block++) {
+        block_refs[block] = 1;
+        group_blocks_used[block / BLOCKS_PER_GROUP]++;
+        block_bitmap[block / 8] |= 1 << (block % 8);
+        tx_new_blocks[block / 8] |= 1 << (block % 8);
+        tx_bitmap(block);
+    }
+}
+
+static bool block_is_new(uint32_t block) {
+    return tx_new_blocks[block / 8] & (1 << (block % 8));
+}
+
+static void blocks_unmark(uint32_t start, uint32_t count) {
+    for (uint32_t block = start; block < start + count; block++) {
+        block_bitmap[block / 8] &= ~(1 << (block % 8));
+        tx_bitmap(block);
+    }
+}
+
+// Hand unmarked blocks back to the free runs, discarding groups that become
+// unused so the device can drop them
+static void blocks_return(uint32_t start, uint32_t count) {
+    for (uint32_t block = start; block < start + count; block++) {
+        uint32_t group = block / BLOCKS_PER_GROUP;
+        if (--group_blocks_used[group] == 0) {
+            bcache_discard(fs_dev, block_offset(group * BLOCKS_PER_GROUP), BCACHE_BLOCK_SIZE);
+        }
+    }
+    space_free(start, count);
+}
+
+// Hold unmarked blocks back until the next checkpoint
+static int blocks_defer(uint32_t start, uint32_t count) {
+    if (array_reserve(&deferred_runs, &deferred_capacity, deferred_count + 2) != 0) {
+        return -1;
+    }
+    deferred_runs[deferred_count++] = start;
+    deferred_runs[deferred_count++] = count;
+    return 0;
+}
+
+static void blocks_free(uint32_t start, uint32_t count) {
+    blocks_unmark(start, count);
+    if (blocks_defer(start, count) != 0) {
+        blocks_return(start, count); // Out of memory: reuse them at once
+    }
+}
+
+// Drop one reference to each block, freeing those no file uses any more
+static void blocks_release(uint32_t start, uint32_t count) {
+    uint32_t run = 0;
+    for (uint32_t block = start; block < start + count; block++) {
+        if (--block_refs[block] == 0) {
+            run++;
+        } else if (run > 0) {
+            blocks_free(block - run, run);
+            run = 0;
+        }
+    }
+    if (run > 0) {
+        blocks_free(start + count - run, run);
+    }
+}
+
+// Index of the smallest free run holding 'count' blocks, or of the largest run if none does
+static uint32_t space_best_fit(uint32_t count) {
+    uint32_t best = 0;
+    uint32_t largest = 0;
+    bool fits = false;
+    for (uint32_t i = 0; i < free_extent_count; i++) {
+        uint32_t length = free_extents[i].count;
+        if (length >= count && (!fits || length < free_extents[best].count)) {
+            best = i;
+            fits = true;
+            if (length == count) {
+                break;
+            }
+        }
+        if (length > free_extents[largest].count) {
+            largest = i;
+        }
+    }
+    return fits ? best : largest;
+}
+
+// Take 'count' blocks from the front of free run 'index'
+static uint32_t space_take(uint32_t index, uint32_t count) {
+    uint32_t start = free_extents[index].start;
+    free_extents[index].start += count;
+    free_extents[index].count -= count;
+    if (free_extents[index].count == 0) {
+        space_remove(index);
+    }
+    free_blocks -= count;
+    return start;
+}
+
+// Index of the extent mapping file block 'block', or of the first extent after it
+static uint32_t extent_find(const fs_entry_t* entry, uint32_t block) {
+    uint32_t low = 0;
+    uint32_t high = entry->extent_count;
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        if (entry->extents[mid].file_block + entry->extents[mid].count <= block) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Grow the extent array of 'entry' to hold at least 'needed' extents
+static int extents_reserve(fs_entry_t* entry, uint32_t needed) {
+    if (needed <= entry->extent_capacity) {
+        return 0;
+    }
+    uint32_t capacity = entry->extent_capacity ? entry->extent_capacity * 2 : INITIAL_EXTENTS;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    fs_extent_t* extents = kmalloc(capacity * sizeof(fs_extent_t));
+    if (!extents) {
+        return -1;
+    }
+    if (entry->extents) {
+        memcpy(extents, entry->extents, entry->extent_count * sizeof(fs_extent_t));
+        kfree(entry->extents);
+    }
+    entry->extents = extents;
+    entry->extent_capacity = capacity;
+    return 0;
+}
+
+// Map file blocks starting at 'file_block' to disk blocks starting at 'start',
+// as extent 'index'. Extents that touch both in the file and on disk are merged.
+static int extent_insert(fs_entry_t* entry, uint32_t index, uint32_t file_block, uint32_t start,
+                         uint32_t count) {
+    if (index > 0) {
+        fs_extent_t* prev = &entry->extents[index - 1];
+        if (prev->file_block + prev->count == file_block && prev->start + prev->count == start) {
+            prev->count += count;
+            return 0;
+        }
+    }
+    if (index < entry->extent_count) {
+        fs_extent_t* next = &entry->extents[index];
+        if (file_block + count == next->file_block && start + count == next->start) {
+            next->file_block = file_block;
+            next->start = start;
+            next->count += count;
+            return 0;
+        }
+    }
+
+    if (extents_reserve(entry, entry->extent_count + 1) != 0) {
+        return -1;
+    }
+    memmove(&entry->extents[index + 1], &entry->extents[index],
+            (entry->extent_count - index) * sizeof(fs_extent_t));
+    entry->extents[index].file_block = file_block;
+    entry->extents[index].start = start;
+    entry->extents[index].count = count;
+    entry->extent_count++;
+    return 0;
+}
+
+// Size the on-disk extent chain of 'entry' for 'extents' extents. Blocks it no
+// longer needs wait for the next checkpoint before they can be reused.
+static int chain_fit(fs_entry_t* entry, uint32_t extents) {
+    uint32_t needed = fs_disk_chain_blocks(extents);
+    if (needed > entry->chain_count) {
+        if (free_blocks < needed - entry->chain_count ||
+            array_reserve(&entry->chain, &entry->chain_capacity, needed) != 0) {
+            return -1;
+        }
+        while (entry->chain_count < needed) {
+            uint32_t block = space_take(space_best_fit(1), 1);
+            blocks_attach(block, 1);
+            entry->chain[entry->chain_count++] = block;
+        }
+        tx_inode(entry);
+    }
+    while (entry->chain_count > needed) {
+        uint32_t block = entry->chain[entry->chain_count - 1];
+        if (blocks_defer(block, 1) != 0) {
+            break; // Keep the block in the chain rather than leak it
+        }
+        entry->chain_count--;
+        block_refs[block] = 0;
+        blocks_unmark(block, 1);
+        tx_inode(entry);
+    }
+    return 0;
+}
+
+static void file_free_blocks(fs_entry_t* entry) {
+    entry->image = NULL;
+    for (uint32_t i = 0; i < entry->extent_count; i++) {
+        blocks_release(entry->extents[i].start, entry->extents[i].count);
+    }
+    kfree(entry->extents);
+    entry->extents = NULL;
+    entry->extent_count = 0;
+    entry->extent_capacity = 0;
+    chain_fit(entry, 0);
+    kfree(entry->chain);
+    entry->chain = NULL;
+    entry->chain_count = 0;
+    entry->chain_capacity = 0;
+}
+
+// Back the hole at file blocks [block, block + count) with zeroed disk blocks,
+// in one run if any free run is big enough and otherwise in as few as possible
+static int file_fill_hole(fs_entry_t* entry, uint32_t block, uint32_t count) {
+    while (count > 0) {
+        if (free_blocks == 0) {
+            return -1;
+        }
+        // Room on disk for one more extent first, in case this one does not merge
+        if (chain_fit(entry, entry->extent_count + 1) != 0 || free_blocks == 0) {
+            return -1;
+        }
+        uint32_t index = space_best_fit(count);
+        uint32_t take = free_extents[index].count < count ? free_extents[index].count : count;
+        uint32_t start = space_take(index, take);
+        blocks_attach(start, take);
+        if (extent_insert(entry, extent_find(entry, block), block, start, take) != 0) {
+            blocks_release(start, take);
+            return -1;
+        }
+        tx_inode(entry);
+        if (bcache_zero(fs_dev, block_offset(start), take * BLOCK_SIZE) != 0) {
+            return -1;
+        }
+        for (uint32_t b = start; b < start + take; b++) {
+            block_csums[b] = zero_block_csum;
+            tx_csum(b);
+        }
+        block += take;
+        count -= take;
+    }
+    return 0;
+}
+
+// Make sure every block under file bytes [offset, offset + size) is backed
+static int file_map_range(fs_entry_t* entry, uint32_t offset, uint32_t size) {
+    uint32_t block = offset / BLOCK_SIZE;
+    uint32_t end = (uint32_t)(((uint64_t)offset + size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    while (block < end) {
+        uint32_t i = extent_find(entry, block);
+        if (i < entry->extent_count && entry->extents[i].file_block <= block) {
+            block = entry->extents[i].file_block + entry->extents[i].count;
+            continue;
+        }
+        uint32_t hole_end = end;
+        if (i < entry->extent_count && entry->extents[i].file_block < end) {
+            hole_end = entry->extents[i].file_block;
+        }
+        if (file_fill_hole(entry, block, hole_end - block) != 0) {
+            return -1;
+        }
+        block = hole_end;
+    }
+    return 0;
+}
+
+// Copy the contents of 'count' disk blocks from 'from' to 'to', checksums included
+static int blocks_copy(uint32_t from, uint32_t to, uint32_t count) {
+    static uint8_t buffer[BCACHE_BLOCK_SIZE];
+    const uint32_t per_copy = BCACHE_BLOCK_SIZE / BLOCK_SIZE;
+    for (uint32_t done = 0; done < count; done += per_copy) {
+        uint32_t size = (count - done < per_copy ? count - done : per_copy) * BLOCK_SIZE;
+        if (bcache_read(fs_dev, block_offset(from + done), buffer, size) != 0 ||
+            bcache_write(fs_dev, block_offset(to + done), buffer, size) != 0) {
+            return -1;
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        block_csums[to + i] = block_csums[from + i];
+        tx_csum(to + i);
+    }
+    return 0;
+}
+
+// Move file blocks [block, block + count), all inside extent 'index', to disk
+// blocks starting at 'start'. The caller has reserved room for two more extents.
+static void extent_remap(fs_entry_t* entry, uint32_t index, uint32_t block, uint32_t count, uint32_t start) {
+    fs_extent_t old = entry->extents[index];
+    uint32_t head = block - old.file_block;
+    uint32_t tail = old.file_block + old.count - (block + count);
+    memmove(&entry->extents[index], &entry->extents[index + 1],
+            (entry->extent_count - index - 1) * sizeof(fs_extent_t));
+    entry->extent_count--;
+    if (head > 0) {
+        extent_insert(entry, extent_find(entry, old.file_block), old.file_block, old.start, head);
+    }
+    extent_insert(entry, extent_find(entry, block), block, start, count);
+    if (tail > 0) {
+        extent_insert(entry, extent_find(entry, block + count), block + count, old.start + head + count, tail);
+    }
+}
+
+// Give file blocks [block, block + count), mapped by one extent to blocks
+// that cannot be written in place, copies of their own
+static int file_cow_run(fs_entry_t* entry, uint32_t block, uint32_t count) {
+    while (count > 0) {
+        if (free_blocks == 0 || extents_reserve(entry, entry->extent_count + 2) != 0 ||
+            chain_fit(entry, entry->extent_count + 2) != 0 || free_blocks == 0) {
+            return -1;
+        }
+        uint32_t index = space_best_fit(count);
+        uint32_t take = free_extents[index].count < count ? free_extents[index].count : count;
+        uint32_t start = space_take(index, take);
+        blocks_attach(start, take);
+
+        uint32_t i = extent_find(entry, block);
+        uint32_t old = entry->extents[i].start + block - entry->extents[i].file_block;
+        if (blocks_copy(old, start, take) != 0) {
+            blocks_release(start, take);
+            return -1;
+        }
+        extent_remap(entry, i, block, take, start);
+        blocks_release(old, take);
+        chain_fit(entry, entry->extent_count + 1);
+        tx_inode(entry);
+        block += take;
+        count -= take;
+    }
+    return 0;
+}
+
+// Make sure every block under file blocks [block, end) can be written in
+// place. Blocks shared with another file are copied, and so are blocks an
+// earlier commit checksummed; the old copy stays intact until the new
+// mapping commits, and is only reused after the next checkpoint.
+static int file_cow_range(fs_entry_t* entry, uint32_t block, uint32_t end) {
+    while (block < end) {
+        uint32_t i = extent_find(entry, block);
+        if (i == entry->extent_count || entry->extents[i].file_block >= end) {
+            break;
+        }
+        const fs_extent_t* extent = &entry->extents[i];
+        if (extent->file_block > block) {
+            block = extent->file_block; // Skip the hole
+            continue;
+        }
+        uint32_t run_end = extent->file_block + extent->count < end ? extent->file_block + extent->count : end;
+        uint32_t disk = extent->start + block - extent->file_block;
+        if (block_refs[disk] == 1 && block_is_new(disk)) {
+            block++;
+            continue;
+        }
+        uint32_t count = 1;
+        while (block + count < run_end && (block_refs[disk + count] > 1 || !block_is_new(disk + count))) {
+            count++;
+        }
+        if (file_cow_run(entry, block, count) != 0) {
+            return -1;
+        }
+        block += count;
+    }
+    return 0;
+}
+
+static int csum_check(uint32_t block, const uint8_t* data) {
+    if (crc32c(0, data, BLOCK_SIZE) == block_csums[block]) {
+        return 0;
+    }
+    log_error(LOG_FS, "FS: Checksum error in data block %u\n", block);
+    return -1;
+}
+
+// Read disk bytes [offset, offset + size), all data blocks of one extent, and
+// check them against their checksums. Blocks only partly wanted are read whole
+// into scratch for the check.
+static int csum_read(uint64_t offset, uint8_t* buffer, uint32_t size) {
+    static uint8_t whole[BLOCK_SIZE];
+    while (size > 0) {
+        uint32_t block = (uint32_t)(offset / BLOCK_SIZE) - super.data_start;
+        uint32_t start = offset % BLOCK_SIZE;
+        uint32_t chunk;
+        if (start == 0 && size >= BLOCK_SIZE) {
+            chunk = size / BLOCK_SIZE * BLOCK_SIZE;
+            if (bcache_read(fs_dev, offset, buffer, chunk) != 0) {
+                return -1;
+            }
+            for (uint32_t i = 0; i < chunk / BLOCK_SIZE; i++) {
+                if (csum_check(block + i, buffer + i * BLOCK_SIZE) != 0) {
+                    return -1;
+                }
+            }
+        } else {
+            chunk = BLOCK_SIZE - start < size ? BLOCK_SIZE - start : size;
+            if (bcache_read(fs_dev, offset - start, whole, BLOCK_SIZE) != 0 || csum_check(block, whole) != 0) {
+                return -1;
+            }
+            memcpy(buffer, whole + start, chunk);
+        }
+        offset += chunk;
+        buffer += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+// Update the checksums for writing 'data' to disk bytes [offset, offset + size),
+// before the write. Only blocks allocated in the running transaction may be
+// written, as a crash could otherwise pair the new data with the old checksum.
+// Whole blocks are summed afresh. Part of a block patches the
+// old checksum with the change, which reads only the bytes being replaced and
+// leaves a block that was already damaged failing its check.
+static int csum_write(uint64_t offset, const uint8_t* data, uint32_t size) {
+    static uint8_t old[BLOCK_SIZE];
+    while (size > 0) {
+        uint32_t block = (uint32_t)(offset / BLOCK_SIZE) - super.data_start;
+        uint32_t start = offset % BLOCK_SIZE;
+        uint32_t chunk = BLOCK_SIZE - start < size ? BLOCK_SIZE - start : size;
+        if (!block_is_new(block)) {
+            log_error(LOG_FS, "FS: In-place write to committed data block %u\n", block);
+            return -1;
+        }
+        if (chunk == BLOCK_SIZE) {
+            block_csums[block] = crc32c(0, data, BLOCK_SIZE);
+        } else {
+            if (bcache_read(fs_dev, offset, old, chunk) != 0) {
+                return -1;
+            }
+            block_csums[block] = crc32c_patch(block_csums[block], BLOCK_SIZE, start, old, data, chunk);
+        }
+        tx_csum(block);
+        offset += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+// Copy between 'buffer' and file bytes [offset, offset + size) an extent at a
+// time. Writes need the range mapped first; reads of holes produce zeros.
+static int file_copy(const fs_entry_t* entry, void* buffer, uint32_t size, uint32_t offset, bool write) {
+    uint8_t* bytes = buffer;
+    while (size > 0) {
+        uint32_t block = offset / BLOCK_SIZE;
+        uint32_t i = extent_find(entry, block);
+        uint64_t end;
+        bool mapped = i < entry->extent_count && entry->extents[i].file_block <= block;
+        uint64_t disk_offset = 0;
+        if (mapped) {
+            const fs_extent_t* extent = &entry->extents[i];
+            end = (uint64_t)(extent->file_block + extent->count) * BLOCK_SIZE;
+            disk_offset = block_offset(extent->start + block - extent->file_block) + offset % BLOCK_SIZE;
+        } else {
+            end = i < entry->extent_count ? (uint64_t)entry->extents[i].file_block * BLOCK_SIZE
+                                          : (uint64_t)offset + size;
+        }
+
+        uint32_t chunk = end - offset < size ? (uint32_t)(end - offset) : size;
+        int result = 0;
+        if (!mapped) {
+            memset(bytes, 0, chunk);
+        } else if (write) {
+            result = csum_write(disk_offset, bytes, chunk);
+            if (result == 0) {
+                result = bcache_write(fs_dev, disk_offset, bytes, chunk);
+            }
+        } else {
+            result = csum_read(disk_offset, bytes, chunk);
+        }
+        if (result != 0) {
+            log_error(LOG_FS, "I/O error\n");
+            return -1;
+        }
+        bytes += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+// Read up to 'size' bytes at 'offset', stopping at the end of the file
+static int file_read(const fs_entry_t* entry, void* buffer, uint32_t size, uint32_t offset) {
+    if (offset > entry->size) {
+        log_error(LOG_FS, "Read out of bounds\n");
+        return -1;
+    }
+    if (size > entry->size - offset) {
+        size = entry->size - offset;
+    }
+    if (entry->image) {
+        memcpy(buffer, entry->image + offset, size);
+        return size;
+    }
+    if (file_copy(entry, buffer, size, offset, false) != 0) {
+        return -1;
+    }
+    return size;
+}
+
+// Bytes past the end of the file in its last block are left as they were when
+// it shrank; zero them before it grows over them. The size only changes in a
+// later commit, so a crash never shows them.
+static int file_zero_tail(fs_entry_t* entry) {
+    uint32_t tail = entry->size % BLOCK_SIZE;
+    if (tail == 0) {
+        return 0;
+    }
+    uint32_t block = entry->size / BLOCK_SIZE;
+    if (file_cow_range(entry, block, block + 1) != 0) {
+        return -1;
+    }
+    uint32_t i = extent_find(entry, block);
+    if (i == entry->extent_count || entry->extents[i].file_block > block) {
+        return 0; // A hole reads as zeros already
+    }
+    const fs_extent_t* extent = &entry->extents[i];
+    uint64_t offset = block_offset(extent->start + block - extent->file_block) + tail;
+    if (csum_write(offset, zero_block, BLOCK_SIZE - tail) != 0) {
+        return -1;
+    }
+    return bcache_zero(fs_dev, offset, BLOCK_SIZE - tail);
+}
+
+// Give a file still backed by the initramfs image blocks of its own, holding
+// its first 'keep' bytes, before it is first modified
+static int file_unshare(fs_entry_t* entry, uint32_t keep) {
+    if (keep > 0 && (file_map_range(entry, 0, keep) != 0 ||
+                     file_copy(entry, (void*)entry->image, keep, 0, true) != 0)) {
+        return -1;
+    }
+    entry->image = NULL;
+    entry->size = keep;
+    tx_inode(entry);
+    return 0;
+}
+
+// Write 'size' bytes at 'offset', allocating blocks and growing the file as needed
+static int file_write(fs_entry_t* entry, const void* buffer, uint32_t size, uint32_t offset) {
+    if ((uint64_t)offset + size > UINT32_MAX || size > INT32_MAX) {
+        log_error(LOG_FS, "Write out of bounds\n");
+        return -1;
+    }
+    if (size == 0) {
+        return 0;
+    }
+    // Blocks freed since the last checkpoint come back with a sync; do it
+    // before this write changes anything, so the commit holds whole operations
+    uint32_t blocks = size / BLOCK_SIZE + 2;
+    if (free_blocks < blocks && deferred_count > 0) {
+        fs_sync();
+    }
+    if (entry->image && file_unshare(entry, entry->size) != 0) {
+        log_error(LOG_FS, "Not enough space\n");
+        tx_end();
+        return -1;
+    }
+    if (offset > entry->size && file_zero_tail(entry) != 0) {
+        log_error(LOG_FS, "I/O error\n");
+        tx_end();
+        return -1;
+    }
+    uint32_t first = offset / BLOCK_SIZE;
+    uint32_t end = (uint32_t)(((uint64_t)offset + size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    if (file_map_range(entry, offset, size) != 0 || file_cow_range(entry, first, end) != 0) {
+        log_error(LOG_FS, "Not enough space\n");
+        tx_end();
+        return -1;
+    }
+    int result = file_copy(entry, (void*)buffer, size, offset, true) != 0 ? -1 : (int)size;
+    if (result > 0 && offset + size > entry->size) {
+        entry->size = offset + size;
+        tx_inode(entry);
+    }
+    tx_end();
+    return result;
+}
+
+// Set the file size, releasing blocks wholly past the new end
+static int file_truncate(fs_entry_t* entry, uint32_t size) {
+    if (entry->image && file_unshare(entry, size < entry->size ? size : entry->size) != 0) {
+        log_error(LOG_FS, "Not enough space\n");
+        tx_end();
+        return -1;
+    }
+    uint32_t keep = (uint32_t)(((uint64_t)size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    while (entry->extent_count > 0) {
+        fs_extent_t* last = &entry->extents[entry->extent_count - 1];
+        if (last->file_block >= keep) {
+            blocks_release(last->start, last->count);
+            entry->extent_count--;
+        } else {
+            if (last->file_block + last->count > keep) {
+                uint32_t drop = last->file_block + last->count - keep;
+                blocks_release(last->start + last->count - drop, drop);
+                last->count -= drop;
+            }
+            break;
+        }
+    }
+
+    // Growing over stale tail bytes would expose them, so fail instead
+    if (size > entry->size && file_zero_tail(entry) != 0) {
+        log_error(LOG_FS, "I/O error\n");
+        tx_end();
+        return -1;
+    }
+    entry->size = size;
+    chain_fit(entry, entry->extent_count);
+    tx_inode(entry);
+    tx_end();
+    return 0;
+}
+
+void fs_get_space_stats(fs_space_stats_t* stats) {
+    stats->total_blocks = total_blocks;
+    stats->journal_used = journal.head;
+    stats->journal_sectors = journal.sectors;
+    stats->free_blocks = free_blocks;
+    stats->free_extents = free_extent_count;
+    stats->largest_free = 0;
+    for (uint32_t i = 0; i < free_extent_count; i++) {
+        if (free_extents[i].count > stats->largest_free) {
+            stats->largest_free = free_extents[i].count;
+        }
+    }
+    stats->file_extents = 0;
+    stats->image_bytes = 0;
+    stats->shared_blocks = 0;
+    for (uint32_t block = 0; block < total_blocks; block++) {
+        stats->shared_blocks += block_refs[block] > 1;
+    }
+    for (uint32_t i = 0; i < inode_chunk_count * INODES_PER_CHUNK; i++) {
+        if (inode(i)->is_used) {
+            stats->file_extents += inode(i)->extent_count;
+            stats->image_bytes += inode(i)->image ? inode(i)->size : 0;
+        }
+    }
+    stats->inodes_used = inodes_used;
+    stats->inodes_allocated = inode_chunk_count * INODES_PER_CHUNK;
+}
+
+// The first file found using data block 'block', or NULL
+static const fs_entry_t* block_owner(uint32_t block) {
+    for (uint32_t i = 0; i < inode_chunk_count * INODES_PER_CHUNK; i++) {
+        const fs_entry_t* entry = inode(i);
+        for (uint32_t e = 0; entry->is_used && e < entry->extent_count; e++) {
+            if (block >= entry->extents[e].start && block - entry->extents[e].start < entry->extents[e].count) {
+                return entry;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Check every block of file data against its checksum, a cache block at a time
+int fs_scrub(fs_scrub_stats_t* stats) {
+    static uint8_t buffer[BCACHE_BLOCK_SIZE];
+    stats->blocks = 0;
+    stats->errors = 0;
+    if (!fs_dev) {
+        log_error(LOG_FS, "FS: Not mounted\n");
+        return -1;
+    }
+    // Extent chain blocks are metadata and have no checksum
+    uint8_t* chain_blocks = kzalloc(total_blocks / 8 + 1);
+    if (!chain_blocks) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < inode_chunk_count * INODES_PER_CHUNK; i++) {
+        const fs_entry_t* entry = inode(i);
+        for (uint32_t link = 0; entry->is_used && link < entry->chain_count; link++) {
+            chain_blocks[entry->chain[link] / 8] |= 1 << (entry->chain[link] % 8);
+        }
+    }
+
+    int result = 0;
+    for (uint32_t first = 0; first < total_blocks && result == 0; first += BLOCKS_PER_GROUP) {
+        if (group_blocks_used[first / BLOCKS_PER_GROUP] == 0) {
+            continue;
+        }
+        uint32_t count = total_blocks - first < BLOCKS_PER_GROUP ? total_blocks - first : BLOCKS_PER_GROUP;
+        if (bcache_read(fs_dev, block_offset(first), buffer, count * BLOCK_SIZE) != 0) {
+            log_error(LOG_FS, "I/O error\n");
+            result = -1;
+            break;
+        }
+        for (uint32_t block = first; block < first + count; block++) {
+            if (block_refs[block] == 0 || (chain_blocks[block / 8] & (1 << (block % 8)))) {
+                continue;
+            }
+            stats->blocks++;
+            if (crc32c(0, buffer + (block - first) * BLOCK_SIZE, BLOCK_SIZE) != block_csums[block]) {
+                const fs_entry_t* owner = block_owner(block);
+                log_error(LOG_FS, "FS: Checksum error in data block %u%s%s\n", block,
+                          owner ? " of " : "", owner ? owner->name : "");
+                stats->errors++;
+            }
+        }
+    }
+    kfree(chain_blocks);
+    return result;
+}
+
+static void inode_encode(const fs_entry_t* entry, fs_disk_inode_t* disk) {
+    memcpy(disk->name, entry->name, FS_DISK_NAME_LENGTH);
+    disk->type = entry->type == FS_DIRECTORY ? FS_DISK_DIRECTORY : FS_DISK_FILE;
+    disk->used = 1;
+    disk->parent = entry->parent;
+    disk->size = entry->size;
+    disk->generation = entry->generation;
+    disk->extent_count = entry->extent_count;
+    disk->extent_chain = entry->chain_count ? entry->chain[0] : FS_DISK_NO_BLOCK;
+    uint32_t inline_count = entry->extent_count < FS_DISK_INLINE_EXTENTS ? entry->extent_count
+                                                                          : FS_DISK_INLINE_EXTENTS;
+    memcpy(disk->extents, entry->extents, inline_count * sizeof(fs_extent_t));
+}
+
+// The image of chain block 'block' of 'entry'
+static void chain_encode(const fs_entry_t* entry, uint32_t block, fs_disk_chain_t* disk) {
+    uint32_t link = 0;
+    while (link < entry->chain_count && entry->chain[link] != block) {
+        link++;
+    }
+    disk->next = link + 1 < entry->chain_count ? entry->chain[link + 1] : FS_DISK_NO_BLOCK;
+    uint32_t first = FS_DISK_INLINE_EXTENTS + link * FS_DISK_CHAIN_EXTENTS;
+    if (first < entry->extent_count) {
+        uint32_t count = entry->extent_count - first;
+        count = count < FS_DISK_CHAIN_EXTENTS ? count : FS_DISK_CHAIN_EXTENTS;
+        memcpy(disk->extents, &entry->extents[first], count * sizeof(fs_extent_t));
+    }
+}
+
+// journal_fill_t for fs_commit: serialize the current state of a metadata sector
+static void fs_fill_sector(uint32_t index, uint8_t* image) {
+    uint32_t home = commit_homes[index];
+    memset(image, 0, BLOCK_SIZE);
+    if (home == 0) {
+        memcpy(image, &super, sizeof(super));
+    } else if (home < super.bitmap_start) {
+        fs_disk_inode_t* disk = (fs_disk_inode_t*)image;
+        uint32_t first = (home - super.inode_start) * FS_DISK_INODES_PER_SECTOR;
+        for (uint32_t i = 0; i < FS_DISK_INODES_PER_SECTOR; i++) {
+            if (first + i >= inode_chunk_count * INODES_PER_CHUNK) {
+                break;
+            }
+            const fs_entry_t* entry = inode(first + i);
+            if (entry->is_used) {
+                inode_encode(entry, &disk[i]);
+            } else {
+                disk[i].generation = entry->generation;
+            }
+        }
+    } else if (home < super.csum_start) {
+        memcpy(image, block_bitmap + (home - super.bitmap_start) * BLOCK_SIZE, BLOCK_SIZE);
+    } else if (home < super.data_start) {
+        memcpy(image, block_csums + (home - super.csum_start) * FS_DISK_CSUMS_PER_SECTOR, BLOCK_SIZE);
+    } else {
+        chain_encode(inode(commit_owners[index]), home - super.data_start, (fs_disk_chain_t*)image);
+    }
+}
+
+// Retire the journal: once every home sector is on disk the log can start over
+static int fs_checkpoint(void) {
+    if (bcache_sync() != 0) {
+        return -1;
+    }
+    super.journal_sequence = journal.sequence;
+    if (bcache_write(fs_dev, 0, &super, sizeof(super)) != 0 || bcache_sync() != 0) {
+        return -1;
+    }
+    journal_reset(&journal);
+    for (uint32_t i = 0; i < deferred_count; i += 2) {
+        blocks_return(deferred_runs[i], deferred_runs[i + 1]);
+    }
+    deferred_count = 0;
+    return 0;
+}
+
+static void commit_sort(uint32_t count) {
+    // Shell sort by home sector, owners alongside
+    for (uint32_t gap = count / 2; gap > 0; gap /= 2) {
+        for (uint32_t i = gap; i < count; i++) {
+            uint32_t home = commit_homes[i];
+            uint32_t owner = commit_owners[i];
+            uint32_t j = i;
+            while (j >= gap && commit_homes[j - gap] > home) {
+                commit_homes[j] = commit_homes[j - gap];
+                commit_owners[j] = commit_owners[j - gap];
+                j -= gap;
+            }
+            commit_homes[j] = home;
+            commit_owners[j] = owner;
+        }
+    }
+}
+
+// Write the running transaction to the journal as one sequential batch. The
+// home sectors follow lazily through the buffer cache.
+static int fs_commit(void) {
+    if (tx_sectors == 0) {
+        return 0;
+    }
+
+    uint32_t count = (tx_super ? 1 : 0);
+    for (uint32_t i = 0; i < super.bitmap_sectors; i++) {
+        count += tx_bitmap_sectors[i];
+    }
+    for (uint32_t i = 0; i < super.csum_sectors; i++) {
+        count += tx_csum_sectors[i];
+    }
+    for (uint32_t i = tx_head; i != NO_INODE; i = inode(i)->tx_next) {
+        count += 1 + inode(i)->chain_count;
+    }
+    commit_homes = kmalloc(count * sizeof(uint32_t));
+    commit_owners = kmalloc(count * sizeof(uint32_t));
+    if (!commit_homes || !commit_owners) {
+        kfree(commit_homes);
+        kfree(commit_owners);
+        return -1;
+    }
+
+    count = 0;
+    if (tx_super) {
+        commit_owners[count] = 0;
+        commit_homes[count++] = 0;
+    }
+    for (uint32_t i = 0; i < super.bitmap_sectors; i++) {
+        if (tx_bitmap_sectors[i]) {
+            commit_owners[count] = 0;
+            commit_homes[count++] = super.bitmap_start + i;
+        }
+    }
+    for (uint32_t i = 0; i < super.csum_sectors; i++) {
+        if (tx_csum_sectors[i]) {
+            commit_owners[count] = 0;
+            commit_homes[count++] = super.csum_start + i;
+        }
+    }
+    for (uint32_t i = tx_head; i != NO_INODE; i = inode(i)->tx_next) {
+        const fs_entry_t* entry = inode(i);
+        commit_owners[count] = i;
+        commit_homes[count++] = super.inode_start + i / FS_DISK_INODES_PER_SECTOR;
+        for (uint32_t link = 0; link < entry->chain_count; link++) {
+            commit_owners[count] = i;
+            commit_homes[count++] = super.data_start + entry->chain[link];
+        }
+    }
+    // Inodes sharing a sector appear once
+    commit_sort(count);
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (unique == 0 || commit_homes[unique - 1] != commit_homes[i]) {
+            commit_homes[unique] = commit_homes[i];
+            commit_owners[unique++] = commit_owners[i];
+        }
+    }
+
+    int result;
+    if (fs_journal_sectors(unique) > journal.sectors) {
+        // Too big to log at all: checkpoint, then write in place
+        log_warn(LOG_FS, "FS: Transaction too large for the journal, writing in place\n");
+        static uint8_t image[BLOCK_SIZE];
+        result = fs_checkpoint();
+        for (uint32_t i = 0; i < unique && result == 0; i++) {
+            fs_fill_sector(i, image);
+            result = bcache_write(fs_dev, (uint64_t)commit_homes[i] * BLOCK_SIZE, image, BLOCK_SIZE);
+        }
+        if (result == 0) {
+            result = bcache_sync();
+        }
+    } else {
+        result = 0;
+        if (journal.head + fs_journal_sectors(unique) > journal.sectors) {
+            result = fs_checkpoint();
+        }
+        if (result == 0) {
+            result = journal_commit(&journal, commit_homes, unique, fs_fill_sector);
+        }
+    }
+    kfree(commit_homes);
+    kfree(commit_owners);
+    commit_homes = NULL;
+    commit_owners = NULL;
+    if (result != 0) {
+        log_error(LOG_FS, "FS: Journal commit failed\n");
+        return -1; // Keep the transaction for the next attempt
+    }
+
+    while (tx_head != NO_INODE) {
+        fs_entry_t* entry = inode(tx_head);
+        entry->dirty = false;
+        tx_head = entry->tx_next;
+    }
+    // Every block allocated in the transaction marked its bitmap sector
+    for (uint32_t i = 0; i < super.bitmap_sectors; i++) {
+        if (tx_bitmap_sectors[i]) {
+            memset(&tx_new_blocks[i * BLOCK_SIZE], 0, BLOCK_SIZE);
+        }
+    }
+    memset(tx_bitmap_sectors, 0, super.bitmap_sectors);
+    memset(tx_csum_sectors, 0, super.csum_sectors);
+    tx_super = false;
+    tx_sectors = 0;
+    tx_ops = 0;
+    return 0;
+}
+
+// Close an operation. Operations share one transaction until enough of them
+// or of their changed sectors have gathered, then it is committed as a group.
+static void tx_end(void) {
+    if (tx_sectors == 0) {
         return;
     }
-    print("FS: Memory allocated successfully\n");
+    if (++tx_ops >= GROUP_COMMIT_OPS || tx_sectors >= GROUP_COMMIT_SECTORS) {
+        fs_commit();
+    }
+}
+
+// Commit the running transaction and checkpoint, leaving everything home
+int fs_sync(void) {
+    if (!fs_dev) {
+        return 0;
+    }
+    if (fs_commit() != 0 || fs_checkpoint() != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Write an empty file system holding only the root directory
+int fs_format(blkdev_t* dev) {
+    static fs_disk_super_t fresh;
+    static fs_disk_super_t old;
+    memset(&fresh, 0, sizeof(fresh));
+    if (fs_disk_layout(dev->sectors, &fresh) != 0) {
+        log_error(LOG_FS, "FS: Device too small for a file system\n");
+        return -1;
+    }
+    fresh.inode_limit = INODES_PER_CHUNK;
+    fresh.journal_sequence = 1;
+    // Start past any sequence an old journal on the device could still hold
+    if (bcache_read(dev, 0, &old, sizeof(old)) == 0 && old.magic == FS_DISK_MAGIC) {
+        fresh.journal_sequence = old.journal_sequence + old.journal_sectors + 1;
+    }
 
-    print("FS: Initializing file system entries...\n");
-    memset(fs_entries, 0, sizeof(fs_entries));
-    free_block = 0;
+    static fs_disk_inode_t root[FS_DISK_INODES_PER_SECTOR];
+    memset(root, 0, sizeof(root));
+    strcpy(root[0].name, "/");
+    root[0].type = FS_DISK_DIRECTORY;
+    root[0].used = 1;
+    root[0].parent = 0; // Root is its own parent
+    root[0].extent_chain = FS_DISK_NO_BLOCK;
 
-    // Create root directory
-    fs_entries[0].type = FS_DIRECTORY;
-    fs_entries[0].parent = 0; // Root is its own parent
-    strcpy(fs_entries[0].name, "/");
-    fs_entries[0].size = 0;
-    fs_entries[0].start_block = 0;
-    fs_entries[0].is_used = true;
+    uint64_t inodes = (uint64_t)fresh.inode_start * BLOCK_SIZE;
+    if (bcache_zero(dev, (uint64_t)fresh.journal_start * BLOCK_SIZE, BLOCK_SIZE) != 0 ||
+        bcache_zero(dev, inodes, INODE_SECTORS_PER_CHUNK * BLOCK_SIZE) != 0 ||
+        bcache_write(dev, inodes, root, sizeof(root)) != 0 ||
+        bcache_zero(dev, (uint64_t)fresh.bitmap_start * BLOCK_SIZE, fresh.bitmap_sectors * BLOCK_SIZE) != 0 ||
+        bcache_zero(dev, (uint64_t)fresh.csum_start * BLOCK_SIZE, fresh.csum_sectors * BLOCK_SIZE) != 0 ||
+        bcache_write(dev, 0, &fresh, sizeof(fresh)) != 0 || bcache_sync() != 0) {
+        log_error(LOG_FS, "FS: Failed to write the file system\n");
+        return -1;
+    }
+    log_info(LOG_FS, "FS: Formatted %s: %u data blocks, %u inodes, %u journal sectors\n", dev->name,
+             fresh.data_blocks, fresh.inode_count, fresh.journal_sectors);
+    return 0;
+}
 
-    print("FS: File system initialized\n");
+// Drop everything a previous mount built
+static void fs_unload(void) {
+    for (uint32_t i = 0; i < inode_chunk_count * INODES_PER_CHUNK; i++) {
+        fs_entry_t* entry = inode(i);
+        kfree(entry->extents);
+        kfree(entry->children);
+        kfree(entry->chain);
+    }
+    for (uint32_t c = 0; c < inode_chunk_count; c++) {
+        kfree(inode_chunks[c]);
+    }
+    inode_chunk_count = 0;
+    kfree(free_extents);
+    kfree(group_blocks_used);
+    kfree(block_refs);
+    kfree(block_bitmap);
+    kfree(tx_bitmap_sectors);
+    kfree(tx_new_blocks);
+    kfree(block_csums);
+    kfree(tx_csum_sectors);
+    kfree(deferred_runs);
+    free_extents = NULL;
+    group_blocks_used = NULL;
+    block_refs = NULL;
+    block_bitmap = NULL;
+    tx_bitmap_sectors = NULL;
+    tx_new_blocks = NULL;
+    block_csums = NULL;
+    tx_csum_sectors = NULL;
+    deferred_runs = NULL;
+    deferred_capacity = 0;
+    deferred_count = 0;
+    total_blocks = 0;
 }
 
-static int find_free_entry(void) {
-    for (int i = 1; i < MAX_FS_ENTRIES; i++) {
-        if (!fs_entries[i].is_used) {
-            return i;
+// Fill a loaded inode from its on-disk form, reading its extent chain
+static int inode_decode(fs_entry_t* entry, const fs_disk_inode_t* disk) {
+    static fs_disk_chain_t chain;
+    uint32_t count = disk->extent_count;
+    uint32_t links = fs_disk_chain_blocks(count);
+    entry->extents = count ? kmalloc(count * sizeof(fs_extent_t)) : NULL;
+    entry->chain = links ? kmalloc(links * sizeof(uint32_t)) : NULL;
+    if ((count && !entry->extents) || (links && !entry->chain)) {
+        return -1;
+    }
+    entry->extent_capacity = count;
+    entry->chain_capacity = links;
+
+    memcpy(entry->name, disk->name, MAX_FILENAME_LENGTH);
+    entry->name[MAX_FILENAME_LENGTH - 1] = '\0';
+    entry->type = disk->type == FS_DISK_DIRECTORY ? FS_DIRECTORY : FS_FILE;
+    entry->parent = disk->parent;
+    entry->size = disk->size;
+    entry->generation = disk->generation;
+    entry->is_used = true;
+    entry->extent_count = count < FS_DISK_INLINE_EXTENTS ? count : FS_DISK_INLINE_EXTENTS;
+    memcpy(entry->extents, disk->extents, entry->extent_count * sizeof(fs_extent_t));
+
+    uint32_t block = disk->extent_chain;
+    while (entry->extent_count < count) {
+        if (block >= total_blocks || entry->chain_count == links ||
+            bcache_read(fs_dev, block_offset(block), &chain, sizeof(chain)) != 0) {
+            return -1;
         }
+        entry->chain[entry->chain_count++] = block;
+        block_refs[block] = 1;
+        uint32_t take = count - entry->extent_count;
+        take = take < FS_DISK_CHAIN_EXTENTS ? take : FS_DISK_CHAIN_EXTENTS;
+        memcpy(&entry->extents[entry->extent_count], chain.extents, take * sizeof(fs_extent_t));
+        entry->extent_count += take;
+        block = chain.next;
     }
-    return -1;
+
+    // Clones show up as several extents mapping the same blocks
+    for (uint32_t i = 0; i < count; i++) {
+        const fs_extent_t* extent = &entry->extents[i];
+        if ((uint64_t)extent->start + extent->count > total_blocks) {
+            return -1;
+        }
+        for (uint32_t b = extent->start; b < extent->start + extent->count; b++) {
+            block_refs[b]++;
+        }
+    }
+    return 0;
 }
 
-int find_entry(const char* path) {
-    print("Searching for path: ");
-    print(path);
-    print("\n");
+// Order a directory's children by name after loading
+static void dir_sort(fs_entry_t* dir) {
+    uint32_t* children = dir->children;
+    for (uint32_t gap = dir->child_count / 2; gap > 0; gap /= 2) {
+        for (uint32_t i = gap; i < dir->child_count; i++) {
+            uint32_t child = children[i];
+            const char* name = inode(child)->name;
+            uint32_t j = i;
+            while (j >= gap && strcmp(inode(children[j - gap])->name, name) > 0) {
+                children[j] = children[j - gap];
+                j -= gap;
+            }
+            children[j] = child;
+        }
+    }
+}
+
+// Build the free runs and group counts from the allocation bitmap, and load the checksums
+static int fs_load_bitmap(void) {
+    if (bcache_read(fs_dev, (uint64_t)super.bitmap_start * BLOCK_SIZE, block_bitmap,
+                    super.bitmap_sectors * BLOCK_SIZE) != 0 ||
+        bcache_read(fs_dev, (uint64_t)super.csum_start * BLOCK_SIZE, block_csums,
+                    super.csum_sectors * BLOCK_SIZE) != 0) {
+        return -1;
+    }
+    uint32_t run = 0;
+    for (uint32_t block = 0; block < total_blocks; block++) {
+        if (block_bitmap[block / 8] & (1 << (block % 8))) {
+            group_blocks_used[block / BLOCKS_PER_GROUP]++;
+            if (run > 0) {
+                space_free(block - run, run);
+                run = 0;
+            }
+        } else {
+            run++;
+        }
+    }
+    if (run > 0) {
+        space_free(total_blocks - run, run);
+    }
+    return 0;
+}
+
+// Load the inode table up to its high-water mark and rebuild the directories
+static int fs_load_inodes(void) {
+    static fs_disk_inode_t disk[BCACHE_BLOCK_SIZE / sizeof(fs_disk_inode_t)];
+    const uint32_t per_read = BCACHE_BLOCK_SIZE / sizeof(fs_disk_inode_t);
+    uint32_t limit = super.inode_limit;
+    for (uint32_t first = 0; first < limit; first += INODES_PER_CHUNK) {
+        if (!inode_chunk_alloc(first)) {
+            return -1;
+        }
+    }
+
+    for (uint32_t first = 0; first < limit; first += per_read) {
+        uint64_t offset = (uint64_t)super.inode_start * BLOCK_SIZE + (uint64_t)first * sizeof(fs_disk_inode_t);
+        if (bcache_read(fs_dev, offset, disk, sizeof(disk)) != 0) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < per_read; i++) {
+            fs_entry_t* entry = inode(first + i);
+            entry->generation = disk[i].generation;
+            if (disk[i].used && inode_decode(entry, &disk[i]) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    // Unused slots form the free list, lowest first
+    for (uint32_t i = limit; i-- > 0;) {
+        if (inode(i)->is_used) {
+            inodes_used++;
+        } else {
+            inode(i)->next_free = free_inode;
+            free_inode = i;
+        }
+    }
+
+    fs_entry_t* root = inode(0);
+    if (!root->is_used || root->type != FS_DIRECTORY) {
+        log_error(LOG_FS, "FS: Root directory missing\n");
+        return -1;
+    }
+    for (uint32_t i = 1; i < limit; i++) {
+        fs_entry_t* entry = inode(i);
+        if (!entry->is_used) {
+            continue;
+        }
+        fs_entry_t* parent = entry->parent < limit ? inode(entry->parent) : NULL;
+        if (!parent || !parent->is_used || parent->type != FS_DIRECTORY || entry->parent == i ||
+            dir_add_child(parent, parent->child_count, i) != 0) {
+            log_warn(LOG_FS, "FS: Inode %u has no parent directory, run fsck\n", i);
+        }
+    }
+    for (uint32_t i = 0; i < limit; i++) {
+        if (inode(i)->is_used && inode(i)->child_count > 1) {
+            dir_sort(inode(i));
+        }
+    }
+    return 0;
+}
+
+// Mount the file system on 'dev'. Replaying the journal is the only recovery
+// step, so the time taken is bounded by the journal rather than the disk size.
+int fs_mount(blkdev_t* dev) {
+    if (!dev) {
+        log_error(LOG_FS, "FS: No block device\n");
+        return -1;
+    }
+    fs_unload();
+    fs_dev = dev;
+    if (bcache_read(dev, 0, &super, sizeof(super)) != 0 || super.magic != FS_DISK_MAGIC ||
+        super.version != FS_DISK_VERSION || super.sectors > dev->sectors ||
+        super.inode_limit < INODES_PER_CHUNK || super.inode_limit % INODES_PER_CHUNK != 0 ||
+        super.inode_limit > super.inode_count || super.inode_count > FS_MAX_INODES ||
+        (uint64_t)super.bitmap_sectors * FS_DISK_BITS_PER_SECTOR < super.data_blocks ||
+        (uint64_t)super.csum_sectors * FS_DISK_CSUMS_PER_SECTOR < super.data_blocks ||
+        (uint64_t)super.data_start + super.data_blocks > super.sectors) {
+        log_info(LOG_FS, "FS: No file system on %s\n", dev->name);
+        fs_dev = NULL;
+        return -1;
+    }
+
+    journal_open(&journal, dev, super.journal_start, super.journal_sectors, super.journal_sequence);
+    int replayed = journal_replay(&journal);
+    if (replayed < 0 || (replayed > 0 && (bcache_sync() != 0 || bcache_read(dev, 0, &super, sizeof(super)) != 0))) {
+        log_error(LOG_FS, "FS: Journal replay failed\n");
+        fs_dev = NULL;
+        return -1;
+    }
+    if (replayed > 0) {
+        log_info(LOG_FS, "FS: Replayed %d journal transactions\n", replayed);
+    }
+
+    total_blocks = super.data_blocks;
+    free_extents = kmalloc((total_blocks / 2 + 1) * sizeof(free_run_t));
+    group_blocks_used = kzalloc(total_blocks / BLOCKS_PER_GROUP + 1);
+    block_refs = kzalloc(total_blocks * sizeof(uint16_t));
+    block_bitmap = kmalloc(super.bitmap_sectors * BLOCK_SIZE);
+    tx_bitmap_sectors = kzalloc(super.bitmap_sectors);
+    tx_new_blocks = kzalloc(super.bitmap_sectors * BLOCK_SIZE);
+    block_csums = kmalloc(super.csum_sectors * BLOCK_SIZE);
+    tx_csum_sectors = kzalloc(super.csum_sectors);
+    if (!free_extents || !group_blocks_used || !block_refs || !block_bitmap || !tx_bitmap_sectors ||
+        !tx_new_blocks || !block_csums || !tx_csum_sectors) {
+        log_error(LOG_FS, "FS: Failed to allocate memory for file system\n");
+        fs_unload();
+        fs_dev = NULL;
+        return -1;
+    }
+
+    free_inode = NO_INODE;
+    inodes_used = 0;
+    free_extent_count = 0;
+    free_blocks = 0;
+    tx_head = NO_INODE;
+    tx_super = false;
+    tx_sectors = 0;
+    tx_ops = 0;
+    zero_block_csum = crc32c(0, zero_block, BLOCK_SIZE);
+    memset(open_files, 0, sizeof(open_files));
+    dcache_reset();
+
+    if (fs_load_bitmap() != 0 || fs_load_inodes() != 0 || fs_checkpoint() != 0) {
+        log_error(LOG_FS, "FS: Failed to load the file system\n");
+        fs_unload();
+        fs_dev = NULL;
+        return -1;
+    }
 
+    log_info(LOG_FS, "FS: Mounted %s, %u entries, %lu KB free\n", dev->name, inodes_used,
+             (uint64_t)free_blocks * BLOCK_SIZE / 1024);
+    return 0;
+}
+
+static int resolve_path(const char* path) {
     if (strcmp(path, "/") == 0) {
-        print("Root directory found\n");
         return 0; // Root directory
     }
 
-    char current_path[MAX_PATH_LENGTH];
     int current_dir = 0;
-
     const char* segment = path + 1; // Skip leading '/'
     const char* next_slash;
 
     while (*segment) {
         next_slash = strchr(segment, '/');
-        int segment_len = next_slash ? (next_slash - segment) : strlen(segment);
-
-        strncpy(current_path, segment, segment_len);
-        current_path[segment_len] = '\0';
-
-        bool found = false;
-        for (int i = 0; i < MAX_FS_ENTRIES; i++) {
-            if (fs_entries[i].is_used && fs_entries[i].parent == (uint32_t)current_dir &&
-                strcmp(fs_entries[i].name, current_path) == 0) {
-                if (!next_slash) {
-                    return i; // Found the final entry
-                }
-                if (fs_entries[i].type != FS_DIRECTORY) {
-                    return -1; // Not a directory
-                }
-                current_dir = i;
-                found = true;
-                break;
-            }
+        uint32_t segment_len = next_slash ? (uint32_t)(next_slash - segment) : strlen(segment);
+        if (segment_len >= MAX_FILENAME_LENGTH) {
+            return -1; // No entry has a name this long
         }
 
-        if (!found) {
+        int entry = dir_lookup(inode(current_dir), segment, segment_len, NULL);
+        if (entry == NO_ENTRY) {
             return -1; // Path segment not found
         }
+        if (!next_slash) {
+            return entry; // Found the final entry
+        }
+        if (inode(entry)->type != FS_DIRECTORY) {
+            return -1; // Not a directory
+        }
+        current_dir = entry;
+        segment = next_slash + 1;
+    }
+
+    return -1; // Path ends in '/'
+}
+
+static int lookup_cached(const char* path) {
+    uint32_t length = strlen(path);
+    if (length >= MAX_PATH_LENGTH) {
+        return resolve_path(path);
+    }
 
-        segment = next_slash ? (next_slash + 1) : "";
+    uint32_t hash = hash_name(path, length);
+    path_cache_slot_t* slot = &path_cache[hash & (PATH_CACHE_SLOTS - 1)];
+    if (slot->entry != NO_ENTRY && slot->hash == hash && strcmp(slot->path, path) == 0) {
+        cache_stats.hits++;
+        return slot->entry;
     }
 
-    return -1; // Should not reach here
+    cache_stats.misses++;
+    int entry = resolve_path(path);
+    if (entry != -1) {
+        slot->hash = hash;
+        slot->entry = entry;
+        strcpy(slot->path, path);
+    }
+    return entry;
 }
 
-int fs_create(const char* path, uint32_t size, fs_entry_type_t type) {
-    print("Creating ");
-    print(type == FS_DIRECTORY ? "directory" : "file");
-    print(": ");
-    print(path);
-    print("\n");
+int find_entry(const char* path) {
+    int entry = lookup_cached(path);
+    trace_point_text(TRACE_FIND_ENTRY, (int64_t)entry, path);
+    return entry;
+}
+
+// Add 'name' to directory 'parent' as part of the running transaction. Returns
+// the new inode, or NO_INODE if the name is taken or the table is full.
+static uint32_t entry_create(uint32_t parent, const char* name, uint32_t size, fs_entry_type_t type) {
+    uint32_t position;
+    if (dir_lookup(inode(parent), name, strlen(name), &position) != NO_ENTRY) {
+        log_error(LOG_FS, "Entry already exists\n");
+        return NO_INODE;
+    }
+
+    uint32_t index = inode_alloc();
+    if (index == NO_INODE) {
+        log_error(LOG_FS, "No free file system entries\n");
+        return NO_INODE;
+    }
+    if (dir_add_child(inode(parent), position, index) != 0) {
+        inode_free(index);
+        log_error(LOG_FS, "No free file system entries\n");
+        return NO_INODE;
+    }
+
+    fs_entry_t* entry = inode(index);
+    entry->extents = NULL;
+    entry->extent_count = 0;
+    entry->extent_capacity = 0;
+    entry->children = NULL;
+    entry->child_count = 0;
+    entry->child_capacity = 0;
+    entry->image = NULL;
+
+    strcpy(entry->name, name);
+    entry->parent = parent;
+    entry->size = type == FS_FILE ? size : 0; // Files start as one hole
+    entry->type = type;
+    entry->is_used = true;
+    tx_inode(entry);
+    return index;
+}
+
+// Split 'path' into its parent directory, returned, and its last component,
+// copied to 'name'. Returns NO_ENTRY if the parent is not a directory.
+static int path_parent(const char* path, char* name) {
     char parent_path[MAX_PATH_LENGTH];
-    char name[MAX_FILENAME_LENGTH];
 
     // Extract parent path and name
     const char* last_slash = strrchr(path, '/');
-    if (!last_slash) {
-        print("Invalid path\n");
-        return -1;
+    if (!last_slash || last_slash - path >= MAX_PATH_LENGTH) {
+        log_error(LOG_FS, "Invalid path\n");
+        return NO_ENTRY;
     }
 
     int parent_path_len = last_slash - path;
@@ -114,104 +1712,357 @@ int fs_create(const char* path, uint32_t size, fs_entry_type_t type) {
         strcpy(parent_path, "/");
     }
 
+    if (strlen(last_slash + 1) >= MAX_FILENAME_LENGTH || last_slash[1] == '\0') {
+        log_error(LOG_FS, "Invalid name\n");
+        return NO_ENTRY;
+    }
     strcpy(name, last_slash + 1);
 
     int parent_index = find_entry(parent_path);
-    print("Parent index: ");
-    print_hex(parent_index);
-    print("\n");
+    if (parent_index == -1 || inode(parent_index)->type != FS_DIRECTORY) {
+        log_error(LOG_FS, "Parent directory not found\n");
+        return NO_ENTRY;
+    }
+    return parent_index;
+}
 
-    if (parent_index == -1 || (parent_index != 0 && fs_entries[parent_index].type != FS_DIRECTORY)) {
-        print("Parent directory not found\n");
+// Remove entry 'index' from its directory and free it, as part of the running transaction
+static void entry_delete(uint32_t index) {
+    fs_entry_t* entry = inode(index);
+    dir_remove_child(inode(entry->parent), entry->name);
+    path_cache_invalidate(index);
+    file_free_blocks(entry);
+    kfree(entry->children);
+    entry->children = NULL;
+    inode_free(index);
+}
+
+int fs_create(const char* path, uint32_t size, fs_entry_type_t type) {
+    log_debug(LOG_FS, "FS: Creating %s %s\n", type == FS_DIRECTORY ? "directory" : "file", path);
+    char name[MAX_FILENAME_LENGTH];
+    int parent_index = path_parent(path, name);
+    if (parent_index == NO_ENTRY) {
         return -1;
     }
+    log_debug(LOG_FS, "FS: Parent index %d\n", parent_index);
 
-    int entry = find_free_entry();
-    if (entry == -1) {
-        print("No free file system entries\n");
+    int result = entry_create(parent_index, name, size, type) == NO_INODE ? -1 : 0;
+    tx_end();
+    return result;
+}
+
+// Add the contents of an initramfs archive to the mounted file system. Files
+// point straight at the archive bytes until they are first modified, so the
+// time taken depends on the number of entries, not on how much data they hold.
+int fs_load_initramfs(const void* archive, uint32_t size) {
+    const initramfs_header_t* header = archive;
+    if (size < sizeof(*header) || header->magic != INITRAMFS_MAGIC || header->version != INITRAMFS_VERSION ||
+        header->size > size ||
+        header->count > (header->size - sizeof(*header)) / sizeof(initramfs_entry_t)) {
+        log_error(LOG_FS, "FS: No valid initramfs\n");
+        return -1;
+    }
+    if (header->count == 0) {
+        return 0;
+    }
+    const initramfs_entry_t* records = (const initramfs_entry_t*)(header + 1);
+    uint32_t* inodes = kmalloc(header->count * sizeof(uint32_t));
+    if (!inodes) {
+        log_error(LOG_FS, "FS: Failed to allocate memory for the initramfs\n");
         return -1;
     }
 
-    if (type == FS_FILE) {
-        uint32_t blocks_needed = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
-        if (free_block + blocks_needed > FS_SIZE / BLOCK_SIZE) {
-            print("Not enough space\n");
-            return -1;
+    uint32_t loaded = 0;
+    for (uint32_t i = 0; i < header->count; i++) {
+        const initramfs_entry_t* record = &records[i];
+        inodes[i] = NO_INODE;
+        bool is_file = record->type == INITRAMFS_FILE;
+        uint32_t parent = record->parent == INITRAMFS_ROOT ? 0
+                        : record->parent < i                ? inodes[record->parent]
+                                                            : NO_INODE;
+        if (parent == NO_INODE || inode(parent)->type != FS_DIRECTORY ||
+            record->name[INITRAMFS_NAME_LENGTH - 1] != '\0' || record->name[0] == '\0' ||
+            strchr(record->name, '/') || (!is_file && record->type != INITRAMFS_DIRECTORY) ||
+            (is_file && (uint64_t)record->offset + record->size > header->size)) {
+            log_warn(LOG_FS, "FS: Skipping bad initramfs entry %u\n", i);
+            continue;
+        }
+        uint32_t index = entry_create(parent, record->name, is_file ? record->size : 0,
+                                      is_file ? FS_FILE : FS_DIRECTORY);
+        if (index == NO_INODE) {
+            continue;
+        }
+        if (is_file) {
+            inode(index)->image = (const uint8_t*)archive + record->offset;
+        }
+        inodes[i] = index;
+        loaded++;
+    }
+    kfree(inodes);
+    tx_end();
+
+    log_info(LOG_FS, "FS: Loaded %u initramfs entries, %u KB mapped in place\n", loaded,
+             header->size / 1024);
+    return 0;
+}
+
+// Make a copy of entry 'source' named 'name' in directory 'parent'. A file
+// copy shares every data block with the source. Returns the new inode, or
+// NO_INODE.
+static uint32_t entry_clone(uint32_t source, uint32_t parent, const char* name) {
+    const fs_entry_t* from = inode(source);
+    uint32_t index = entry_create(parent, name, from->size, from->type);
+    if (index == NO_INODE || from->type == FS_DIRECTORY) {
+        return index;
+    }
+    fs_entry_t* entry = inode(index);
+    if (extents_reserve(entry, from->extent_count) != 0 || chain_fit(entry, from->extent_count) != 0) {
+        log_error(LOG_FS, "Not enough space\n");
+        entry_delete(index);
+        return NO_INODE;
+    }
+    memcpy(entry->extents, from->extents, from->extent_count * sizeof(fs_extent_t));
+    entry->extent_count = from->extent_count;
+    entry->image = from->image;
+    for (uint32_t i = 0; i < entry->extent_count; i++) {
+        const fs_extent_t* extent = &entry->extents[i];
+        for (uint32_t block = extent->start; block < extent->start + extent->count; block++) {
+            block_refs[block]++;
         }
-        fs_entries[entry].start_block = free_block;
-        free_block += blocks_needed;
-    } else {
-        fs_entries[entry].start_block = 0;
     }
+    tx_inode(entry);
+    return index;
+}
 
-    strcpy(fs_entries[entry].name, name);
-    fs_entries[entry].parent = parent_index;
-    fs_entries[entry].size = size;
-    fs_entries[entry].type = type;
-    fs_entries[entry].is_used = true;
+// Copy file 'source' to 'destination' without copying its data: both share
+// the blocks until one of them writes to them
+int fs_clone(const char* source, const char* destination) {
+    int source_index = find_entry(source);
+    if (source_index == -1 || inode(source_index)->type != FS_FILE) {
+        log_error(LOG_FS, "File not found\n");
+        return -1;
+    }
+    char name[MAX_FILENAME_LENGTH];
+    int parent_index = path_parent(destination, name);
+    if (parent_index == NO_ENTRY) {
+        return -1;
+    }
+    int result = entry_clone(source_index, parent_index, name) == NO_INODE ? -1 : 0;
+    tx_end();
+    return result;
+}
 
+// Clone everything under directory 'source' into directory 'target', leaving out 'skip'.
+// Each clone is an operation of its own, so group commit splits a big tree into
+// transactions the journal can hold. Every prefix of the clone is a consistent
+// tree, so a crash part way only leaves a partial snapshot behind.
+static int tree_clone(uint32_t source, uint32_t target, uint32_t skip) {
+    for (uint32_t i = 0; i < inode(source)->child_count; i++) {
+        uint32_t child = inode(source)->children[i];
+        if (child == skip) {
+            continue;
+        }
+        uint32_t copy = entry_clone(child, target, inode(child)->name);
+        tx_end();
+        if (copy == NO_INODE || (inode(child)->type == FS_DIRECTORY && tree_clone(child, copy, skip) != 0)) {
+            return -1;
+        }
+    }
     return 0;
 }
 
+// Freeze the whole tree as /.snapshots/<name>. Every entry is cloned, so the
+// cost is one inode per entry and no data is copied.
+int fs_snapshot(const char* name) {
+    if (name[0] == '\0' || strlen(name) >= MAX_FILENAME_LENGTH || strchr(name, '/')) {
+        log_error(LOG_FS, "Invalid name\n");
+        return -1;
+    }
+    int found = dir_lookup(inode(0), SNAPSHOT_DIRECTORY, strlen(SNAPSHOT_DIRECTORY), NULL);
+    uint32_t snapshots = found == NO_ENTRY ? entry_create(0, SNAPSHOT_DIRECTORY, 0, FS_DIRECTORY) : (uint32_t)found;
+    if (snapshots == NO_INODE || inode(snapshots)->type != FS_DIRECTORY) {
+        log_error(LOG_FS, "Cannot create /" SNAPSHOT_DIRECTORY "\n");
+        tx_end();
+        return -1;
+    }
+    uint32_t root = entry_create(snapshots, name, 0, FS_DIRECTORY);
+    int result = root == NO_INODE ? -1 : tree_clone(0, root, snapshots);
+    tx_end();
+    if (result != 0) {
+        log_error(LOG_FS, "Snapshot incomplete\n");
+    }
+    return result;
+}
+
 int fs_delete(const char* path) {
     int entry_index = find_entry(path);
     if (entry_index == -1) {
-        print("Entry not found\n");
+        log_error(LOG_FS, "Entry not found\n");
         return -1;
     }
 
-    if (fs_entries[entry_index].type == FS_DIRECTORY) {
-        // Check if directory is empty
-        for (int i = 0; i < MAX_FS_ENTRIES; i++) {
-            if (fs_entries[i].is_used && fs_entries[i].parent == (uint32_t)entry_index) {
-                print("Directory not empty\n");
-                return -1;
-            }
-        }
+    if (entry_index == 0) {
+        log_error(LOG_FS, "Cannot delete the root directory\n");
+        return -1;
+    }
+
+    fs_entry_t* entry = inode(entry_index);
+    if (entry->type == FS_DIRECTORY && entry->child_count > 0) {
+        log_error(LOG_FS, "Directory not empty\n");
+        return -1;
     }
 
-    fs_entries[entry_index].is_used = false;
+    entry_delete(entry_index);
+    tx_end();
     return 0;
 }
 
 int fs_read(const char* path, void* buffer, uint32_t size, uint32_t offset) {
     int file_index = find_entry(path);
-    if (file_index == -1 || fs_entries[file_index].type != FS_FILE) {
-        print("File not found\n");
+    if (file_index == -1 || inode(file_index)->type != FS_FILE) {
+        log_error(LOG_FS, "File not found\n");
         return -1;
     }
 
-    if (offset + size > fs_entries[file_index].size) {
-        print("Read out of bounds\n");
+    int result = file_read(inode(file_index), buffer, size, offset);
+    trace_point(TRACE_FS_READ, file_index, offset, size, (int64_t)result);
+    return result;
+}
+
+int fs_write(const char* path, const void* buffer, uint32_t size, uint32_t offset) {
+    int file_index = find_entry(path);
+    if (file_index == -1 || inode(file_index)->type != FS_FILE) {
+        log_error(LOG_FS, "File not found\n");
         return -1;
     }
 
-    uint32_t start = fs_entries[file_index].start_block * BLOCK_SIZE + offset;
-    memcpy(buffer, fs_data + start, size);
-    return size;
+    int result = file_write(inode(file_index), buffer, size, offset);
+    trace_point(TRACE_FS_WRITE, file_index, offset, size, (int64_t)result);
+    return result;
 }
 
-int fs_write(const char* path, const void* buffer, uint32_t size, uint32_t offset) {
+int fs_truncate(const char* path, uint32_t size) {
     int file_index = find_entry(path);
-    if (file_index == -1 || fs_entries[file_index].type != FS_FILE) {
-        print("File not found\n");
+    if (file_index == -1 || inode(file_index)->type != FS_FILE) {
+        log_error(LOG_FS, "File not found\n");
         return -1;
     }
 
-    if (offset + size > fs_entries[file_index].size) {
-        print("Write out of bounds\n");
+    return file_truncate(inode(file_index), size);
+}
+
+int fs_open(const char* path, int flags) {
+    if (!(flags & FS_O_RDWR)) {
         return -1;
     }
 
-    uint32_t start = fs_entries[file_index].start_block * BLOCK_SIZE + offset;
-    memcpy(fs_data + start, buffer, size);
-    return size;
+    int file_index = find_entry(path);
+    if (file_index == -1 || inode(file_index)->type != FS_FILE) {
+        log_error(LOG_FS, "File not found\n");
+        return -1;
+    }
+
+    for (int fd = 0; fd < FS_MAX_OPEN_FILES; fd++) {
+        if (!open_files[fd].in_use) {
+            open_files[fd].in_use = true;
+            open_files[fd].flags = flags;
+            open_files[fd].entry = file_index;
+            open_files[fd].generation = inode(file_index)->generation;
+            open_files[fd].position = 0;
+            return fd;
+        }
+    }
+    log_error(LOG_FS, "Too many open files\n");
+    return -1;
+}
+
+// The open file behind 'fd', or NULL if it is not open or its file was deleted
+static fs_file_t* file_get(int fd) {
+    if (fd < 0 || fd >= FS_MAX_OPEN_FILES || !open_files[fd].in_use) {
+        return NULL;
+    }
+    fs_file_t* file = &open_files[fd];
+    if (!inode(file->entry)->is_used || inode(file->entry)->generation != file->generation) {
+        log_error(LOG_FS, "Stale file handle\n");
+        return NULL;
+    }
+    return file;
+}
+
+int fs_close(int fd) {
+    if (fd < 0 || fd >= FS_MAX_OPEN_FILES || !open_files[fd].in_use) {
+        return -1;
+    }
+    open_files[fd].in_use = false;
+    return 0;
+}
+
+int fs_pread(int fd, void* buffer, uint32_t size, uint32_t offset) {
+    fs_file_t* file = file_get(fd);
+    if (!file || !(file->flags & FS_O_READ)) {
+        return -1;
+    }
+    int result = file_read(inode(file->entry), buffer, size, offset);
+    trace_point(TRACE_FS_READ, file->entry, offset, size, (int64_t)result);
+    return result;
+}
+
+int fs_pwrite(int fd, const void* buffer, uint32_t size, uint32_t offset) {
+    fs_file_t* file = file_get(fd);
+    if (!file || !(file->flags & FS_O_WRITE)) {
+        return -1;
+    }
+    int result = file_write(inode(file->entry), buffer, size, offset);
+    trace_point(TRACE_FS_WRITE, file->entry, offset, size, (int64_t)result);
+    return result;
+}
+
+int fs_ftruncate(int fd, uint32_t size) {
+    fs_file_t* file = file_get(fd);
+    if (!file || !(file->flags & FS_O_WRITE)) {
+        return -1;
+    }
+    return file_truncate(inode(file->entry), size);
+}
+
+int fs_fd_read(int fd, void* buffer, uint32_t size) {
+    fs_file_t* file = file_get(fd);
+    if (!file) {
+        return -1;
+    }
+    int result = fs_pread(fd, buffer, size, file->position);
+    if (result > 0) {
+        file->position += result;
+    }
+    return result;
+}
+
+int fs_fd_write(int fd, const void* buffer, uint32_t size) {
+    fs_file_t* file = file_get(fd);
+    if (!file) {
+        return -1;
+    }
+    int result = fs_pwrite(fd, buffer, size, file->position);
+    if (result > 0) {
+        file->position += result;
+    }
+    return result;
+}
+
+// Seeking past the end is allowed; a later write there leaves a hole
+int fs_seek(int fd, uint32_t offset) {
+    fs_file_t* file = file_get(fd);
+    if (!file) {
+        return -1;
+    }
+    file->position = offset;
+    return 0;
 }
 
 void fs_list(const char* path) {
     int dir_index = find_entry(path);
-    if (dir_index == -1 || fs_entries[dir_index].type != FS_DIRECTORY) {
-        print("Directory not found\n");
+    if (dir_index == -1 || inode(dir_index)->type != FS_DIRECTORY) {
+        log_error(LOG_FS, "Directory not found\n");
         return;
     }
 
@@ -219,16 +2070,16 @@ void fs_list(const char* path) {
     print(path);
     print(":\n");
 
-    for (int i = 0; i < MAX_FS_ENTRIES; i++) {
-        if (fs_entries[i].is_used && fs_entries[i].parent == (uint32_t)dir_index) {
-            print(fs_entries[i].type == FS_DIRECTORY ? "[DIR] " : "[FILE] ");
-            print(fs_entries[i].name);
-            if (fs_entries[i].type == FS_FILE) {
-                print(" (");
-                print_hex(fs_entries[i].size);
-                print(" bytes)");
-            }
-            print("\n");
+    const fs_entry_t* dir = inode(dir_index);
+    for (uint32_t i = 0; i < dir->child_count; i++) {
+        const fs_entry_t* child = inode(dir->children[i]);
+        print(child->type == FS_DIRECTORY ? "[DIR] " : "[FILE] ");
+        print(child->name);
+        if (child->type == FS_FILE) {
+            print(" (");
+            print_hex(child->size);
+            print(" bytes)");
         }
+        print("\n");
     }
-}
\ No newline at end of file
+}
@@ -1,3 +1,4 @@
+#include <stdbool.h>
 #include "kernel/io.h"
 #include "kernel/uart.h"
 
@@ -19,7 +20,202 @@ void print_hex(uint64_t num) {
     print(buffer);
 }
 
+void print_dec(uint64_t num) {
+    char buffer[21];
+    int i = 20;
+    buffer[i] = '\0';
+
+    do {
+        buffer[--i] = '0' + (num % 10);
+        num /= 10;
+    } while (num);
+
+    print(&buffer[i]);
+}
+
+typedef struct {
+    char* buffer;
+    size_t size;
+    size_t length; // Including what did not fit
+} kfmt_out_t;
+
+static void kfmt_putc(kfmt_out_t* out, char c) {
+    if (out->length + 1 < out->size) {
+        out->buffer[out->length] = c;
+    }
+    out->length++;
+}
+
+// Lay out one converted field: sign/prefix, padding and digits or text
+static void kfmt_field(kfmt_out_t* out, const char* prefix, const char* text, size_t text_len,
+                       unsigned int width, bool left, bool zero) {
+    size_t prefix_len = 0;
+    while (prefix[prefix_len]) {
+        prefix_len++;
+    }
+    size_t pad = width > prefix_len + text_len ? width - prefix_len - text_len : 0;
+
+    if (!left && !zero) {
+        for (; pad; pad--) {
+            kfmt_putc(out, ' ');
+        }
+    }
+    for (size_t i = 0; i < prefix_len; i++) {
+        kfmt_putc(out, prefix[i]);
+    }
+    if (!left) {
+        for (; pad; pad--) {
+            kfmt_putc(out, '0');
+        }
+    }
+    for (size_t i = 0; i < text_len; i++) {
+        kfmt_putc(out, text[i]);
+    }
+    for (; pad; pad--) {
+        kfmt_putc(out, ' ');
+    }
+}
+
+int kvsnprintf(char* buffer, size_t size, const char* format, va_list args) {
+    kfmt_out_t out = { buffer, size, 0 };
+
+    for (const char* p = format; *p; p++) {
+        if (*p != '%') {
+            kfmt_putc(&out, *p);
+            continue;
+        }
+        p++;
+
+        bool left = false;
+        bool zero = false;
+        for (;; p++) {
+            if (*p == '-') {
+                left = true;
+            } else if (*p == '0') {
+                zero = true;
+            } else {
+                break;
+            }
+        }
+        unsigned int width = 0;
+        while (*p >= '0' && *p <= '9') {
+            width = width * 10 + (*p++ - '0');
+        }
+        int longs = 0;
+        if (*p == 'z') {
+            longs = 2;
+            p++;
+        } else {
+            for (; *p == 'l'; p++) {
+                longs++;
+            }
+        }
+
+        char digits[24];
+        size_t n = sizeof(digits);
+        const char* prefix = "";
+        uint64_t value;
+        unsigned int base = 10;
+        const char* hex = "0123456789abcdef";
+
+        switch (*p) {
+        case 'd':
+        case 'i': {
+            int64_t v = longs ? va_arg(args, int64_t) : va_arg(args, int);
+            if (v < 0) {
+                prefix = "-";
+                value = -(uint64_t)v;
+            } else {
+                value = (uint64_t)v;
+            }
+            break;
+        }
+        case 'u':
+        case 'x':
+        case 'X':
+            value = longs ? va_arg(args, uint64_t) : va_arg(args, unsigned int);
+            if (*p != 'u') {
+                base = 16;
+                hex = *p == 'X' ? "0123456789ABCDEF" : hex;
+            }
+            break;
+        case 'p':
+            value = (uintptr_t)va_arg(args, void*);
+            base = 16;
+            prefix = "0x";
+            break;
+        case 's': {
+            const char* s = va_arg(args, const char*);
+            if (!s) {
+                s = "(null)";
+            }
+            size_t len = 0;
+            while (s[len]) {
+                len++;
+            }
+            kfmt_field(&out, "", s, len, width, left, false);
+            continue;
+        }
+        case 'c': {
+            char c = (char)va_arg(args, int);
+            kfmt_field(&out, "", &c, 1, width, left, false);
+            continue;
+        }
+        case '%':
+            kfmt_putc(&out, '%');
+            continue;
+        case '\0':
+            p--; // A lone '%' at the end
+            continue;
+        default:
+            // Unknown conversion: print it as written
+            kfmt_putc(&out, '%');
+            kfmt_putc(&out, *p);
+            continue;
+        }
+
+        do {
+            digits[--n] = hex[value % base];
+            value /= base;
+        } while (value);
+        kfmt_field(&out, prefix, &digits[n], sizeof(digits) - n, width, left, zero);
+    }
+
+    if (size) {
+        buffer[out.length < size ? out.length : size - 1] = '\0';
+    }
+    return (int)out.length;
+}
+
+int ksnprintf(char* buffer, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = kvsnprintf(buffer, size, format, args);
+    va_end(args);
+    return length;
+}
+
+// The buffer is on the stack, not static, so an interrupt handler can print
+// while the code it interrupted is still formatting. uart_write queues a
+// message that fits in the UART ring with IRQs masked, so the two do not
+// interleave.
+int kvprintf(const char* format, va_list args) {
+    char buffer[KPRINTF_BUFFER];
+    int length = kvsnprintf(buffer, sizeof(buffer), format, args);
+    uart_write(buffer, (size_t)length < sizeof(buffer) ? (size_t)length : sizeof(buffer) - 1);
+    return length;
+}
+
+int kprintf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = kvprintf(format, args);
+    va_end(args);
+    return length;
+}
+
 void system_shutdown(void) {
+    uart_flush();
     // QEMU specific: write to system control block to trigger shutdown
     volatile uint32_t *scb = (volatile uint32_t *)0x9000000;
     *scb = 0x5555;  // Magic value to signal shutdown
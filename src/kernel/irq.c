@@ -0,0 +1,170 @@
+#include <stdbool.h>
+#include "kernel/irq.h"
+#include "kernel/gic.h"
+#include "kernel/arch.h"
+#include "kernel/uart.h"
+#include "kernel/log.h"
+#include "kernel/ksyms.h"
+
+extern const uint8_t exception_vectors[]; // src/boot/vectors.S
+
+static irq_handler_t handlers[IRQ_MAX];
+static uint64_t entry_time;
+static uint64_t interrupted_pc;
+
+#define ESR_EC(esr) (((esr) >> 26) & 0x3F)
+#define ESR_ISS(esr) ((esr) & 0x1FFFFFF)
+#define BACKTRACE_DEPTH 16
+
+// Install the vector table, bring up the GIC and unmask IRQs
+void irq_init(void) {
+    __asm__ volatile("msr vbar_el1, %0\n"
+                     "isb" :: "r"(exception_vectors) : "memory");
+    gic_init();
+    arch_irq_enable();
+}
+
+int irq_register(uint32_t irq, irq_handler_t handler) {
+    if (irq >= IRQ_MAX) {
+        return -1;
+    }
+    handlers[irq] = handler;
+    gic_enable(irq);
+    return 0;
+}
+
+uint64_t irq_entry_time(void) {
+    return entry_time;
+}
+
+uint64_t irq_interrupted_pc(void) {
+    return interrupted_pc;
+}
+
+// Serve every pending interrupt. Runs with IRQs masked, so handlers never nest.
+void irq_handle(uint64_t time, uint64_t pc) {
+    entry_time = time;
+    interrupted_pc = pc;
+    for (;;) {
+        uint32_t iar = gic_acknowledge();
+        uint32_t irq = iar & 0x3FF;
+        if (irq >= GIC_SPURIOUS) {
+            break;
+        }
+        if (irq < IRQ_MAX && handlers[irq]) {
+            handlers[irq](irq);
+        } else {
+            gic_disable(irq);
+            log_warn(LOG_BOOT, "IRQ: No handler for interrupt %u, disabled\n", irq);
+        }
+        gic_end(iar);
+    }
+}
+
+static const char* exception_class(uint64_t ec) {
+    switch (ec) {
+    case 0x00: return "Unknown reason";
+    case 0x01: return "WFI/WFE trapped";
+    case 0x07: return "FP/SIMD access trapped";
+    case 0x0E: return "Illegal execution state";
+    case 0x15: return "SVC";
+    case 0x18: return "System register access trapped";
+    case 0x20: return "Instruction abort from a lower EL";
+    case 0x21: return "Instruction abort";
+    case 0x22: return "PC alignment fault";
+    case 0x24: return "Data abort from a lower EL";
+    case 0x25: return "Data abort";
+    case 0x26: return "SP alignment fault";
+    case 0x2F: return "SError";
+    case 0x3C: return "BRK";
+    default: return "Other";
+    }
+}
+
+// Fault status code of an instruction or data abort
+static const char* abort_status(uint64_t fsc) {
+    switch (fsc & 0x3C) {
+    case 0x04: return "translation fault";
+    case 0x08: return "access flag fault";
+    case 0x0C: return "permission fault";
+    }
+    switch (fsc) {
+    case 0x00: case 0x01: case 0x02: case 0x03: return "address size fault";
+    case 0x10: return "synchronous external abort";
+    case 0x21: return "alignment fault";
+    case 0x30: return "TLB conflict abort";
+    default: return "other fault";
+    }
+}
+
+static void backtrace_entry(uint64_t pc, const char* note) {
+    uint64_t offset;
+    const char* name = ksyms_lookup(pc, &offset);
+    if (name) {
+        kprintf("  0x%016lx %s+0x%lx%s\n", pc, name, offset, note);
+    } else {
+        kprintf("  0x%016lx%s\n", pc, note);
+    }
+}
+
+// Walk the frame record chain: each record is the caller's x29 and x30, and
+// records sit at rising addresses. Stops at anything that does not look like
+// one. The link register comes first for faults in leaf functions, which save
+// no record, so it may repeat the next entry.
+static void backtrace(const exception_frame_t* frame) {
+    uint64_t fp = frame->x[29];
+    kprintf("Backtrace:\n");
+    backtrace_entry(frame->elr, " (ELR)");
+    backtrace_entry(frame->x[30], " (LR)");
+    for (int depth = 0; depth < BACKTRACE_DEPTH && fp && !(fp & 0xF); depth++) {
+        const uint64_t* record = (const uint64_t*)(uintptr_t)fp;
+        if (!record[1]) {
+            break;
+        }
+        backtrace_entry(record[1], "");
+        if (record[0] <= fp) {
+            break;
+        }
+        fp = record[0];
+    }
+}
+
+static void halt(void) {
+    uart_flush();
+    for (;;) {
+        arch_wait_for_interrupt();
+    }
+}
+
+// Anything but an IRQ taken at EL1 is a kernel bug: dump the registers and stop
+void exception_fault(uint64_t kind, const exception_frame_t* frame) {
+    static const char* const types[] = { "synchronous", "IRQ", "FIQ", "SError" };
+    static const char* const origins[] = { "EL1 on SP_EL0", "EL1", "EL0 (AArch64)", "EL0 (AArch32)" };
+    static bool faulted;
+    uint64_t ec = ESR_EC(frame->esr);
+    uint64_t iss = ESR_ISS(frame->esr);
+
+    // A fault while reporting one, e.g. from a corrupt frame pointer
+    if (faulted) {
+        kprintf("\nFault while reporting a fault, ELR 0x%016lx\n", frame->elr);
+        halt();
+    }
+    faulted = true;
+
+    kprintf("\nUnexpected %s exception from %s", types[kind % 4], origins[kind / 4 % 4]);
+    if (kind % 4 == 0) {
+        kprintf(": %s (EC 0x%02lx)", exception_class(ec), ec);
+        if (ec >= 0x20 && ec <= 0x25 && ec != 0x22 && ec != 0x23) {
+            kprintf(", %s%s", abort_status(iss & 0x3F),
+                    ec >= 0x24 ? (iss & (1 << 6) ? " on write" : " on read") : "");
+        }
+    }
+    kprintf("\n  ESR  0x%016lx  FAR  0x%016lx\n  ELR  0x%016lx  SPSR 0x%016lx\n", frame->esr,
+            frame->far, frame->elr, frame->spsr);
+    for (int i = 0; i < 30; i += 2) {
+        kprintf("  x%-2d  0x%016lx  x%-2d  0x%016lx\n", i, frame->x[i], i + 1, frame->x[i + 1]);
+    }
+    kprintf("  x30  0x%016lx  sp   0x%016lx\n", frame->x[30], frame->sp);
+    backtrace(frame);
+    halt();
+}
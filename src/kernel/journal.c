@@ -0,0 +1,162 @@
+#include "kernel/journal.h"
+#include "kernel/fs_format.h"
+#include "kernel/bcache.h"
+#include "string.h"
+#include <stdbool.h>
+
+// Scratch sectors; the file system is single threaded
+static uint8_t image[FS_DISK_SECTOR];
+static fs_journal_descriptor_t descriptor;
+static fs_journal_commit_t commit;
+
+static inline int journal_read(journal_t* journal, uint32_t position, void* buffer) {
+    return bcache_read(journal->dev, (uint64_t)(journal->start + position) * FS_DISK_SECTOR, buffer,
+                       FS_DISK_SECTOR);
+}
+
+static inline int journal_write(journal_t* journal, uint32_t position, const void* buffer) {
+    return bcache_write(journal->dev, (uint64_t)(journal->start + position) * FS_DISK_SECTOR, buffer,
+                        FS_DISK_SECTOR);
+}
+
+void journal_open(journal_t* journal, blkdev_t* dev, uint32_t start, uint32_t sectors, uint32_t sequence) {
+    journal->dev = dev;
+    journal->start = start;
+    journal->sectors = sectors;
+    journal->head = 0;
+    journal->sequence = sequence;
+}
+
+void journal_reset(journal_t* journal) {
+    journal->head = 0;
+}
+
+// Check the transaction at 'position' is complete and intact. Returns the
+// position after its commit block, or 0 if it is not there.
+static uint32_t journal_scan(journal_t* journal, uint32_t position) {
+    uint32_t images = 0;
+    uint32_t checksum = FS_DISK_CHECKSUM_SEED;
+    uint64_t sectors = journal->dev->sectors;
+    while (position < journal->sectors) {
+        if (journal_read(journal, position, &descriptor) != 0 || descriptor.sequence != journal->sequence) {
+            return 0;
+        }
+        if (descriptor.magic == FS_JOURNAL_COMMIT) {
+            memcpy(&commit, &descriptor, sizeof(commit));
+            bool intact = commit.count == images && commit.checksum == checksum;
+            return intact ? position + 1 : 0;
+        }
+        if (descriptor.magic != FS_JOURNAL_DESCRIPTOR || descriptor.count == 0 ||
+            descriptor.count > FS_JOURNAL_TAGS || position + 1 + descriptor.count >= journal->sectors) {
+            return 0;
+        }
+        for (uint32_t i = 0; i < descriptor.count; i++) {
+            if (descriptor.home[i] >= sectors) {
+                return 0;
+            }
+        }
+
+        checksum = fs_disk_checksum(checksum, &descriptor, sizeof(descriptor));
+        for (uint32_t i = 0; i < descriptor.count; i++) {
+            if (journal_read(journal, position + 1 + i, image) != 0) {
+                return 0;
+            }
+            checksum = fs_disk_checksum(checksum, image, FS_DISK_SECTOR);
+        }
+        images += descriptor.count;
+        position += 1 + descriptor.count;
+    }
+    return 0;
+}
+
+// Write every complete transaction from the start of the journal to its home
+// sectors through the cache; the caller syncs. Returns how many were replayed,
+// leaving the sequence after the last one.
+int journal_replay(journal_t* journal) {
+    int replayed = 0;
+    uint32_t position = 0;
+    while (1) {
+        uint32_t end = journal_scan(journal, position);
+        if (end == 0) {
+            break;
+        }
+        while (position < end - 1) {
+            if (journal_read(journal, position, &descriptor) != 0) {
+                return -1;
+            }
+            for (uint32_t i = 0; i < descriptor.count; i++) {
+                if (journal_read(journal, position + 1 + i, image) != 0 ||
+                    bcache_write(journal->dev, (uint64_t)descriptor.home[i] * FS_DISK_SECTOR, image,
+                                 FS_DISK_SECTOR) != 0) {
+                    return -1;
+                }
+            }
+            position += 1 + descriptor.count;
+        }
+        position = end;
+        journal->sequence++;
+        replayed++;
+    }
+    journal->head = position;
+    return replayed;
+}
+
+// Log the images of 'count' home sectors as one transaction, then write them
+// home. Everything written through the cache before the call is on disk before
+// the transaction is, and home sectors are only written once it is durable.
+// Returns -1 without logging anything if the journal has no room left.
+int journal_commit(journal_t* journal, const uint32_t* homes, uint32_t count, journal_fill_t fill) {
+    if (count == 0) {
+        return 0;
+    }
+    if (journal->head + fs_journal_sectors(count) > journal->sectors) {
+        return -1;
+    }
+    // Data blocks first, so a replayed transaction never refers to unwritten data
+    if (bcache_sync() != 0) {
+        return -1;
+    }
+
+    // The commit block goes out in the same batch as the images; the checksum
+    // tells replay whether all of them made it
+    uint32_t position = journal->head;
+    uint32_t checksum = FS_DISK_CHECKSUM_SEED;
+    for (uint32_t first = 0; first < count; first += FS_JOURNAL_TAGS) {
+        uint32_t batch = count - first < FS_JOURNAL_TAGS ? count - first : FS_JOURNAL_TAGS;
+        memset(&descriptor, 0, sizeof(descriptor));
+        descriptor.magic = FS_JOURNAL_DESCRIPTOR;
+        descriptor.sequence = journal->sequence;
+        descriptor.count = batch;
+        memcpy(descriptor.home, homes + first, batch * sizeof(uint32_t));
+        checksum = fs_disk_checksum(checksum, &descriptor, sizeof(descriptor));
+        if (journal_write(journal, position++, &descriptor) != 0) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < batch; i++) {
+            fill(first + i, image);
+            checksum = fs_disk_checksum(checksum, image, FS_DISK_SECTOR);
+            if (journal_write(journal, position++, image) != 0) {
+                return -1;
+            }
+        }
+    }
+    memset(&commit, 0, sizeof(commit));
+    commit.magic = FS_JOURNAL_COMMIT;
+    commit.sequence = journal->sequence;
+    commit.count = count;
+    commit.checksum = checksum;
+    if (journal_write(journal, position++, &commit) != 0 || bcache_sync() != 0) {
+        return -1;
+    }
+    journal->head = position;
+    journal->sequence++;
+
+    // The home copies can now be written back whenever the cache gets to them
+    for (uint32_t i = 0; i < count; i++) {
+        fill(i, image);
+        if (bcache_write(journal->dev, (uint64_t)homes[i] * FS_DISK_SECTOR, image, FS_DISK_SECTOR) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
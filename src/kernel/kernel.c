@@ -4,19 +4,22 @@
 #include "kernel/shell.h"
 #include "kernel/uart.h"
 #include "kernel/fs.h"
+#include "kernel/fdt.h"
+#include "kernel/mmu.h"
+#include "kernel/bench.h"
+#include "kernel/slab.h"
+#include "kernel/virtio_blk.h"
+#include "kernel/bcache.h"
+#include "kernel/ramdisk.h"
+#include "kernel/initramfs.h"
+#include "kernel/irq.h"
+#include "kernel/log.h"
+#include "kernel/timer.h"
 
 
-void delay(int count) {
-    for (volatile int i = 0; i < count; i++) {
-        for (volatile int j = 0; j < 10000; j++) {
-            __asm__("nop");
-        }
-    }
-}
-
 void kernel_shutdown(void) {
     print("Shutting down...\n");
-    // Perform any necessary cleanup here
+    fs_sync();
 
     system_shutdown();
 
@@ -28,55 +31,89 @@ void kernel_shutdown(void) {
 
 // Kernel main function
 void kernel_main(uint64_t dtb_ptr32, uint64_t x1, uint64_t x2, uint64_t x3) {
-    (void)dtb_ptr32; // Mark as unused
     (void)x1;
     (void)x2;
     (void)x3;
 
     *((volatile uint32_t*)(0x09000000)) = 'E';
 
-    print("1. UART initialization...\n");
+    log_debug(LOG_BOOT, "1. UART initialization...\n");
     uart_init();
-    print("UART initialized.\n");
+    log_debug(LOG_BOOT, "UART initialized.\n");
 
-    print("2. Kernel started.\n");
+    // From here on output is queued and sent by the UART interrupt
+    irq_init();
+    uart_irq_init();
+    timer_init();
+    log_debug(LOG_BOOT, "Interrupts enabled.\n");
 
-    // For now, let's assume we have 128MB of RAM
-    uint64_t mem_size = 128 * 1024 * 1024;
+    log_debug(LOG_BOOT, "2. Kernel started.\n");
 
-    print("3. Initializing Physical Memory Manager...\n");
-    pmm_init(mem_size);
+    static fdt_memory_map_t memory_map;
+    if (fdt_get_memory_map((const void*)dtb_ptr32, &memory_map) == 0) {
+        for (unsigned int i = 0; i < memory_map.memory_count; i++) {
+            log_info(LOG_BOOT, "RAM: 0x%016lx size 0x%016lx\n", memory_map.memory[i].base,
+                     memory_map.memory[i].size);
+        }
+    } else {
+        // No usable device tree: fall back to the QEMU virt default of 128MB at 0x40000000
+        log_warn(LOG_BOOT, "No device tree memory map, assuming 128MB of RAM\n");
+        memory_map.memory[0].base = 0x40000000;
+        memory_map.memory[0].size = 128 * 1024 * 1024;
+        memory_map.memory_count = 1;
+    }
 
-    print("4. PMM initialization complete.\n");
-    print("Total memory: ");
-    print_hex(mem_size);
-    print(" bytes\n");
+    log_debug(LOG_BOOT, "3. Initializing Physical Memory Manager...\n");
+    pmm_init(&memory_map);
 
-    print("5. Preparing to calculate free memory...\n");
+    log_debug(LOG_BOOT, "4. PMM initialization complete.\n");
+    log_info(LOG_BOOT, "Total memory: 0x%016lx bytes\n", pmm_get_total_memory());
+
+    slab_init();
+
+    log_debug(LOG_BOOT, "5. Preparing to calculate free memory...\n");
     // Add a small delay here
     for (volatile int i = 0; i < 1000000; i++) {
         __asm__("nop");
     }
 
-    print("6. Calculating free memory...\n");
+    log_debug(LOG_BOOT, "6. Calculating free memory...\n");
     uint64_t free_mem = pmm_get_free_memory();
 
-    print("7. Free memory calculation complete.\n");
-    print("Free memory: ");
-    print_hex(free_mem);
-    print(" bytes\n");
-
-    print("8. Physical Memory Manager test complete.\n");
+    log_debug(LOG_BOOT, "7. Free memory calculation complete.\n");
+    log_info(LOG_BOOT, "Free memory: 0x%016lx bytes\n", free_mem);
+
+    log_debug(LOG_BOOT, "8. Physical Memory Manager test complete.\n");
+
+    log_debug(LOG_BOOT, "9. Initializing file system...\n");
+    bcache_init(BCACHE_DEFAULT_BUFFERS);
+    virtio_blk_probe();
+    // Mount the first disk if it holds a file system. Otherwise format a RAM disk,
+    // whose pages are allocated on demand, of up to half of free memory, and
+    // fill it from the initramfs linked into the kernel.
+    blkdev_t* disk = blkdev_get(0);
+    if (!disk || fs_mount(disk) != 0) {
+        uint64_t fs_size = free_mem / 2 < FS_MAX_CAPACITY ? free_mem / 2 : FS_MAX_CAPACITY;
+        blkdev_t* ram = ramdisk_create(fs_size);
+        if (ram && fs_format(ram) == 0 && fs_mount(ram) == 0) {
+            fs_load_initramfs(__initramfs_start, __initramfs_end - __initramfs_start);
+        }
+    }
+    log_debug(LOG_BOOT, "10. File system initialization complete.\n");
 
-    print("9. Initializing file system...\n");
-    fs_init();
-    print("10. File system initialization complete.\n");
+#ifdef BOOT_BENCH
+    bench_hot_paths("MMU off, caches off");
+#endif
+    mmu_init(&memory_map);
+#ifdef BOOT_BENCH
+    bench_hot_paths("MMU on, caches on");
+#endif
 
-    print("11. Initialization complete. Starting shell...\n");
+    log_info(LOG_BOOT, "11. Initialization complete. Starting shell...\n");
     shell_run();
 
     // We should never reach here
-    print("12. Kernel main loop reached. This should not happen.\n");
+    log_error(LOG_BOOT, "12. Kernel main loop reached. This should not happen.\n");
     while(1) {
         __asm__("wfi");  // Wait for interrupt
     }
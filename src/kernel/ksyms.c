@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "kernel/ksyms.h"
+
+// Generated by tools/mkksyms, and __text_end by linker/linker.ld
+extern const uint64_t ksyms_table_count;
+extern const uint64_t ksyms_table_addresses[];
+extern const uint32_t ksyms_table_name_offsets[];
+extern const char ksyms_table_names[];
+extern const char __text_end[];
+
+uint32_t ksyms_count(void) {
+    return ksyms_table_count;
+}
+
+// Binary search for the last symbol at or below the address. Cheap enough
+// to run from an interrupt handler for every profiler sample.
+int ksyms_index(uint64_t address) {
+    if (ksyms_table_count == 0 || address < ksyms_table_addresses[0] ||
+        address >= (uintptr_t)__text_end) {
+        return -1;
+    }
+    uint32_t low = 0;
+    uint32_t high = ksyms_table_count;
+    while (high - low > 1) {
+        uint32_t middle = low + (high - low) / 2;
+        if (ksyms_table_addresses[middle] <= address) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+const char* ksyms_name(int index) {
+    return &ksyms_table_names[ksyms_table_name_offsets[index]];
+}
+
+uint64_t ksyms_address(int index) {
+    return ksyms_table_addresses[index];
+}
+
+const char* ksyms_lookup(uint64_t address, uint64_t* offset) {
+    int index = ksyms_index(address);
+    if (index < 0) {
+        return NULL;
+    }
+    *offset = address - ksyms_table_addresses[index];
+    return ksyms_name(index);
+}
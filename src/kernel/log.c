@@ -0,0 +1,71 @@
+#include <stdarg.h>
+#include "kernel/log.h"
+#include "string.h"
+
+static const char* const subsystem_names[LOG_SUBSYSTEMS] = {
+    [LOG_BOOT] = "boot",
+    [LOG_PMM] = "pmm",
+    [LOG_FS] = "fs",
+    [LOG_SHELL] = "shell",
+};
+
+static const char* const level_names[] = {
+    [LOG_ERROR] = "error",
+    [LOG_WARN] = "warn",
+    [LOG_INFO] = "info",
+    [LOG_DEBUG] = "debug",
+};
+
+#define LOG_LEVELS (int)(sizeof(level_names) / sizeof(level_names[0]))
+
+static int levels[LOG_SUBSYSTEMS] = {
+    [0 ... LOG_SUBSYSTEMS - 1] = LOG_LEVEL,
+};
+
+// Messages carry their own "FS: " style prefix, so this only filters
+void log_write(log_subsystem_t subsystem, int level, const char* format, ...) {
+    if (level > levels[subsystem]) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    kvprintf(format, args);
+    va_end(args);
+}
+
+int log_get_level(log_subsystem_t subsystem) {
+    return levels[subsystem];
+}
+
+void log_set_level(log_subsystem_t subsystem, int level) {
+    levels[subsystem] = level;
+}
+
+const char* log_subsystem_name(log_subsystem_t subsystem) {
+    return subsystem_names[subsystem];
+}
+
+const char* log_level_name(int level) {
+    return level >= 0 && level < LOG_LEVELS ? level_names[level] : "?";
+}
+
+int log_parse_subsystem(const char* name) {
+    for (int i = 0; i < LOG_SUBSYSTEMS; i++) {
+        if (strcmp(name, subsystem_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int log_parse_level(const char* name) {
+    for (int i = 0; i < LOG_LEVELS; i++) {
+        if (strcmp(name, level_names[i]) == 0) {
+            return i;
+        }
+    }
+    if (name[0] >= '0' && name[0] < '0' + LOG_LEVELS && name[1] == '\0') {
+        return name[0] - '0';
+    }
+    return -1;
+}
@@ -0,0 +1,134 @@
+#include "kernel/mmu.h"
+#include "kernel/pmm.h"
+#include "kernel/log.h"
+#include <stddef.h>
+
+// Identity map with a 4KB granule and 39-bit addresses: translation starts at
+// level 1, where each entry covers 1GB, and RAM is mapped with 2MB level-2 blocks.
+#define VA_BITS 39
+#define ENTRIES_PER_TABLE 512
+#define L1_SHIFT 30
+#define L2_SHIFT 21
+#define L1_BLOCK_SIZE (1ull << L1_SHIFT)
+#define L2_BLOCK_SIZE (1ull << L2_SHIFT)
+
+// Low GB of the QEMU virt address map: flash, GIC, PL011 at 0x09000000, virtio-mmio
+#define DEVICE_BASE 0x00000000
+#define DEVICE_SIZE L1_BLOCK_SIZE
+
+// MAIR_EL1 attribute indices
+#define MT_DEVICE_nGnRE 0
+#define MT_NORMAL 1
+#define MT_NORMAL_NC 2
+#define MAIR_VALUE ((0x04ull << (8 * MT_DEVICE_nGnRE)) | \
+                    (0xFFull << (8 * MT_NORMAL)) |       \
+                    (0x44ull << (8 * MT_NORMAL_NC)))
+
+// Descriptor bits
+#define PTE_BLOCK (1ull << 0)
+#define PTE_TABLE (3ull << 0)
+#define PTE_ATTR(index) ((uint64_t)(index) << 2)
+#define PTE_SH_INNER (3ull << 8)
+#define PTE_AF (1ull << 10)
+#define PTE_PXN (1ull << 53)
+#define PTE_UXN (1ull << 54)
+#define PTE_ADDR_MASK 0x0000FFFFFFFFF000ull
+
+#define PTE_DEVICE (PTE_BLOCK | PTE_ATTR(MT_DEVICE_nGnRE) | PTE_AF | PTE_PXN | PTE_UXN)
+#define PTE_NORMAL (PTE_BLOCK | PTE_ATTR(MT_NORMAL) | PTE_SH_INNER | PTE_AF | PTE_UXN)
+
+// TCR_EL1: T0SZ, write-back walks, inner shareable, 4KB granule, no TTBR1 walks
+#define TCR_T0SZ (64 - VA_BITS)
+#define TCR_IRGN0_WBWA (1ull << 8)
+#define TCR_ORGN0_WBWA (1ull << 10)
+#define TCR_SH0_INNER (3ull << 12)
+#define TCR_TG0_4K (0ull << 14)
+#define TCR_EPD1 (1ull << 23)
+#define TCR_IPS_SHIFT 32
+
+#define SCTLR_M (1ull << 0)
+#define SCTLR_A (1ull << 1)
+#define SCTLR_C (1ull << 2)
+#define SCTLR_I (1ull << 12)
+
+static uint64_t* l1_table;
+
+static uint64_t* alloc_table(void) {
+    return pmm_alloc_zeroed_page();
+}
+
+// Map [base, base + size) with 2MB Normal write-back blocks
+static int map_ram(uint64_t base, uint64_t size) {
+    uint64_t start = base & ~(L2_BLOCK_SIZE - 1);
+    uint64_t end = (base + size + L2_BLOCK_SIZE - 1) & ~(L2_BLOCK_SIZE - 1);
+
+    for (uint64_t addr = start; addr < end; addr += L2_BLOCK_SIZE) {
+        uint64_t l1_index = addr >> L1_SHIFT;
+        if (l1_index >= ENTRIES_PER_TABLE) {
+            log_warn(LOG_PMM, "MMU: RAM above the 39-bit address space is not mapped\n");
+            return -1;
+        }
+
+        uint64_t* l2_table;
+        if ((l1_table[l1_index] & 3) == PTE_TABLE) {
+            l2_table = (uint64_t*)(uintptr_t)(l1_table[l1_index] & PTE_ADDR_MASK);
+        } else {
+            l2_table = alloc_table();
+            if (!l2_table) {
+                log_error(LOG_PMM, "MMU: Out of memory for page tables\n");
+                return -1;
+            }
+            l1_table[l1_index] = (uintptr_t)l2_table | PTE_TABLE;
+        }
+
+        l2_table[(addr >> L2_SHIFT) & (ENTRIES_PER_TABLE - 1)] = addr | PTE_NORMAL;
+    }
+    return 0;
+}
+
+void mmu_init(const fdt_memory_map_t* map) {
+    log_debug(LOG_PMM, "MMU: Building identity map...\n");
+    l1_table = alloc_table();
+    if (!l1_table) {
+        log_error(LOG_PMM, "MMU: Out of memory for page tables\n");
+        return;
+    }
+
+    l1_table[DEVICE_BASE >> L1_SHIFT] = DEVICE_BASE | PTE_DEVICE;
+    for (unsigned int i = 0; i < map->memory_count; i++) {
+        if (map_ram(map->memory[i].base, map->memory[i].size) != 0) {
+            return;
+        }
+    }
+
+    // Physical address size the CPU supports goes straight into TCR_EL1.IPS
+    uint64_t mmfr0;
+    __asm__ volatile("mrs %0, id_aa64mmfr0_el1" : "=r"(mmfr0));
+    uint64_t tcr = TCR_T0SZ | TCR_IRGN0_WBWA | TCR_ORGN0_WBWA | TCR_SH0_INNER | TCR_TG0_4K |
+                   TCR_EPD1 | ((mmfr0 & 0xF) << TCR_IPS_SHIFT);
+
+    __asm__ volatile("msr mair_el1, %0" :: "r"(MAIR_VALUE));
+    __asm__ volatile("msr tcr_el1, %0" :: "r"(tcr));
+    __asm__ volatile("msr ttbr0_el1, %0" :: "r"((uintptr_t)l1_table));
+    __asm__ volatile("dsb ish\n"
+                     "isb\n"
+                     "tlbi vmalle1\n"
+                     "ic iallu\n"
+                     "dsb ish\n"
+                     "isb" ::: "memory");
+
+    uint64_t sctlr;
+    __asm__ volatile("mrs %0, sctlr_el1" : "=r"(sctlr));
+    sctlr |= SCTLR_M | SCTLR_C | SCTLR_I;
+    sctlr &= ~SCTLR_A;
+    __asm__ volatile("msr sctlr_el1, %0\n"
+                     "isb" :: "r"(sctlr) : "memory");
+
+    log_info(LOG_PMM, "MMU: Enabled with caches on\n");
+}
+
+int mmu_is_enabled(void) {
+    uint64_t sctlr;
+    __asm__ volatile("mrs %0, sctlr_el1" : "=r"(sctlr));
+    return (sctlr & SCTLR_M) != 0;
+}
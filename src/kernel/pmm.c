@@ -1,98 +1,609 @@
-#include "kernel/io.h"
+#include "kernel/pmm.h"
+#include "kernel/log.h"
+#include "kernel/trace.h"
+#include "kernel/arch.h"
+#include "kernel/fdt.h"
 #include <stdint.h>
 #include <stddef.h>
 
-#define PAGE_SIZE 4096
-#define BITMAP_SIZE 32768 // Supports up to 4GB of RAM
+#define PMM_MAX_ZONES 8
+#define PMM_MAX_RESERVED (FDT_MAX_REGIONS + PMM_MAX_ZONES + 1)
+#define ZERO_POOL_DEFAULT_DEPTH 32
+#define MAX_BLOCK_SIZE ((uint64_t)PAGE_SIZE << (PMM_MAX_ORDER - 1))
 
-static uint32_t memory_bitmap[BITMAP_SIZE];
+// Three-level map of the free blocks of one order:
+// l0 has one bit per block, l1 one bit per non-zero l0 word, l2 one bit per non-zero l1 word
+typedef struct {
+    uint64_t* l0;
+    uint64_t* l1;
+    uint64_t* l2;
+    uint64_t l0_words;
+    uint64_t l1_words;
+    uint64_t l2_words;
+    uint64_t hint; // l0 word where the last block was found (next-fit)
+} free_map_t;
+
+// A physically contiguous range of RAM managed by its own buddy allocator.
+// The base is aligned down to the largest block size so buddies are
+// naturally aligned in physical memory; pages below the real start stay used.
+typedef struct {
+    uint64_t base;
+    uint64_t start_index; // First page that really is RAM
+    uint64_t num_pages;
+    uint64_t* memory_bitmap; // One bit per page, set when the page is in use
+    free_map_t free_maps[PMM_MAX_ORDER];
+    uint32_t order_mask; // Bit k is set while order k has at least one free block
+    pmm_stats_t stats;
+} pmm_zone_t;
+
+extern char __start[];
+extern char __end[];
+
+static pmm_zone_t zones[PMM_MAX_ZONES];
+static unsigned int num_zones;
 static uint64_t total_memory;
+static uint64_t metadata_size;
+static uint64_t failed_allocs;
+
+// Pages zeroed ahead of time for pmm_alloc_zeroed_page; they count as used
+static void* zero_pool[PMM_ZERO_POOL_MAX];
+static unsigned int zero_pool_count;
+static unsigned int zero_pool_depth = ZERO_POOL_DEFAULT_DEPTH;
+static uint64_t zero_pool_hits;
+static uint64_t zero_pool_misses;
+
+static inline uint64_t align_up(uint64_t value, uint64_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static inline uint64_t align_down(uint64_t value, uint64_t align) {
+    return value & ~(align - 1);
+}
+
+static inline uint64_t page_to_index(pmm_zone_t* zone, uintptr_t addr) {
+    return (addr - zone->base) / PAGE_SIZE;
+}
 
-void pmm_init(uint64_t mem_size) {
-    print("PMM: Initializing...\n");
-    total_memory = mem_size;
-    
-    print("PMM: Marking all pages as used...\n");
-    // Initially mark all pages as used
-    for (size_t i = 0; i < BITMAP_SIZE; i++) {
-        memory_bitmap[i] = 0xFFFFFFFF;
-        if (i % 1000 == 0) {
-            print(".");  // Print a dot every 1000 iterations to show progress
+static inline int free_map_test(pmm_zone_t* zone, unsigned int order, uint64_t block) {
+    return (zone->free_maps[order].l0[block / 64] >> (block % 64)) & 1;
+}
+
+static inline void free_map_set(pmm_zone_t* zone, unsigned int order, uint64_t block) {
+    free_map_t* map = &zone->free_maps[order];
+    uint64_t word = block / 64;
+    map->l0[word] |= 1ull << (block % 64);
+    map->l1[word / 64] |= 1ull << (word % 64);
+    map->l2[word / 4096] |= 1ull << ((word / 64) % 64);
+    zone->order_mask |= 1u << order;
+    zone->stats.free_blocks[order]++;
+}
+
+static inline void free_map_clear(pmm_zone_t* zone, unsigned int order, uint64_t block) {
+    free_map_t* map = &zone->free_maps[order];
+    uint64_t word = block / 64;
+    zone->stats.free_blocks[order]--;
+    map->l0[word] &= ~(1ull << (block % 64));
+    if (map->l0[word]) {
+        return;
+    }
+    map->l1[word / 64] &= ~(1ull << (word % 64));
+    if (map->l1[word / 64]) {
+        return;
+    }
+    map->l2[word / 4096] &= ~(1ull << ((word / 64) % 64));
+    for (uint64_t i = 0; i < map->l2_words; i++) {
+        if (map->l2[i]) {
+            return;
         }
     }
-    print("\n");
+    zone->order_mask &= ~(1u << order);
+}
+
+// First non-zero l0 word at or after 'from', or -1
+static int64_t free_map_next_word(free_map_t* map, uint64_t from) {
+    if (from >= map->l0_words) {
+        return -1;
+    }
+    uint64_t i1 = from / 64;
+    uint64_t bits = map->l1[i1] & (~0ull << (from % 64));
+    if (bits) {
+        return i1 * 64 + __builtin_ctzll(bits);
+    }
 
-    print("PMM: Calculating number of pages...\n");
-    // Calculate number of pages and mark them as free
-    size_t num_pages = mem_size / PAGE_SIZE;
-    print("PMM: Number of pages: ");
-    print_hex(num_pages);
-    print("\n");
+    uint64_t from1 = i1 + 1;
+    if (from1 >= map->l1_words) {
+        return -1;
+    }
+    uint64_t i2 = from1 / 64;
+    bits = map->l2[i2] & (~0ull << (from1 % 64));
+    while (!bits) {
+        if (++i2 >= map->l2_words) {
+            return -1;
+        }
+        bits = map->l2[i2];
+    }
+    i1 = i2 * 64 + __builtin_ctzll(bits);
+    return i1 * 64 + __builtin_ctzll(map->l1[i1]);
+}
 
-    print("PMM: Marking pages as free...\n");
-    for (size_t i = 0; i < num_pages; i++) {
-        memory_bitmap[i / 32] &= ~(1 << (i % 32));
-        if (i % 1000 == 0) {
-            print(".");  // Print a dot every 1000 iterations to show progress
+// Find a free block of the given order, starting from the next-fit hint
+static int64_t free_map_find(pmm_zone_t* zone, unsigned int order) {
+    free_map_t* map = &zone->free_maps[order];
+    int64_t word = free_map_next_word(map, map->hint);
+    if (word < 0) {
+        word = free_map_next_word(map, 0);
+        if (word < 0) {
+            return -1;
         }
     }
-    print("\n");
+    map->hint = word;
+    return word * 64 + __builtin_ctzll(map->l0[word]);
+}
+
+// Mark pages [start, start + count) as used or free in the zone's page bitmap
+static void bitmap_mark(pmm_zone_t* zone, uint64_t start, uint64_t count, int used) {
+    uint64_t* bitmap = zone->memory_bitmap;
+    uint64_t i = start;
+    uint64_t end = start + count;
 
-    print("PMM: Initialization complete.\n");
+    while (i < end && (i % 64) != 0) {
+        if (used) bitmap[i / 64] |= (1ull << (i % 64));
+        else bitmap[i / 64] &= ~(1ull << (i % 64));
+        i++;
+    }
+    while (i + 64 <= end) {
+        bitmap[i / 64] = used ? ~0ull : 0;
+        i += 64;
+    }
+    while (i < end) {
+        if (used) bitmap[i / 64] |= (1ull << (i % 64));
+        else bitmap[i / 64] &= ~(1ull << (i % 64));
+        i++;
+    }
 }
 
-void* pmm_alloc_page() {
-    for (size_t i = 0; i < BITMAP_SIZE; i++) {
-        if (memory_bitmap[i] != 0xFFFFFFFF) {
-            for (int j = 0; j < 32; j++) {
-                if (!(memory_bitmap[i] & (1 << j))) {
-                    memory_bitmap[i] |= (1 << j);
-                    return (void*)(((i * 32) + j) * PAGE_SIZE);
-                }
+static inline uint64_t div_round_up(uint64_t value, uint64_t divisor) {
+    return (value + divisor - 1) / divisor;
+}
+
+// Number of 64-bit words of bitmaps a zone of 'num_pages' pages needs
+static uint64_t zone_metadata_words(uint64_t num_pages) {
+    uint64_t words = div_round_up(num_pages, 64);
+    for (unsigned int order = 0; order < PMM_MAX_ORDER; order++) {
+        uint64_t l0 = div_round_up(div_round_up(num_pages, 1ull << order), 64);
+        uint64_t l1 = div_round_up(l0, 64);
+        words += l0 + l1 + div_round_up(l1, 64);
+    }
+    return words;
+}
+
+// Lay the zone's bitmaps out in 'storage' and start with every page in use
+static void zone_init(pmm_zone_t* zone, uint64_t base, uint64_t start_index, uint64_t num_pages,
+                      uint64_t* storage) {
+    zone->base = base;
+    zone->start_index = start_index;
+    zone->num_pages = num_pages;
+    zone->order_mask = 0;
+
+    uint64_t words = div_round_up(num_pages, 64);
+    zone->memory_bitmap = storage;
+    for (uint64_t i = 0; i < words; i++) {
+        storage[i] = ~0ull;
+    }
+    storage += words;
+
+    for (unsigned int order = 0; order < PMM_MAX_ORDER; order++) {
+        free_map_t* map = &zone->free_maps[order];
+        map->l0_words = div_round_up(div_round_up(num_pages, 1ull << order), 64);
+        map->l1_words = div_round_up(map->l0_words, 64);
+        map->l2_words = div_round_up(map->l1_words, 64);
+        map->l0 = storage;
+        map->l1 = map->l0 + map->l0_words;
+        map->l2 = map->l1 + map->l1_words;
+        map->hint = 0;
+        uint64_t map_words = map->l0_words + map->l1_words + map->l2_words;
+        for (uint64_t i = 0; i < map_words; i++) {
+            storage[i] = 0;
+        }
+        storage += map_words;
+
+        zone->stats.free_blocks[order] = 0;
+        zone->stats.allocs[order] = 0;
+        zone->stats.frees[order] = 0;
+    }
+
+    zone->stats.total_pages = num_pages - start_index;
+    zone->stats.free_pages = 0;
+    zone->stats.used_pages = num_pages - start_index;
+    zone->stats.failed_allocs = 0;
+}
+
+// Give pages [start, end) of the zone to its buddy allocator as the largest
+// naturally aligned blocks that fit
+static void zone_add_free_range(pmm_zone_t* zone, uint64_t start, uint64_t end) {
+    uint64_t index = start;
+    while (index < end) {
+        unsigned int order = PMM_MAX_ORDER - 1;
+        while (order > 0 &&
+               ((index & ((1ull << order) - 1)) != 0 || index + (1ull << order) > end)) {
+            order--;
+        }
+        bitmap_mark(zone, index, 1ull << order, 0);
+        free_map_set(zone, order, index >> order);
+        index += 1ull << order;
+    }
+    zone->stats.free_pages += end - start;
+    zone->stats.used_pages -= end - start;
+}
+
+// Lowest page-aligned address in [start, end) where 'size' bytes overlap
+// none of the reserved ranges, or 0 if there is none
+static uint64_t find_unreserved(uint64_t start, uint64_t end, uint64_t size,
+                                const fdt_region_t* reserved, unsigned int reserved_count) {
+    uint64_t candidate = start;
+    int moved = 1;
+    while (moved) {
+        moved = 0;
+        for (unsigned int i = 0; i < reserved_count; i++) {
+            uint64_t r_start = reserved[i].base;
+            uint64_t r_end = reserved[i].base + reserved[i].size;
+            if (candidate < r_end && r_start < candidate + size) {
+                candidate = align_up(r_end, PAGE_SIZE);
+                moved = 1;
             }
         }
     }
-    return NULL; // Out of memory
+    return candidate + size <= end ? candidate : 0;
+}
+
+// Free every page of [start, end) that no reserved range touches
+static void zone_add_unreserved(pmm_zone_t* zone, uint64_t start, uint64_t end,
+                                const fdt_region_t* reserved, unsigned int reserved_count) {
+    // Reserved ranges clipped to the zone, sorted by base
+    fdt_region_t clipped[PMM_MAX_RESERVED];
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < reserved_count; i++) {
+        uint64_t r_start = align_down(reserved[i].base, PAGE_SIZE);
+        uint64_t r_end = align_up(reserved[i].base + reserved[i].size, PAGE_SIZE);
+        if (r_end <= start || r_start >= end) {
+            continue;
+        }
+        unsigned int j = count++;
+        while (j > 0 && clipped[j - 1].base > r_start) {
+            clipped[j] = clipped[j - 1];
+            j--;
+        }
+        clipped[j].base = r_start < start ? start : r_start;
+        clipped[j].size = (r_end > end ? end : r_end) - clipped[j].base;
+    }
+
+    uint64_t cursor = start;
+    for (unsigned int i = 0; i < count; i++) {
+        if (clipped[i].base > cursor) {
+            zone_add_free_range(zone, page_to_index(zone, cursor), page_to_index(zone, clipped[i].base));
+        }
+        uint64_t r_end = clipped[i].base + clipped[i].size;
+        if (r_end > cursor) {
+            cursor = r_end;
+        }
+    }
+    if (cursor < end) {
+        zone_add_free_range(zone, page_to_index(zone, cursor), page_to_index(zone, end));
+    }
+}
+
+void pmm_init(const fdt_memory_map_t* map) {
+    log_debug(LOG_PMM, "PMM: Initializing...\n");
+    num_zones = 0;
+    total_memory = 0;
+    metadata_size = 0;
+    failed_allocs = 0;
+
+    // Firmware reservations, the kernel image and, as they are placed, the zone bitmaps
+    fdt_region_t reserved[PMM_MAX_RESERVED];
+    unsigned int reserved_count = 0;
+    for (unsigned int i = 0; i < map->reserved_count; i++) {
+        reserved[reserved_count++] = map->reserved[i];
+    }
+    reserved[reserved_count].base = (uintptr_t)__start;
+    reserved[reserved_count].size = (uintptr_t)__end - (uintptr_t)__start;
+    reserved_count++;
+
+    for (unsigned int i = 0; i < map->memory_count && num_zones < PMM_MAX_ZONES; i++) {
+        uint64_t start = align_up(map->memory[i].base, PAGE_SIZE);
+        uint64_t end = align_down(map->memory[i].base + map->memory[i].size, PAGE_SIZE);
+        if (end <= start) {
+            continue;
+        }
+
+        pmm_zone_t* zone = &zones[num_zones];
+        uint64_t base = align_down(start, MAX_BLOCK_SIZE);
+        uint64_t num_pages = (end - base) / PAGE_SIZE;
+        uint64_t size = align_up(zone_metadata_words(num_pages) * sizeof(uint64_t), PAGE_SIZE);
+
+        // The zone's bitmaps live in the zone itself
+        uint64_t metadata = find_unreserved(start, end, size, reserved, reserved_count);
+        if (!metadata || reserved_count == PMM_MAX_RESERVED) {
+            log_warn(LOG_PMM, "PMM: No room for the metadata of zone 0x%016lx, skipping it\n", start);
+            continue;
+        }
+        reserved[reserved_count].base = metadata;
+        reserved[reserved_count].size = size;
+        reserved_count++;
+
+        zone_init(zone, base, (start - base) / PAGE_SIZE, num_pages, (uint64_t*)(uintptr_t)metadata);
+        zone_add_unreserved(zone, start, end, reserved, reserved_count);
+        num_zones++;
+        total_memory += end - start;
+        metadata_size += size;
+
+        log_info(LOG_PMM, "PMM: Zone 0x%016lx - 0x%016lx: %lu free pages, %lu bytes of metadata\n",
+                 start, end, zone->stats.free_pages, size);
+    }
+
+    log_debug(LOG_PMM, "PMM: Initialization complete.\n");
+}
+
+unsigned int pmm_size_to_order(uint64_t size) {
+    unsigned int order = 0;
+    while (order < PMM_MAX_ORDER && ((uint64_t)PAGE_SIZE << order) < size) {
+        order++;
+    }
+    return order;
+}
+
+static void* zone_alloc(pmm_zone_t* zone, unsigned int order) {
+    // Smallest order at or above the request that has a free block
+    uint32_t candidates = zone->order_mask & (~0u << order);
+    if (!candidates) {
+        return NULL;
+    }
+    unsigned int current = __builtin_ctz(candidates);
+
+    uint64_t block = free_map_find(zone, current);
+    uint64_t index = block << current;
+    free_map_clear(zone, current, block);
+
+    // Split down to the requested order, returning the upper halves to the free maps
+    while (current > order) {
+        current--;
+        free_map_set(zone, current, (index >> current) + 1);
+    }
+
+    bitmap_mark(zone, index, 1ull << order, 1);
+    zone->stats.allocs[order]++;
+    zone->stats.free_pages -= 1ull << order;
+    zone->stats.used_pages += 1ull << order;
+    return (void*)(uintptr_t)(zone->base + index * PAGE_SIZE);
+}
+
+static void zone_free(pmm_zone_t* zone, uint64_t index, unsigned int order) {
+    bitmap_mark(zone, index, 1ull << order, 0);
+    zone->stats.frees[order]++;
+    zone->stats.free_pages += 1ull << order;
+    zone->stats.used_pages -= 1ull << order;
+
+    // Merge with the buddy for as long as it is free at the same order
+    while (order < PMM_MAX_ORDER - 1) {
+        uint64_t buddy = index ^ (1ull << order);
+        if (buddy + (1ull << order) > zone->num_pages || !free_map_test(zone, order, buddy >> order)) {
+            break;
+        }
+        free_map_clear(zone, order, buddy >> order);
+        index &= ~(1ull << order);
+        order++;
+    }
+
+    free_map_set(zone, order, index >> order);
+}
+
+static pmm_zone_t* zone_for_address(uintptr_t addr) {
+    for (unsigned int i = 0; i < num_zones; i++) {
+        if (addr >= zones[i].base && addr < zones[i].base + zones[i].num_pages * PAGE_SIZE) {
+            return &zones[i];
+        }
+    }
+    return NULL;
+}
+
+static void* alloc_from_zones(unsigned int order) {
+    for (unsigned int i = 0; i < num_zones; i++) {
+        void* block = zone_alloc(&zones[i], order);
+        if (block) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+static void zero_pool_drain(unsigned int keep) {
+    while (zero_pool_count > keep) {
+        pmm_free_page(zero_pool[--zero_pool_count]);
+    }
+}
+
+void* pmm_alloc_pages(unsigned int order) {
+    if (order >= PMM_MAX_ORDER) {
+        return NULL;
+    }
+
+    void* block = alloc_from_zones(order);
+    // Pre-zeroed pages are only a cache; give them back before failing
+    if (!block && zero_pool_count > 0) {
+        zero_pool_drain(0);
+        block = alloc_from_zones(order);
+    }
+    if (!block) {
+        failed_allocs++; // Out of memory
+    }
+    trace_point(TRACE_PMM_ALLOC, (uintptr_t)block, order, 0, 0);
+    return block;
+}
+
+void pmm_free_pages(void* address, unsigned int order) {
+    uintptr_t addr = (uintptr_t)address;
+    trace_point(TRACE_PMM_FREE, addr, order, 0, 0);
+    pmm_zone_t* zone = zone_for_address(addr);
+    if (!zone || order >= PMM_MAX_ORDER || (addr & (PAGE_SIZE - 1)) != 0) {
+        log_error(LOG_PMM, "PMM: Invalid free of 0x%016lx\n", addr);
+        return;
+    }
+
+    uint64_t index = page_to_index(zone, addr);
+    if ((index & ((1ull << order) - 1)) != 0 || index + (1ull << order) > zone->num_pages) {
+        log_error(LOG_PMM, "PMM: Invalid free of 0x%016lx\n", addr);
+        return;
+    }
+    if (!(zone->memory_bitmap[index / 64] & (1ull << (index % 64)))) {
+        log_error(LOG_PMM, "PMM: Double free of 0x%016lx\n", addr);
+        return;
+    }
+
+    zone_free(zone, index, order);
+}
+
+void* pmm_alloc_page() {
+    return pmm_alloc_pages(0);
 }
 
 void pmm_free_page(void* page_address) {
-    uintptr_t addr = (uintptr_t)page_address;
-    size_t page_index = addr / PAGE_SIZE;
-    memory_bitmap[page_index / 32] &= ~(1 << (page_index % 32));
+    pmm_free_pages(page_address, 0);
+}
+
+void* pmm_alloc_zeroed_page(void) {
+    if (zero_pool_count > 0) {
+        zero_pool_hits++;
+        return zero_pool[--zero_pool_count];
+    }
+
+    zero_pool_misses++;
+    void* page = pmm_alloc_page();
+    if (page) {
+        arch_zero_pages(page, PAGE_SIZE);
+    }
+    return page;
+}
+
+unsigned int pmm_zero_pool_refill(unsigned int budget) {
+    unsigned int added = 0;
+    while (added < budget && zero_pool_count < zero_pool_depth) {
+        void* page = alloc_from_zones(0);
+        if (!page) {
+            break;
+        }
+        arch_zero_pages(page, PAGE_SIZE);
+        zero_pool[zero_pool_count++] = page;
+        added++;
+    }
+    return added;
+}
+
+void pmm_zero_pool_set_depth(unsigned int depth) {
+    if (depth > PMM_ZERO_POOL_MAX) {
+        depth = PMM_ZERO_POOL_MAX;
+    }
+    zero_pool_depth = depth;
+    zero_pool_drain(depth);
+}
+
+void pmm_zero_pool_get_stats(pmm_zero_pool_stats_t* stats) {
+    stats->depth = zero_pool_depth;
+    stats->count = zero_pool_count;
+    stats->hits = zero_pool_hits;
+    stats->misses = zero_pool_misses;
 }
 
 uint64_t pmm_get_free_memory() {
-    print("PMM: Calculating free memory...\n");
     uint64_t free_pages = 0;
-    uint64_t total_iterations = 0;
+    for (unsigned int i = 0; i < num_zones; i++) {
+        free_pages += zones[i].stats.free_pages;
+    }
+    return free_pages * PAGE_SIZE;
+}
 
-    for (size_t i = 0; i < BITMAP_SIZE; i++) {
-        uint32_t bitmap_entry = memory_bitmap[i];
-        for (int j = 0; j < 32; j++) {
-            if (!(bitmap_entry & (1 << j))) {
-                free_pages++;
-            }
-        }
-        total_iterations++;
+uint64_t pmm_get_total_memory(void) {
+    return total_memory;
+}
 
-        if (total_iterations % 1000 == 0) {
-            print("PMM: Processed ");
-            print_hex(total_iterations);
-            print(" / ");
-            print_hex(BITMAP_SIZE);
-            print(" bitmap entries\n");
+uint64_t pmm_get_metadata_size(void) {
+    return metadata_size;
+}
+
+unsigned int pmm_zone_count(void) {
+    return num_zones;
+}
+
+int pmm_get_zone_stats(unsigned int zone_index, uint64_t* base, pmm_stats_t* stats) {
+    if (zone_index >= num_zones) {
+        return -1;
+    }
+    pmm_zone_t* zone = &zones[zone_index];
+    *base = zone->base + zone->start_index * PAGE_SIZE;
+    *stats = zone->stats;
+    return 0;
+}
+
+void pmm_get_stats(pmm_stats_t* stats) {
+    stats->total_pages = 0;
+    stats->free_pages = 0;
+    stats->used_pages = 0;
+    for (unsigned int order = 0; order < PMM_MAX_ORDER; order++) {
+        stats->free_blocks[order] = 0;
+        stats->allocs[order] = 0;
+        stats->frees[order] = 0;
+    }
+    for (unsigned int i = 0; i < num_zones; i++) {
+        pmm_stats_t* zone_stats = &zones[i].stats;
+        stats->total_pages += zone_stats->total_pages;
+        stats->free_pages += zone_stats->free_pages;
+        stats->used_pages += zone_stats->used_pages;
+        for (unsigned int order = 0; order < PMM_MAX_ORDER; order++) {
+            stats->free_blocks[order] += zone_stats->free_blocks[order];
+            stats->allocs[order] += zone_stats->allocs[order];
+            stats->frees[order] += zone_stats->frees[order];
         }
     }
+    stats->failed_allocs = failed_allocs;
+}
+
+// Recount one zone from its bitmaps and compare against the live counters
+static int zone_audit(pmm_zone_t* zone) {
+    int errors = 0;
+
+    // Bits below start_index and past num_pages in the last word are always set
+    uint64_t words = (zone->num_pages + 63) / 64;
+    uint64_t used = arch_popcount(zone->memory_bitmap, words) - (words * 64 - zone->num_pages) -
+                    zone->start_index;
+    if (used != zone->stats.used_pages || zone->stats.total_pages - used != zone->stats.free_pages) {
+        log_error(LOG_PMM, "PMM: audit: page bitmap has %lu used pages, counters say %lu used / %lu free\n",
+                  used, zone->stats.used_pages, zone->stats.free_pages);
+        errors++;
+    }
 
-    print("PMM: Free memory calculation complete\n");
-    print("PMM: Free pages: ");
-    print_hex(free_pages);
-    print("\n");
+    uint64_t free_from_blocks = 0;
+    for (unsigned int order = 0; order < PMM_MAX_ORDER; order++) {
+        free_map_t* map = &zone->free_maps[order];
+        uint64_t blocks = arch_popcount(map->l0, map->l0_words);
+        if (blocks != zone->stats.free_blocks[order]) {
+            log_error(LOG_PMM, "PMM: audit: order %u has %lu free blocks, counter says %lu\n",
+                      order, blocks, zone->stats.free_blocks[order]);
+            errors++;
+        }
+        free_from_blocks += blocks << order;
+    }
+    if (free_from_blocks != zone->stats.free_pages) {
+        log_error(LOG_PMM, "PMM: audit: free blocks cover %lu pages, counter says %lu\n",
+                  free_from_blocks, zone->stats.free_pages);
+        errors++;
+    }
 
-    uint64_t free_memory = free_pages * PAGE_SIZE;
-    print("PMM: Free memory: ");
-    print_hex(free_memory);
-    print(" bytes\n");
+    return errors;
+}
 
-    return free_memory;
-}
\ No newline at end of file
+int pmm_audit(void) {
+    int errors = 0;
+    for (unsigned int i = 0; i < num_zones; i++) {
+        errors += zone_audit(&zones[i]);
+    }
+    return errors;
+}
@@ -0,0 +1,174 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel/profile.h"
+#include "kernel/ksyms.h"
+#include "kernel/timer.h"
+#include "kernel/irq.h"
+#include "kernel/arch.h"
+#include "kernel/slab.h"
+#include "kernel/io.h"
+#include "string.h"
+
+#define PMU_IRQ 23 // PMU overflow: PPI 7 on the QEMU virt GIC
+#define PMU_EVENT_CPU_CYCLES 0x11
+#define PMCR_E (1 << 0)
+
+// Event counter 0 does the sampling, leaving the cycle counter to bench.c
+#define PMU_COUNTER_BIT (1ull << 0)
+
+static uint32_t* samples; // Per symbol, plus a last slot for PCs outside the kernel text
+static uint32_t slots;
+static uint64_t total;
+static uint64_t started;
+static uint64_t stopped;
+static bool running;
+static profile_source_t source;
+static uint32_t rate;
+static bool pmu_registered;
+
+// Runs in IRQ context
+static void profile_sample(uint64_t pc) {
+    int index = ksyms_index(pc);
+    samples[index < 0 ? slots - 1 : (uint32_t)index]++;
+    total++;
+}
+
+static void timer_tick(void) {
+    profile_sample(irq_interrupted_pc());
+}
+
+// The 32-bit event counter overflows, raising the interrupt, after 'rate' cycles
+static void pmu_arm(void) {
+    uint64_t start = (uint32_t)-rate;
+    __asm__ volatile("msr pmevcntr0_el0, %0\n"
+                     "isb" :: "r"(start));
+}
+
+static void pmu_irq(uint32_t irq) {
+    (void)irq;
+    __asm__ volatile("msr pmovsclr_el0, %0" :: "r"(PMU_COUNTER_BIT));
+    profile_sample(irq_interrupted_pc());
+    pmu_arm();
+}
+
+static bool pmu_present(void) {
+    uint64_t dfr0;
+    __asm__ volatile("mrs %0, id_aa64dfr0_el1" : "=r"(dfr0));
+    uint64_t version = (dfr0 >> 8) & 0xF; // PMUVer: 0 is none, 0xF is IMPLEMENTATION DEFINED
+    return version != 0 && version != 0xF;
+}
+
+static void pmu_start(void) {
+    if (!pmu_registered) {
+        irq_register(PMU_IRQ, pmu_irq);
+        pmu_registered = true;
+    }
+    uint64_t pmcr;
+    __asm__ volatile("msr pmevtyper0_el0, %0" :: "r"((uint64_t)PMU_EVENT_CPU_CYCLES)); // EL0 and EL1
+    pmu_arm();
+    __asm__ volatile("msr pmovsclr_el0, %0\n"
+                     "msr pmintenset_el1, %0\n"
+                     "msr pmcntenset_el0, %0" :: "r"(PMU_COUNTER_BIT));
+    __asm__ volatile("mrs %0, pmcr_el0" : "=r"(pmcr));
+    __asm__ volatile("msr pmcr_el0, %0\n"
+                     "isb" :: "r"(pmcr | PMCR_E));
+}
+
+static void pmu_stop(void) {
+    __asm__ volatile("msr pmintenclr_el1, %0\n"
+                     "msr pmcntenclr_el0, %0\n"
+                     "msr pmovsclr_el0, %0\n"
+                     "isb" :: "r"(PMU_COUNTER_BIT));
+}
+
+int profile_start(profile_source_t new_source, uint32_t new_rate) {
+    if (new_source == PROFILE_PMU && !pmu_present()) {
+        return -1;
+    }
+    if (!samples) {
+        slots = ksyms_count() + 1;
+        samples = kmalloc(slots * sizeof(uint32_t));
+        if (!samples) {
+            return -1;
+        }
+    }
+    profile_stop();
+
+    memset(samples, 0, slots * sizeof(uint32_t));
+    total = 0;
+    source = new_source;
+    rate = new_rate ? new_rate : source == PROFILE_TIMER ? PROFILE_TIMER_HZ : PROFILE_PMU_PERIOD;
+    started = arch_counter();
+    running = true;
+
+    if (source == PROFILE_TIMER) {
+        timer_set_handler(timer_tick);
+        if (timer_start_periodic(rate) != 0) {
+            timer_set_handler(NULL);
+            running = false;
+            return -1;
+        }
+    } else {
+        pmu_start();
+    }
+    return 0;
+}
+
+void profile_stop(void) {
+    if (!running) {
+        return;
+    }
+    if (source == PROFILE_TIMER) {
+        timer_stop();
+        timer_set_handler(NULL);
+    } else {
+        pmu_stop();
+    }
+    stopped = arch_counter();
+    running = false;
+}
+
+// The busiest functions first, by self samples: a sample counts only for the
+// function the PC was in, not its callers
+void profile_report(void) {
+    if (total == 0) {
+        print("No samples; run 'profile start' first\n");
+        return;
+    }
+
+    uint64_t elapsed = (running ? arch_counter() : stopped) - started;
+    kprintf("%lu samples in %lu ms, ", total, timer_ticks_to_ns(elapsed) / 1000000);
+    if (source == PROFILE_TIMER) {
+        kprintf("timer at %u Hz%s\n", rate, running ? ", still running" : "");
+    } else {
+        kprintf("PMU every %u cycles%s\n", rate, running ? ", still running" : "");
+    }
+    kprintf("%10s %7s  %s\n", "samples", "%", "function");
+
+    // Repeated selection of the next largest count keeps this allocation free
+    uint64_t last_count = UINT64_MAX;
+    uint32_t last_slot = 0;
+    uint64_t shown = 0;
+    for (int line = 0; line < PROFILE_REPORT_LINES; line++) {
+        int best = -1;
+        for (uint32_t i = 0; i < slots; i++) {
+            uint64_t count = samples[i];
+            bool after_last = count < last_count || (count == last_count && i > last_slot);
+            if (count && after_last && (best < 0 || count > samples[best])) {
+                best = i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        uint64_t permille = (uint64_t)samples[best] * 1000 / total;
+        kprintf("%10u %5lu.%lu  %s\n", samples[best], permille / 10, permille % 10,
+                (uint32_t)best == slots - 1 ? "(outside kernel text)" : ksyms_name(best));
+        shown += samples[best];
+        last_count = samples[best];
+        last_slot = best;
+    }
+    if (shown < total) {
+        kprintf("%10lu          in other functions\n", total - shown);
+    }
+}
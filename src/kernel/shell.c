@@ -3,6 +3,15 @@
 #include "kernel/io.h"
 #include "kernel/pmm.h"
 #include "kernel/fs.h"
+#include "kernel/bench.h"
+#include "kernel/blkdev.h"
+#include "kernel/bcache.h"
+#include "kernel/slab.h"
+#include "kernel/arch.h"
+#include "kernel/log.h"
+#include "kernel/trace.h"
+#include "kernel/timer.h"
+#include "kernel/profile.h"
 #include <stddef.h>
 #include <stdint.h>
 #include "string.h" 
@@ -20,12 +29,29 @@ static void cmd_mkdir(const char* path);
 static void cmd_cd(const char* path);
 static void cmd_pwd(void);
 static void cmd_ls(const char* path);
+static void cmd_cat(const char* path);
+static void cmd_clone(const char* source, const char* destination);
+static void full_path(const char* path, char* out);
+static void cmd_memory(void);
+static void cmd_memory_audit(void);
+static void cmd_slabinfo(void);
+static void cmd_zeropool(const char* depth);
+static void cmd_fscache(void);
+static void cmd_df(void);
+static void cmd_scrub(void);
+static void cmd_lsblk(void);
+static void cmd_bcache(void);
+static void cmd_loglevel(int args, const char* arg1, const char* arg2);
+static void cmd_trace(int args, const char* arg1, const char* arg2);
+static void cmd_timer(int args, const char* arg1, const char* arg2);
+static void cmd_latency(int args, const char* arg1);
+static void cmd_profile(int args, const char* arg1, const char* arg2);
 
 // Current working directory
 static char current_directory[MAX_PATH_LENGTH] = "/";
 
 void shell_run() {
-    print("Shell: Entering shell loop\n");
+    log_debug(LOG_SHELL, "Shell: Entering shell loop\n");
     char command[MAX_COMMAND_LENGTH];
     size_t command_length = 0;
 
@@ -36,6 +62,9 @@ void shell_run() {
         // Read command
         command_length = 0;
         while (1) {
+            // Use idle time waiting for input to top up the pre-zeroed page pool;
+            // once it is full, uart_getc sleeps in WFI until a key arrives
+            while (!uart_poll() && pmm_zero_pool_refill(1) > 0);
             char c = uart_getc();
             if (c == '\r' || c == '\n') {
                 uart_putc('\n');
@@ -60,6 +89,7 @@ static void shell_execute_command(const char* command) {
     char arg1[MAX_COMMAND_LENGTH];
     char arg2[MAX_COMMAND_LENGTH];
     int args = parse_args(command, cmd, arg1, arg2);
+    trace_point_text(TRACE_SHELL, strlen(command), command);
 
     if (args == 0) {
         print("Empty command\n");
@@ -70,21 +100,40 @@ static void shell_execute_command(const char* command) {
         print("Available commands:\n");
         print("  help - Display this help message\n");
         print("  hello - Print a greeting\n");
-        print("  memory - Display memory information\n");
+        print("  memory [audit] - Display memory information, or verify the PMM counters\n");
         print("  fs_create <filename> <size> - Create a new file\n");
         print("  fs_delete <filename> - Delete a file\n");
+        print("  fs_truncate <filename> <size> - Shrink or extend a file\n");
         print("  ls [path] - List contents of a directory\n");
+        print("  cat <path> - Print the contents of a file\n");
+        print("  clone <source> <destination> - Copy a file, sharing its blocks until either copy changes\n");
+        print("  snapshot <name> - Freeze the whole tree as /.snapshots/<name>\n");
         print("  mkdir <path> - Create a new directory\n");
         print("  cd <path> - Change current directory\n");
         print("  pwd - Print current working directory\n");
+        print("  slabinfo - Display kernel heap cache statistics\n");
+        print("  zeropool [depth] - Display or set the pre-zeroed page pool\n");
+        print("  fscache - Display path lookup cache statistics\n");
+        print("  df - Display file system free space and fragmentation\n");
+        print("  scrub - Verify every file data block against its checksum\n");
+        print("  bench pmm|paths|string|blk|crc - Run the page allocator, hot path, string, block device or CRC benchmark\n");
+        print("  lsblk - List block devices\n");
+        print("  bcache - Display buffer cache statistics\n");
+        print("  loglevel [subsystem] [level] - Display or set log levels (error, warn, info, debug)\n");
+        print("  trace [on|off [event]|clear|dump|raw] - Control and print the event trace\n");
+        print("  timer [hz|once <us>|off] - Display the timer, or start a periodic or one-shot tick\n");
+        print("  latency [reset] - Display the timer interrupt latency histogram\n");
+        print("  profile start [timer|pmu]|stop|report|rate <n> - Sample where the kernel spends its time\n");
+        print("  sync - Commit the file system journal and write back cached blocks\n");
         print("  shutdown - Shut down the system\n");
     } else if (strcmp(cmd, "hello") == 0) {
         print("Hello from MyOS!\n");
     } else if (strcmp(cmd, "memory") == 0) {
-        uint64_t free_mem = pmm_get_free_memory();
-        print("Free memory: ");
-        print_hex(free_mem);
-        print(" bytes\n");
+        if (args == 2 && strcmp(arg1, "audit") == 0) {
+            cmd_memory_audit();
+        } else {
+            cmd_memory();
+        }
     } else if (strcmp(cmd, "fs_create") == 0 && args == 3) {
         uint32_t size = str_to_int(arg2);
         if (fs_create(arg1, size, FS_FILE) == 0) {
@@ -94,16 +143,71 @@ static void shell_execute_command(const char* command) {
         if (fs_delete(arg1) == 0) {
             print("File deleted successfully\n");
         }
+    } else if (strcmp(cmd, "fs_truncate") == 0 && args == 3) {
+        if (fs_truncate(arg1, str_to_int(arg2)) == 0) {
+            print("File truncated successfully\n");
+        }
     } else if (strcmp(cmd, "ls") == 0) {
         cmd_ls(args == 2 ? arg1 : current_directory);
+    } else if (strcmp(cmd, "cat") == 0 && args == 2) {
+        cmd_cat(arg1);
+    } else if (strcmp(cmd, "clone") == 0 && args == 3) {
+        cmd_clone(arg1, arg2);
+    } else if (strcmp(cmd, "snapshot") == 0 && args == 2) {
+        if (fs_snapshot(arg1) == 0) {
+            print("Snapshot created\n");
+        }
     } else if (strcmp(cmd, "mkdir") == 0 && args == 2) {
         cmd_mkdir(arg1);
     } else if (strcmp(cmd, "cd") == 0 && args == 2) {
         cmd_cd(arg1);
     } else if (strcmp(cmd, "pwd") == 0) {
         cmd_pwd();
+    } else if (strcmp(cmd, "slabinfo") == 0) {
+        cmd_slabinfo();
+    } else if (strcmp(cmd, "zeropool") == 0) {
+        cmd_zeropool(args == 2 ? arg1 : NULL);
+    } else if (strcmp(cmd, "fscache") == 0) {
+        cmd_fscache();
+    } else if (strcmp(cmd, "df") == 0) {
+        cmd_df();
+    } else if (strcmp(cmd, "scrub") == 0) {
+        cmd_scrub();
+    } else if (strcmp(cmd, "lsblk") == 0) {
+        cmd_lsblk();
+    } else if (strcmp(cmd, "bcache") == 0) {
+        cmd_bcache();
+    } else if (strcmp(cmd, "loglevel") == 0) {
+        cmd_loglevel(args, arg1, arg2);
+    } else if (strcmp(cmd, "trace") == 0) {
+        cmd_trace(args, arg1, arg2);
+    } else if (strcmp(cmd, "timer") == 0) {
+        cmd_timer(args, arg1, arg2);
+    } else if (strcmp(cmd, "latency") == 0) {
+        cmd_latency(args, arg1);
+    } else if (strcmp(cmd, "profile") == 0 && args >= 2) {
+        cmd_profile(args, arg1, arg2);
+    } else if (strcmp(cmd, "sync") == 0) {
+        if (fs_sync() != 0 || bcache_sync() != 0) {
+            print("Write-back failed\n");
+        }
+    } else if (strcmp(cmd, "bench") == 0 && args == 2) {
+        if (strcmp(arg1, "pmm") == 0) {
+            bench_pmm();
+        } else if (strcmp(arg1, "paths") == 0) {
+            bench_hot_paths("current settings");
+        } else if (strcmp(arg1, "string") == 0) {
+            bench_string();
+        } else if (strcmp(arg1, "blk") == 0) {
+            bench_blk();
+        } else if (strcmp(arg1, "crc") == 0) {
+            bench_crc();
+        } else {
+            print("Unknown benchmark\n");
+        }
     } else if (strcmp(cmd, "shutdown") == 0) {
         print("Shutting down...\n");
+        fs_sync();
         system_shutdown();
     } else {
         print("Unknown command. Type 'help' for available commands.\n");
@@ -111,18 +215,10 @@ static void shell_execute_command(const char* command) {
 }
 
 static void cmd_mkdir(const char* path) {
-    char full_path[MAX_PATH_LENGTH];
-    if (path[0] == '/') {
-        strcpy(full_path, path);
-    } else {
-        strcpy(full_path, current_directory);
-        if (strcmp(current_directory, "/") != 0) {
-            strcat(full_path, "/");
-        }
-        strcat(full_path, path);
-    }
+    char directory[MAX_PATH_LENGTH];
+    full_path(path, directory);
 
-    if (fs_create(full_path, 0, FS_DIRECTORY) == 0) {
+    if (fs_create(directory, 0, FS_DIRECTORY) == 0) {
         print("Directory created successfully\n");
     } else {
         print("Failed to create directory\n");
@@ -131,15 +227,7 @@ static void cmd_mkdir(const char* path) {
 
 static void cmd_cd(const char* path) {
     char new_path[MAX_PATH_LENGTH];
-    if (path[0] == '/') {
-        strcpy(new_path, path);
-    } else {
-        strcpy(new_path, current_directory);
-        if (strcmp(current_directory, "/") != 0) {
-            strcat(new_path, "/");
-        }
-        strcat(new_path, path);
-    }
+    full_path(path, new_path);
 
     int entry = find_entry(new_path);
     if (entry != -1 && find_entry(new_path) != -1) {
@@ -158,6 +246,430 @@ static void cmd_ls(const char* path) {
     fs_list(path);
 }
 
+// Resolve 'path' against the current directory
+static void full_path(const char* path, char* out) {
+    if (path[0] == '/') {
+        strcpy(out, path);
+    } else {
+        strcpy(out, current_directory);
+        if (strcmp(current_directory, "/") != 0) {
+            strcat(out, "/");
+        }
+        strcat(out, path);
+    }
+}
+
+static void cmd_cat(const char* path) {
+    char file[MAX_PATH_LENGTH];
+    full_path(path, file);
+
+    static char buffer[512];
+    uint32_t offset = 0;
+    int count;
+    while ((count = fs_read(file, buffer, sizeof(buffer), offset)) > 0) {
+        for (int i = 0; i < count; i++) {
+            uart_putc(buffer[i]);
+        }
+        offset += count;
+    }
+}
+
+static void cmd_clone(const char* source, const char* destination) {
+    char from[MAX_PATH_LENGTH];
+    char to[MAX_PATH_LENGTH];
+    full_path(source, from);
+    full_path(destination, to);
+    if (fs_clone(from, to) == 0) {
+        print("File cloned successfully\n");
+    }
+}
+
+static void cmd_memory(void) {
+    pmm_stats_t stats;
+    pmm_get_stats(&stats);
+    print("Free memory: ");
+    print_hex(pmm_get_free_memory());
+    print(" bytes\n");
+    print("Pages: ");
+    print_dec(stats.total_pages);
+    print(" total, ");
+    print_dec(stats.free_pages);
+    print(" free, ");
+    print_dec(stats.used_pages);
+    print(" used, ");
+    print_dec(stats.failed_allocs);
+    print(" failed allocations\n");
+    print("PMM metadata: ");
+    print_dec(pmm_get_metadata_size());
+    print(" bytes\n");
+
+    for (unsigned int zone = 0; zone < pmm_zone_count(); zone++) {
+        uint64_t base;
+        pmm_get_zone_stats(zone, &base, &stats);
+
+        print("Zone ");
+        print_dec(zone);
+        print(" at ");
+        print_hex(base);
+        print(": ");
+        print_dec(stats.total_pages);
+        print(" pages, ");
+        print_dec(stats.free_pages);
+        print(" free, ");
+        print_dec(stats.used_pages);
+        print(" used\n");
+
+        print("  order  free blocks  allocs  frees\n");
+        for (unsigned int order = 0; order < PMM_MAX_ORDER; order++) {
+            print("  ");
+            print_dec(order);
+            print("  ");
+            print_dec(stats.free_blocks[order]);
+            print("  ");
+            print_dec(stats.allocs[order]);
+            print("  ");
+            print_dec(stats.frees[order]);
+            print("\n");
+        }
+    }
+}
+
+static void cmd_memory_audit(void) {
+    int errors = pmm_audit();
+    if (errors == 0) {
+        print("PMM audit passed\n");
+    } else {
+        print("PMM audit found ");
+        print_dec(errors);
+        print(" mismatches\n");
+    }
+}
+
+static void cmd_slabinfo(void) {
+    kmem_cache_stats_t stats;
+    print("cache  size  active/total objs  slabs  hit rate  fragmentation  pages released\n");
+    for (unsigned int i = 0; kmem_cache_get_stats(i, &stats) == 0; i++) {
+        uint64_t total = stats.slabs * stats.objects_per_slab;
+        uint64_t slab_bytes = stats.slabs * PAGE_SIZE;
+        uint64_t requests = stats.hits + stats.misses;
+
+        print(stats.name);
+        print("  ");
+        print_dec(stats.object_size);
+        print("  ");
+        print_dec(stats.active_objects);
+        print("/");
+        print_dec(total);
+        print("  ");
+        print_dec(stats.slabs);
+        print("  ");
+        print_dec(requests ? stats.hits * 100 / requests : 0);
+        print("%  ");
+        print_dec(slab_bytes ? (slab_bytes - stats.active_objects * stats.object_size) * 100 / slab_bytes : 0);
+        print("%  ");
+        print_dec(stats.pages_released);
+        print("\n");
+    }
+}
+
+static void cmd_zeropool(const char* depth) {
+    if (depth) {
+        pmm_zero_pool_set_depth(str_to_int(depth));
+    }
+
+    pmm_zero_pool_stats_t stats;
+    pmm_zero_pool_get_stats(&stats);
+    print("Zero pool: ");
+    print_dec(stats.count);
+    print("/");
+    print_dec(stats.depth);
+    print(" pages, ");
+    print_dec(stats.hits);
+    print(" hits, ");
+    print_dec(stats.misses);
+    print(" misses\n");
+}
+
+static void cmd_fscache(void) {
+    fs_cache_stats_t stats;
+    fs_get_cache_stats(&stats);
+    print("Path cache: ");
+    print_dec(stats.hits);
+    print(" hits, ");
+    print_dec(stats.misses);
+    print(" misses, ");
+    print_dec(stats.invalidations);
+    print(" invalidations\n");
+    print("Dentry hash: ");
+    print_dec(stats.probes);
+    print(" component lookups\n");
+}
+
+static void cmd_df(void) {
+    fs_space_stats_t stats;
+    fs_get_space_stats(&stats);
+    print("Blocks: ");
+    print_dec(stats.total_blocks);
+    print(" total, ");
+    print_dec(stats.total_blocks - stats.free_blocks);
+    print(" used, ");
+    print_dec(stats.free_blocks);
+    print(" free (");
+    print_dec((uint64_t)stats.free_blocks * BLOCK_SIZE / 1024);
+    print(" KB)\n");
+    print("Free space: ");
+    print_dec(stats.free_extents);
+    print(" runs, largest ");
+    print_dec(stats.largest_free);
+    print(" blocks, ");
+    // Share of free space outside the largest run
+    uint32_t fragmentation = 0;
+    if (stats.free_blocks > 0) {
+        fragmentation = 100 - (uint64_t)stats.largest_free * 100 / stats.free_blocks;
+    }
+    print_dec(fragmentation);
+    print("% fragmented\n");
+    print("Files: ");
+    print_dec(stats.file_extents);
+    print(" extents\n");
+    print("Inodes: ");
+    print_dec(stats.inodes_used);
+    print(" used of ");
+    print_dec(stats.inodes_allocated);
+    print(" allocated\n");
+    print("Journal: ");
+    print_dec(stats.journal_used);
+    print(" of ");
+    print_dec(stats.journal_sectors);
+    print(" sectors in use\n");
+    print("Initramfs: ");
+    print_dec(stats.image_bytes / 1024);
+    print(" KB of file data still read in place\n");
+    print("Shared: ");
+    print_dec(stats.shared_blocks);
+    print(" blocks used by more than one file\n");
+}
+
+static void cmd_scrub(void) {
+    fs_scrub_stats_t stats;
+    uint64_t start = arch_counter();
+    int result = fs_scrub(&stats);
+    uint64_t ticks = arch_counter() - start;
+    if (result != 0) {
+        print("Scrub stopped early\n");
+    }
+    print("Scrubbed ");
+    print_dec(stats.blocks);
+    print(" blocks (");
+    print_dec((uint64_t)stats.blocks * BLOCK_SIZE / 1024);
+    print(" KB) in ");
+    print_dec(ticks * 1000 / arch_counter_freq());
+    print(" ms, ");
+    print_dec(stats.errors);
+    print(" checksum errors\n");
+}
+
+static void cmd_lsblk(void) {
+    blkdev_t* dev = blkdev_get(0);
+    if (!dev) {
+        print("No block devices\n");
+        return;
+    }
+    for (; dev; dev = dev->next) {
+        print(dev->name);
+        print(": ");
+        print_dec(dev->sectors * BLK_SECTOR_SIZE / (1024 * 1024));
+        print(" MB, ");
+        print_dec(dev->sectors);
+        print(" sectors, queue depth ");
+        print_dec(dev->queue_depth);
+        print("\n");
+    }
+}
+
+static void cmd_bcache(void) {
+    bcache_stats_t stats;
+    bcache_get_stats(&stats);
+    uint64_t lookups = stats.hits + stats.misses;
+    print("Buffers: ");
+    print_dec(stats.buffers);
+    print(" of ");
+    print_dec(BCACHE_BLOCK_SIZE);
+    print(" bytes, ");
+    print_dec(stats.dirty);
+    print(" dirty\n");
+    print("Lookups: ");
+    print_dec(stats.hits);
+    print(" hits, ");
+    print_dec(stats.misses);
+    print(" misses (");
+    print_dec(lookups ? stats.hits * 100 / lookups : 0);
+    print("% hit ratio), ");
+    print_dec(stats.evictions);
+    print(" evictions\n");
+    print("Read-ahead: ");
+    print_dec(stats.readahead);
+    print(" blocks, ");
+    print_dec(stats.readahead_hits);
+    print(" used\n");
+    print("Write-back: ");
+    print_dec(stats.flushes);
+    print(" flushes, ");
+    print_dec(stats.flush_blocks);
+    print(" blocks in ");
+    print_dec(stats.flush_requests);
+    print(" requests\n");
+}
+
+// loglevel lists every subsystem, loglevel <level> sets them all and
+// loglevel <subsystem> <level> sets one
+static void cmd_loglevel(int args, const char* arg1, const char* arg2) {
+    if (args == 1) {
+        for (int i = 0; i < LOG_SUBSYSTEMS; i++) {
+            kprintf("%-6s %s\n", log_subsystem_name(i), log_level_name(log_get_level(i)));
+        }
+        kprintf("Compiled in up to %s\n", log_level_name(LOG_LEVEL));
+        return;
+    }
+
+    int subsystem = args == 3 ? log_parse_subsystem(arg1) : -1;
+    int level = log_parse_level(args == 3 ? arg2 : arg1);
+    if (args == 3 && subsystem < 0) {
+        print("Unknown subsystem\n");
+        return;
+    }
+    if (level < 0) {
+        print("Unknown level\n");
+        return;
+    }
+    for (int i = 0; i < LOG_SUBSYSTEMS; i++) {
+        if (subsystem < 0 || subsystem == i) {
+            log_set_level(i, level);
+        }
+    }
+    if (level > LOG_LEVEL) {
+        kprintf("Messages above %s are compiled out; rebuild with LOG_LEVEL=%d to see them\n",
+                log_level_name(LOG_LEVEL), level);
+    }
+}
+
+// trace on/off take an event name, or apply to every event without one
+static void cmd_trace(int args, const char* arg1, const char* arg2) {
+    if (args == 1) {
+        for (int i = 0; i < TRACE_EVENTS; i++) {
+            kprintf("%-10s %s\n", trace_event_name(i), trace_enabled(i) ? "on" : "off");
+        }
+        kprintf("%lu records, the last %u are kept\n", trace_count(), TRACE_RECORDS);
+    } else if (strcmp(arg1, "on") == 0 || strcmp(arg1, "off") == 0) {
+        uint32_t mask = (1u << TRACE_EVENTS) - 1;
+        if (args == 3) {
+            int event = trace_parse_event(arg2);
+            if (event < 0) {
+                print("Unknown event\n");
+                return;
+            }
+            mask = 1u << event;
+        }
+        if (arg1[1] == 'n') {
+            trace_enable(mask);
+        } else {
+            trace_disable(mask);
+        }
+    } else if (strcmp(arg1, "clear") == 0) {
+        trace_clear();
+    } else if (strcmp(arg1, "dump") == 0) {
+        trace_dump();
+    } else if (strcmp(arg1, "raw") == 0) {
+        trace_dump_raw();
+    } else {
+        print("Usage: trace [on|off [event]|clear|dump|raw]\n");
+    }
+}
+
+static void cmd_timer(int args, const char* arg1, const char* arg2) {
+    if (args == 1) {
+        static const char* const modes[] = { "off", "periodic", "one-shot" };
+        timer_stats_t stats;
+        timer_get_stats(&stats);
+        kprintf("Timer: %s", modes[stats.mode]);
+        if (stats.mode == TIMER_PERIODIC) {
+            kprintf(" at %lu Hz", arch_counter_freq() / stats.period);
+        }
+        kprintf(", %lu ticks, %lu missed deadlines\n", stats.ticks, stats.missed);
+    } else if (strcmp(arg1, "off") == 0) {
+        timer_stop();
+    } else if (strcmp(arg1, "once") == 0 && args == 3) {
+        timer_start_oneshot(str_to_int(arg2));
+    } else if (timer_start_periodic(str_to_int(arg1)) != 0) {
+        print("Usage: timer [hz|once <us>|off]\n");
+    }
+}
+
+static void cmd_latency(int args, const char* arg1) {
+    if (args == 2 && strcmp(arg1, "reset") == 0) {
+        timer_reset_latency();
+        return;
+    }
+    timer_latency_t latency;
+    timer_get_latency(&latency);
+    if (latency.count == 0) {
+        print("No timer interrupts yet; start the tick with 'timer <hz>'\n");
+        return;
+    }
+
+    kprintf("%lu interrupts: min %lu ns, mean %lu ns, max %lu ns\n", latency.count,
+            timer_ticks_to_ns(latency.min), timer_ticks_to_ns(latency.total / latency.count),
+            timer_ticks_to_ns(latency.max));
+
+    // Percentiles are the upper bound of the bucket they fall in
+    static const unsigned int permille[] = { 500, 900, 990, 999 };
+    uint64_t seen = 0;
+    unsigned int next = 0;
+    for (unsigned int i = 0; i < TIMER_LATENCY_BUCKETS && next < 4; i++) {
+        seen += latency.buckets[i];
+        while (next < 4 && seen * 1000 >= latency.count * permille[next]) {
+            kprintf("  p%u.%u < %lu ns\n", permille[next] / 10, permille[next] % 10,
+                    timer_ticks_to_ns(1ull << i));
+            next++;
+        }
+    }
+
+    uint64_t peak = 0;
+    for (unsigned int i = 0; i < TIMER_LATENCY_BUCKETS; i++) {
+        peak = latency.buckets[i] > peak ? latency.buckets[i] : peak;
+    }
+    for (unsigned int i = 0; i < TIMER_LATENCY_BUCKETS; i++) {
+        if (!latency.buckets[i]) {
+            continue;
+        }
+        char bar[41];
+        unsigned int length = latency.buckets[i] * 40 / peak;
+        memset(bar, '#', length ? length : 1);
+        bar[length ? length : 1] = '\0';
+        kprintf("  < %10lu ns %10lu %s\n", timer_ticks_to_ns(1ull << i), latency.buckets[i], bar);
+    }
+}
+
+// The rate applies to the next start: timer samples per second or PMU cycles
+// per sample, 0 for the default
+static void cmd_profile(int args, const char* arg1, const char* arg2) {
+    static uint32_t rate;
+    if (strcmp(arg1, "start") == 0) {
+        profile_source_t source = args == 3 && strcmp(arg2, "pmu") == 0 ? PROFILE_PMU : PROFILE_TIMER;
+        if (profile_start(source, rate) != 0) {
+            print(source == PROFILE_PMU ? "No usable PMU\n" : "Cannot start the timer at that rate\n");
+        }
+    } else if (strcmp(arg1, "stop") == 0) {
+        profile_stop();
+    } else if (strcmp(arg1, "report") == 0) {
+        profile_report();
+    } else if (strcmp(arg1, "rate") == 0 && args == 3) {
+        rate = str_to_int(arg2);
+    } else {
+        print("Usage: profile start [timer|pmu]|stop|report|rate <n>\n");
+    }
+}
+
 static int parse_args(const char* command, char* cmd, char* arg1, char* arg2) {
     int args = 0;
     const char* start = command;
@@ -0,0 +1,375 @@
+#include "kernel/slab.h"
+#include "kernel/pmm.h"
+#include "kernel/log.h"
+#include "string.h"
+
+#define SLAB_MAGIC 0x51AB51AB
+#define LARGE_MAGIC 0x1A26E000
+#define SLAB_EMPTY_KEEP 1 // Empty slabs a cache holds on to before giving pages back
+#define KMALLOC_CLASSES 8 // 16, 32, ... 2048 bytes
+
+// Header at the start of every slab page; the objects follow it
+typedef struct slab {
+    uint32_t magic;
+    uint32_t inuse;
+    kmem_cache_t* cache;
+    void* free_list; // Free objects, linked through the object memory itself
+    struct slab* next;
+    struct slab* prev;
+} slab_t;
+
+// Header in front of kmalloc allocations too large for a slab
+typedef struct {
+    uint32_t magic;
+    uint32_t order;
+    uint64_t size;
+} large_header_t;
+
+struct kmem_cache {
+    char name[KMEM_NAME_LENGTH];
+    uint32_t object_size;
+    uint32_t stride;       // Distance between objects in a slab
+    uint32_t free_offset;  // Where a free object keeps its free-list link
+    uint32_t first_offset; // Offset of the first object from the slab header
+    uint32_t objects_per_slab;
+    kmem_ctor_t ctor;
+    slab_t* partial;
+    slab_t* full;
+    slab_t* empty;
+    uint32_t empty_count;
+    uint64_t slabs;
+    uint64_t active_objects;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t pages_released;
+    kmem_cache_t* next;
+};
+
+// Caches are themselves allocated from this statically defined cache
+static kmem_cache_t cache_cache;
+static kmem_cache_t* cache_list;
+static kmem_cache_t* kmalloc_caches[KMALLOC_CLASSES];
+static const char* kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+};
+
+static inline uint32_t align_up(uint32_t value, uint32_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static void slab_list_add(slab_t** head, slab_t* slab) {
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void slab_list_remove(slab_t** head, slab_t* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+static void* page_alloc_reclaiming(unsigned int order) {
+    void* page = pmm_alloc_pages(order);
+    if (!page && slab_reclaim() > 0) {
+        page = pmm_alloc_pages(order);
+    }
+    return page;
+}
+
+static int cache_setup(kmem_cache_t* cache, const char* name, uint32_t size, uint32_t align,
+                       kmem_ctor_t ctor) {
+    if (align < sizeof(void*)) {
+        align = sizeof(void*);
+    }
+    if ((align & (align - 1)) != 0 || size == 0) {
+        return -1;
+    }
+
+    strncpy(cache->name, name, KMEM_NAME_LENGTH - 1);
+    cache->name[KMEM_NAME_LENGTH - 1] = '\0';
+    cache->object_size = size;
+    cache->ctor = ctor;
+    if (ctor) {
+        // Keep the link outside the object so freed objects stay constructed
+        cache->free_offset = align_up(size, sizeof(void*));
+        cache->stride = align_up(cache->free_offset + sizeof(void*), align);
+    } else {
+        cache->free_offset = 0;
+        cache->stride = align_up(size < sizeof(void*) ? sizeof(void*) : size, align);
+    }
+    cache->first_offset = align_up(sizeof(slab_t), align);
+    if (cache->first_offset >= PAGE_SIZE) {
+        return -1;
+    }
+    cache->objects_per_slab = (PAGE_SIZE - cache->first_offset) / cache->stride;
+    if (cache->objects_per_slab == 0) {
+        return -1;
+    }
+
+    cache->partial = NULL;
+    cache->full = NULL;
+    cache->empty = NULL;
+    cache->empty_count = 0;
+    cache->slabs = 0;
+    cache->active_objects = 0;
+    cache->allocs = 0;
+    cache->frees = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->pages_released = 0;
+
+    cache->next = cache_list;
+    cache_list = cache;
+    return 0;
+}
+
+static slab_t* slab_create(kmem_cache_t* cache) {
+    slab_t* slab = page_alloc_reclaiming(0);
+    if (!slab) {
+        return NULL;
+    }
+
+    slab->magic = SLAB_MAGIC;
+    slab->inuse = 0;
+    slab->cache = cache;
+    slab->free_list = NULL;
+
+    // Build the free list back to front so objects are handed out in address order
+    uint8_t* objects = (uint8_t*)slab + cache->first_offset;
+    for (int i = cache->objects_per_slab - 1; i >= 0; i--) {
+        uint8_t* object = objects + i * cache->stride;
+        if (cache->ctor) {
+            cache->ctor(object);
+        }
+        *(void**)(object + cache->free_offset) = slab->free_list;
+        slab->free_list = object;
+    }
+
+    cache->slabs++;
+    return slab;
+}
+
+static void slab_release(kmem_cache_t* cache, slab_t* slab) {
+    slab->magic = 0;
+    pmm_free_page(slab);
+    cache->slabs--;
+    cache->pages_released++;
+}
+
+void slab_init(void) {
+    log_debug(LOG_PMM, "SLAB: Initializing...\n");
+    cache_list = NULL;
+    cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), sizeof(void*), NULL);
+
+    for (int i = 0; i < KMALLOC_CLASSES; i++) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], KMALLOC_MIN_SIZE << i, 0, NULL);
+        if (!kmalloc_caches[i]) {
+            log_error(LOG_PMM, "SLAB: Failed to create %s\n", kmalloc_names[i]);
+        }
+    }
+    log_debug(LOG_PMM, "SLAB: Initialization complete.\n");
+}
+
+kmem_cache_t* kmem_cache_create(const char* name, uint32_t size, uint32_t align, kmem_ctor_t ctor) {
+    kmem_cache_t* cache = kmem_cache_alloc(&cache_cache);
+    if (!cache) {
+        return NULL;
+    }
+    if (cache_setup(cache, name, size, align, ctor) != 0) {
+        kmem_cache_free(&cache_cache, cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void kmem_cache_destroy(kmem_cache_t* cache) {
+    if (cache->active_objects > 0) {
+        log_error(LOG_PMM, "SLAB: Cannot destroy %s, objects still in use\n", cache->name);
+        return;
+    }
+    kmem_cache_shrink(cache);
+
+    kmem_cache_t** link = &cache_list;
+    while (*link && *link != cache) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = cache->next;
+    }
+    kmem_cache_free(&cache_cache, cache);
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache) {
+    slab_t* slab = cache->partial;
+    if (slab) {
+        cache->hits++;
+    } else if (cache->empty) {
+        slab = cache->empty;
+        slab_list_remove(&cache->empty, slab);
+        cache->empty_count--;
+        slab_list_add(&cache->partial, slab);
+        cache->hits++;
+    } else {
+        slab = slab_create(cache);
+        if (!slab) {
+            return NULL;
+        }
+        slab_list_add(&cache->partial, slab);
+        cache->misses++;
+    }
+
+    uint8_t* object = slab->free_list;
+    slab->free_list = *(void**)(object + cache->free_offset);
+    slab->inuse++;
+    if (slab->inuse == cache->objects_per_slab) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+
+    cache->active_objects++;
+    cache->allocs++;
+    return object;
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* object) {
+    slab_t* slab = (slab_t*)((uintptr_t)object & ~(uintptr_t)(PAGE_SIZE - 1));
+    if (slab->magic != SLAB_MAGIC || slab->cache != cache) {
+        log_error(LOG_PMM, "SLAB: Bad free of %p to %s\n", object, cache->name);
+        return;
+    }
+
+    if (slab->inuse == cache->objects_per_slab) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+
+    *(void**)((uint8_t*)object + cache->free_offset) = slab->free_list;
+    slab->free_list = object;
+    slab->inuse--;
+    cache->active_objects--;
+    cache->frees++;
+
+    if (slab->inuse == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty_count < SLAB_EMPTY_KEEP) {
+            slab_list_add(&cache->empty, slab);
+            cache->empty_count++;
+        } else {
+            slab_release(cache, slab);
+        }
+    }
+}
+
+uint64_t kmem_cache_shrink(kmem_cache_t* cache) {
+    uint64_t released = 0;
+    while (cache->empty) {
+        slab_t* slab = cache->empty;
+        slab_list_remove(&cache->empty, slab);
+        slab_release(cache, slab);
+        released++;
+    }
+    cache->empty_count = 0;
+    return released;
+}
+
+// Return every cached empty slab to the PMM
+uint64_t slab_reclaim(void) {
+    uint64_t released = 0;
+    for (kmem_cache_t* cache = cache_list; cache; cache = cache->next) {
+        released += kmem_cache_shrink(cache);
+    }
+    return released;
+}
+
+void* kmalloc(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    if (size <= KMALLOC_MAX_SIZE) {
+        int index = 0;
+        while ((size_t)(KMALLOC_MIN_SIZE << index) < size) {
+            index++;
+        }
+        if (!kmalloc_caches[index]) {
+            return NULL;
+        }
+        return kmem_cache_alloc(kmalloc_caches[index]);
+    }
+
+    unsigned int order = pmm_size_to_order(size + sizeof(large_header_t));
+    if (order >= PMM_MAX_ORDER) {
+        return NULL;
+    }
+    large_header_t* header = page_alloc_reclaiming(order);
+    if (!header) {
+        return NULL;
+    }
+    header->magic = LARGE_MAGIC;
+    header->order = order;
+    header->size = size;
+    return header + 1;
+}
+
+void* kzalloc(size_t size) {
+    void* ptr = kmalloc(size);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+void kfree(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    // Slab objects never start at a page boundary (the slab header is there),
+    // and large allocations always start right after their header
+    void* page = (void*)((uintptr_t)ptr & ~(uintptr_t)(PAGE_SIZE - 1));
+    uint32_t magic = *(uint32_t*)page;
+    if (magic == SLAB_MAGIC) {
+        kmem_cache_free(((slab_t*)page)->cache, ptr);
+    } else if (magic == LARGE_MAGIC && (large_header_t*)page + 1 == ptr) {
+        large_header_t* header = page;
+        header->magic = 0;
+        pmm_free_pages(header, header->order);
+    } else {
+        log_error(LOG_PMM, "SLAB: Bad kfree of %p\n", ptr);
+    }
+}
+
+int kmem_cache_get_stats(unsigned int index, kmem_cache_stats_t* stats) {
+    kmem_cache_t* cache = cache_list;
+    while (cache && index > 0) {
+        cache = cache->next;
+        index--;
+    }
+    if (!cache) {
+        return -1;
+    }
+
+    strcpy(stats->name, cache->name);
+    stats->object_size = cache->object_size;
+    stats->objects_per_slab = cache->objects_per_slab;
+    stats->slabs = cache->slabs;
+    stats->active_objects = cache->active_objects;
+    stats->allocs = cache->allocs;
+    stats->frees = cache->frees;
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->pages_released = cache->pages_released;
+    return 0;
+}
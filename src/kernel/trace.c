@@ -0,0 +1,136 @@
+#include <stdint.h>
+#include "kernel/trace.h"
+#include "kernel/arch.h"
+#include "kernel/io.h"
+#include "string.h"
+
+uint32_t trace_mask;
+
+static trace_record_t ring[TRACE_RECORDS];
+static uint64_t head; // Records written; the next goes to ring[head % TRACE_RECORDS]
+
+static const char* const event_names[TRACE_EVENTS] = TRACE_EVENT_NAMES;
+static const trace_event_format_t event_formats[TRACE_EVENTS] = TRACE_EVENT_FORMATS;
+
+// Claiming the slot with IRQs masked keeps a tracepoint hit from an interrupt
+// handler from landing on top of the one it interrupted
+void trace_record(trace_event_t event, uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3) {
+    uint64_t daif = arch_irq_save();
+    uint64_t slot = head++;
+    arch_irq_restore(daif);
+    trace_record_t* record = &ring[slot % TRACE_RECORDS];
+    record->timestamp = arch_counter();
+    record->event = event;
+    record->reserved = 0;
+    record->args[0] = arg0;
+    record->args[1] = arg1;
+    record->args[2] = arg2;
+    record->args[3] = arg3;
+}
+
+void trace_record_text(trace_event_t event, uint64_t arg, const char* text) {
+    uint64_t packed[3] = { 0, 0, 0 };
+    char* bytes = (char*)packed;
+    for (int i = 0; i < TRACE_TEXT_LENGTH && text[i]; i++) {
+        bytes[i] = text[i];
+    }
+    trace_record(event, arg, packed[0], packed[1], packed[2]);
+}
+
+void trace_enable(uint32_t mask) {
+    uint64_t daif = arch_irq_save();
+    trace_mask |= mask;
+    arch_irq_restore(daif);
+}
+
+void trace_disable(uint32_t mask) {
+    uint64_t daif = arch_irq_save();
+    trace_mask &= ~mask;
+    arch_irq_restore(daif);
+}
+
+void trace_clear(void) {
+    head = 0;
+}
+
+uint64_t trace_count(void) {
+    return head;
+}
+
+int trace_parse_event(const char* name) {
+    for (int i = 0; i < TRACE_EVENTS; i++) {
+        if (strcmp(name, event_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char* trace_event_name(trace_event_t event) {
+    return event < TRACE_EVENTS ? event_names[event] : "?";
+}
+
+// Counter ticks to microseconds without overflowing for long traces
+static uint64_t ticks_to_us(uint64_t ticks, uint64_t freq) {
+    return ticks / freq * 1000000 + ticks % freq * 1000000 / freq;
+}
+
+static void describe(const trace_record_t* record, char* out, size_t size) {
+    const uint64_t* args = record->args;
+    if (record->event >= TRACE_EVENTS) {
+        ksnprintf(out, size, "%lx %lx %lx %lx", args[0], args[1], args[2], args[3]);
+        return;
+    }
+    const trace_event_format_t* format = &event_formats[record->event];
+    if (format->layout == TRACE_LAYOUT_ARGS) {
+        ksnprintf(out, size, format->format, (unsigned long long)args[0], (unsigned long long)args[1],
+                  (unsigned long long)args[2], (unsigned long long)args[3]);
+    } else {
+        char text[TRACE_TEXT_SIZE];
+        trace_event_text(record, format->layout, text);
+        ksnprintf(out, size, format->format, text, (unsigned long long)args[0]);
+    }
+}
+
+// Tracing is paused while printing so the dump does not record over itself
+void trace_dump(void) {
+    uint32_t mask = trace_mask;
+    trace_mask = 0;
+
+    uint64_t freq = arch_counter_freq();
+    uint64_t first = head > TRACE_RECORDS ? head - TRACE_RECORDS : 0;
+    kprintf("%lu records", head - first);
+    if (first) {
+        kprintf(", %lu older ones overwritten", first);
+    }
+    kprintf("\n%12s %10s  %-10s %s\n", "time (us)", "delta", "event", "details");
+
+    uint64_t start = ring[first % TRACE_RECORDS].timestamp;
+    uint64_t previous = start;
+    for (uint64_t i = first; i < head; i++) {
+        const trace_record_t* record = &ring[i % TRACE_RECORDS];
+        char details[96];
+        describe(record, details, sizeof(details));
+        kprintf("%12lu %10lu  %-10s %s\n", ticks_to_us(record->timestamp - start, freq),
+                ticks_to_us(record->timestamp - previous, freq), trace_event_name(record->event),
+                details);
+        previous = record->timestamp;
+    }
+
+    trace_mask = mask;
+}
+
+void trace_dump_raw(void) {
+    uint32_t mask = trace_mask;
+    trace_mask = 0;
+
+    uint64_t first = head > TRACE_RECORDS ? head - TRACE_RECORDS : 0;
+    kprintf("TRACE %lu %lu\n", arch_counter_freq(), head - first);
+    for (uint64_t i = first; i < head; i++) {
+        const trace_record_t* record = &ring[i % TRACE_RECORDS];
+        kprintf("T %lx %x %lx %lx %lx %lx\n", record->timestamp, record->event, record->args[0],
+                record->args[1], record->args[2], record->args[3]);
+    }
+
+    trace_mask = mask;
+}
@@ -0,0 +1,162 @@
+#include "kernel/crc32c.h"
+
+// Bit-reflected CRC-32C polynomial. In this form bit 31 is the x^0 term.
+#define POLY 0x82F63B78u
+
+typedef uint64_t __attribute__((may_alias)) word_t;
+
+// Slicing-by-8 tables: table[k][i] is the CRC of byte i followed by k zeros
+static uint32_t table[8][256];
+// x^(2^k) mod POLY, for moving a CRC past runs of zeros
+static uint32_t x2n_table[32];
+static bool ready;
+static bool have_hw;
+
+// Product of two polynomials modulo POLY
+static uint32_t multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31;
+    uint32_t product = 0;
+    for (;;) {
+        if (a & m) {
+            product ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+    }
+    return product;
+}
+
+// x^(n * 2^k) mod POLY
+static uint32_t x2nmodp(uint32_t n, unsigned int k) {
+    uint32_t p = 1u << 31; // x^0
+    while (n) {
+        if (n & 1) {
+            p = multmodp(x2n_table[k & 31], p);
+        }
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+static void crc32c_setup(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+        }
+        table[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+        }
+    }
+    uint32_t p = 1u << 30; // x^1
+    x2n_table[0] = p;
+    for (int k = 1; k < 32; k++) {
+        x2n_table[k] = p = multmodp(p, p);
+    }
+
+#if defined(__aarch64__) && !__STDC_HOSTED__
+    // ID_AA64ISAR0_EL1.CRC32, bits [19:16]: optional in ARMv8.0, required from 8.1
+    uint64_t isar0;
+    __asm__ volatile("mrs %0, id_aa64isar0_el1" : "=r"(isar0));
+    have_hw = ((isar0 >> 16) & 0xF) != 0;
+#endif
+    ready = true;
+}
+
+bool crc32c_has_hw(void) {
+    if (!ready) {
+        crc32c_setup();
+    }
+    return have_hw;
+}
+
+uint32_t crc32c_sw(uint32_t crc, const void* data, size_t size) {
+    if (!ready) {
+        crc32c_setup();
+    }
+    const uint8_t* p = data;
+    crc = ~crc;
+    while (size > 0 && ((uintptr_t)p & 7)) {
+        crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        size--;
+    }
+    for (; size >= 8; size -= 8, p += 8) {
+        uint64_t w = *(const word_t*)p ^ crc;
+        crc = table[7][w & 0xFF] ^ table[6][(w >> 8) & 0xFF] ^ table[5][(w >> 16) & 0xFF] ^
+              table[4][(w >> 24) & 0xFF] ^ table[3][(w >> 32) & 0xFF] ^ table[2][(w >> 40) & 0xFF] ^
+              table[1][(w >> 48) & 0xFF] ^ table[0][w >> 56];
+    }
+    while (size-- > 0) {
+        crc = table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(__aarch64__) && !__STDC_HOSTED__
+// CRC32CX folds 8 bytes per instruction; the target attribute lets the
+// assembler accept it without building the whole kernel for +crc
+__attribute__((target("+crc")))
+uint32_t crc32c_hw(uint32_t crc, const void* data, size_t size) {
+    const uint8_t* p = data;
+    crc = ~crc;
+    while (size > 0 && ((uintptr_t)p & 7)) {
+        __asm__("crc32cb %w0, %w0, %w1" : "+r"(crc) : "r"((uint32_t)*p++));
+        size--;
+    }
+    for (; size >= 32; size -= 32, p += 32) {
+        const word_t* w = (const word_t*)p;
+        __asm__("crc32cx %w0, %w0, %x1\n"
+                "crc32cx %w0, %w0, %x2\n"
+                "crc32cx %w0, %w0, %x3\n"
+                "crc32cx %w0, %w0, %x4"
+                : "+r"(crc) : "r"(w[0]), "r"(w[1]), "r"(w[2]), "r"(w[3]));
+    }
+    for (; size >= 8; size -= 8, p += 8) {
+        __asm__("crc32cx %w0, %w0, %x1" : "+r"(crc) : "r"(*(const word_t*)p));
+    }
+    while (size-- > 0) {
+        __asm__("crc32cb %w0, %w0, %w1" : "+r"(crc) : "r"((uint32_t)*p++));
+    }
+    return ~crc;
+}
+#else
+uint32_t crc32c_hw(uint32_t crc, const void* data, size_t size) {
+    return crc32c_sw(crc, data, size);
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t size) {
+    if (!ready) {
+        crc32c_setup();
+    }
+    return have_hw ? crc32c_hw(crc, data, size) : crc32c_sw(crc, data, size);
+}
+
+// A CRC is linear in its message: for two messages of the same length, the
+// XOR of their checksums is the plain polynomial remainder (no inversions) of
+// the XOR of the messages. Here that XOR is zero outside the changed range;
+// leading zeros leave the remainder alone and trailing ones multiply it by x^8
+// each.
+uint32_t crc32c_patch(uint32_t crc, uint32_t length, uint32_t offset, const void* old, const void* new,
+                      uint32_t size) {
+    const uint8_t* a = old;
+    const uint8_t* b = new;
+    uint8_t delta[64];
+    uint32_t change = 0;
+    for (uint32_t done = 0; done < size;) {
+        uint32_t n = size - done < sizeof(delta) ? size - done : sizeof(delta);
+        for (uint32_t i = 0; i < n; i++) {
+            delta[i] = a[done + i] ^ b[done + i];
+        }
+        change = ~crc32c(~change, delta, n);
+        done += n;
+    }
+    return crc ^ multmodp(x2nmodp(length - offset - size, 3), change);
+}
@@ -1,6 +1,41 @@
 #include <stddef.h>
+#include <stdint.h>
+
+// memcpy, memmove, memset and memcmp live in mem.S.
+//
+// The string scans below read aligned 8-byte words. An aligned word never
+// crosses a page, so reading past the terminator inside it is safe.
+
+#define ONES 0x0101010101010101ull
+#define HIGHS 0x8080808080808080ull
+
+typedef uint64_t __attribute__((may_alias)) word_t;
+
+// Non-zero if any byte of w is zero; the lowest set bit marks the first one
+static inline uint64_t has_zero(uint64_t w) {
+    return (w - ONES) & ~w & HIGHS;
+}
 
 int strcmp(const char *s1, const char *s2) {
+    if ((((uintptr_t)s1 ^ (uintptr_t)s2) & 7) == 0) {
+        while ((uintptr_t)s1 & 7) {
+            if (!*s1 || *s1 != *s2) {
+                return *(const unsigned char*)s1 - *(const unsigned char*)s2;
+            }
+            s1++;
+            s2++;
+        }
+        // Skip whole words that match and hold no terminator
+        const word_t *w1 = (const word_t *)s1;
+        const word_t *w2 = (const word_t *)s2;
+        while (*w1 == *w2 && !has_zero(*w1)) {
+            w1++;
+            w2++;
+        }
+        s1 = (const char *)w1;
+        s2 = (const char *)w2;
+    }
+
     while (*s1 && (*s1 == *s2)) {
         s1++;
         s2++;
@@ -17,21 +52,6 @@ char *strncpy(char *dest, const char *src, size_t n) {
     return dest;
 }
 
-void *memset(void *s, int c, size_t n) {
-    unsigned char *p = s;
-    while (n--)
-        *p++ = (unsigned char)c;
-    return s;
-}
-
-void *memcpy(void *dest, const void *src, size_t n) {
-    char *d = dest;
-    const char *s = src;
-    while (n--)
-        *d++ = *s++;
-    return dest;
-}
-
 char *strcpy(char *dest, const char *src) {
     char *d = dest;
     while ((*d++ = *src++) != '\0');
@@ -46,22 +66,49 @@ char *strcat(char *dest, const char *src) {
 }
 
 char *strchr(const char *s, int c) {
-    while (*s != '\0') {
-        if (*s == c) {
+    char ch = (char)c;
+    while ((uintptr_t)s & 7) {
+        if (*s == ch) {
             return (char *)s;
         }
+        if (*s == '\0') {
+            return NULL;
+        }
         s++;
     }
-    return NULL;
+
+    // Stop at the first word holding either the character or the terminator
+    uint64_t pattern = ONES * (unsigned char)ch;
+    const word_t *w = (const word_t *)s;
+    while (!has_zero(*w) && !has_zero(*w ^ pattern)) {
+        w++;
+    }
+
+    s = (const char *)w;
+    while (*s != ch) {
+        if (*s == '\0') {
+            return NULL;
+        }
+        s++;
+    }
+    return (char *)s;
 }
 
 size_t strlen(const char *s) {
-    size_t len = 0;
-    while (*s != '\0') {
-        len++;
-        s++;
+    const char *p = s;
+    while ((uintptr_t)p & 7) {
+        if (*p == '\0') {
+            return p - s;
+        }
+        p++;
+    }
+
+    const word_t *w = (const word_t *)p;
+    uint64_t zero;
+    while (!(zero = has_zero(*w))) {
+        w++;
     }
-    return len;
+    return (const char *)w + __builtin_ctzll(zero) / 8 - s;
 }
 
 char *strrchr(const char *s, int c) {
@@ -0,0 +1,351 @@
+// Host tool: check a FrogOS file system image without modifying it.
+//
+//   fsck <image>
+//
+// Committed journal transactions are replayed in memory first, so the image is
+// checked as the kernel would mount it. File data blocks are checked against
+// their CRC-32C checksums. Exits 0 when clean, 1 on errors.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kernel/fs_format.h"
+#include "kernel/crc32c.h"
+
+#define MAX_REPORTS 10 // Per kind of block error
+
+static uint8_t* image;
+static uint64_t image_sectors;
+static fs_disk_super_t super;
+static unsigned int errors;
+
+static void* sector(uint64_t number) {
+    return image + number * FS_DISK_SECTOR;
+}
+
+static fs_disk_inode_t* disk_inode(uint32_t index) {
+    return (fs_disk_inode_t*)sector(super.inode_start + index / FS_DISK_INODES_PER_SECTOR) +
+           index % FS_DISK_INODES_PER_SECTOR;
+}
+
+static void error(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+static void error(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    printf("fsck: ");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+    errors++;
+}
+
+// Check the transaction at journal sector 'position'; returns the sector after
+// its commit block, or 0 if it is incomplete or damaged
+static uint32_t journal_scan(uint32_t position, uint32_t sequence) {
+    uint32_t images = 0;
+    uint32_t checksum = FS_DISK_CHECKSUM_SEED;
+    while (position < super.journal_sectors) {
+        fs_journal_descriptor_t* descriptor = sector(super.journal_start + position);
+        if (descriptor->sequence != sequence) {
+            return 0;
+        }
+        if (descriptor->magic == FS_JOURNAL_COMMIT) {
+            fs_journal_commit_t* commit = (fs_journal_commit_t*)descriptor;
+            return commit->count == images && commit->checksum == checksum ? position + 1 : 0;
+        }
+        if (descriptor->magic != FS_JOURNAL_DESCRIPTOR || descriptor->count == 0 ||
+            descriptor->count > FS_JOURNAL_TAGS || position + 1 + descriptor->count >= super.journal_sectors) {
+            return 0;
+        }
+        for (uint32_t i = 0; i < descriptor->count; i++) {
+            if (descriptor->home[i] >= image_sectors) {
+                return 0;
+            }
+        }
+        checksum = fs_disk_checksum(checksum, descriptor, FS_DISK_SECTOR);
+        for (uint32_t i = 0; i < descriptor->count; i++) {
+            checksum = fs_disk_checksum(checksum, sector(super.journal_start + position + 1 + i), FS_DISK_SECTOR);
+        }
+        images += descriptor->count;
+        position += 1 + descriptor->count;
+    }
+    return 0;
+}
+
+// Apply committed transactions to the in-memory image, as mount does
+static unsigned int journal_replay(void) {
+    unsigned int replayed = 0;
+    uint32_t position = 0;
+    uint32_t sequence = super.journal_sequence;
+    uint32_t end;
+    while ((end = journal_scan(position, sequence)) != 0) {
+        while (position < end - 1) {
+            fs_journal_descriptor_t* descriptor = sector(super.journal_start + position);
+            for (uint32_t i = 0; i < descriptor->count; i++) {
+                memcpy(sector(descriptor->home[i]), sector(super.journal_start + position + 1 + i), FS_DISK_SECTOR);
+            }
+            position += 1 + descriptor->count;
+        }
+        position = end;
+        sequence++;
+        replayed++;
+    }
+    return replayed;
+}
+
+static int check_super(void) {
+    if (super.magic != FS_DISK_MAGIC || super.version != FS_DISK_VERSION) {
+        error("no FrogOS file system (magic %08x, version %u)", super.magic, super.version);
+        return -1;
+    }
+    if (super.sectors > image_sectors) {
+        error("superblock describes %llu sectors but the image has %llu", (unsigned long long)super.sectors,
+              (unsigned long long)image_sectors);
+        return -1;
+    }
+    fs_disk_super_t expected;
+    memset(&expected, 0, sizeof(expected));
+    if (fs_disk_layout(super.sectors, &expected) != 0 || expected.journal_start != super.journal_start ||
+        expected.journal_sectors != super.journal_sectors || expected.inode_start != super.inode_start ||
+        expected.inode_count != super.inode_count || expected.bitmap_start != super.bitmap_start ||
+        expected.bitmap_sectors != super.bitmap_sectors || expected.csum_start != super.csum_start ||
+        expected.csum_sectors != super.csum_sectors || expected.data_start != super.data_start ||
+        expected.data_blocks != super.data_blocks) {
+        error("superblock layout does not match a %llu sector device", (unsigned long long)super.sectors);
+        return -1;
+    }
+    if (super.inode_limit == 0 || super.inode_limit > super.inode_count) {
+        error("inode limit %u outside the table of %u", super.inode_limit, super.inode_count);
+        return -1;
+    }
+    return 0;
+}
+
+// Per data block: references, and whether it holds an extent chain
+static uint32_t* block_refs;
+static uint8_t* chain_blocks;
+
+// Record that 'owner' uses data block 'block'. Cloned files share data
+// blocks, but an extent chain block belongs to one inode only.
+static void claim(uint32_t* owners, uint32_t block, uint32_t owner, int chain) {
+    if (block >= super.data_blocks) {
+        error("inode %u uses block %u past the end of the data area", owner, block);
+    } else if (owners[block] && (chain || chain_blocks[block])) {
+        error("block %u used by inodes %u and %u", block, owners[block] - 1, owner);
+    } else {
+        if (!owners[block]) {
+            owners[block] = owner + 1;
+        }
+        block_refs[block]++;
+        chain_blocks[block] = chain;
+    }
+}
+
+static void check_extent(uint32_t index, const fs_disk_inode_t* inode, const fs_disk_extent_t* extent,
+                         uint32_t* next_file_block, uint32_t* owners) {
+    uint32_t file_blocks = (uint32_t)(((uint64_t)inode->size + FS_DISK_SECTOR - 1) / FS_DISK_SECTOR);
+    if (extent->count == 0 || extent->file_block < *next_file_block ||
+        (uint64_t)extent->file_block + extent->count > file_blocks) {
+        error("inode %u has a bad extent (file block %u, %u blocks)", index, extent->file_block, extent->count);
+        return;
+    }
+    *next_file_block = extent->file_block + extent->count;
+    for (uint32_t b = 0; b < extent->count; b++) {
+        claim(owners, extent->start + b, index, 0);
+    }
+}
+
+static void check_inode(uint32_t index, fs_disk_inode_t* inode, uint32_t* owners) {
+    if (memchr(inode->name, '\0', FS_DISK_NAME_LENGTH) == NULL || inode->name[0] == '\0' ||
+        (index != 0 && strchr(inode->name, '/'))) {
+        error("inode %u has a bad name", index);
+        inode->name[FS_DISK_NAME_LENGTH - 1] = '\0';
+    }
+    if (inode->type != FS_DISK_FILE && inode->type != FS_DISK_DIRECTORY) {
+        error("inode %u has unknown type %u", index, inode->type);
+        return;
+    }
+    if (index != 0) {
+        const fs_disk_inode_t* parent = inode->parent < super.inode_limit ? disk_inode(inode->parent) : NULL;
+        if (!parent || !parent->used || parent->type != FS_DISK_DIRECTORY || inode->parent == index) {
+            error("inode %u (%s) has no parent directory", index, inode->name);
+        }
+    }
+    if (inode->type == FS_DISK_DIRECTORY && (inode->extent_count != 0 || inode->size != 0)) {
+        error("directory %u (%s) has data", index, inode->name);
+        return;
+    }
+
+    uint32_t next_file_block = 0;
+    uint32_t inline_count = inode->extent_count < FS_DISK_INLINE_EXTENTS ? inode->extent_count
+                                                                         : FS_DISK_INLINE_EXTENTS;
+    for (uint32_t i = 0; i < inline_count; i++) {
+        check_extent(index, inode, &inode->extents[i], &next_file_block, owners);
+    }
+
+    // The kernel may keep one chain block more than the extents need
+    uint32_t remaining = inode->extent_count - inline_count;
+    uint32_t allowed = fs_disk_chain_blocks(inode->extent_count + 1);
+    uint32_t links = 0;
+    for (uint32_t block = inode->extent_chain; block != FS_DISK_NO_BLOCK; links++) {
+        if (links == allowed || block >= super.data_blocks) {
+            error("inode %u has a bad extent chain", index);
+            return;
+        }
+        claim(owners, block, index, 1);
+        fs_disk_chain_t* chain = sector(super.data_start + block);
+        uint32_t count = remaining < FS_DISK_CHAIN_EXTENTS ? remaining : FS_DISK_CHAIN_EXTENTS;
+        for (uint32_t i = 0; i < count; i++) {
+            check_extent(index, inode, &chain->extents[i], &next_file_block, owners);
+        }
+        remaining -= count;
+        block = chain->next;
+    }
+    if (remaining > 0) {
+        error("inode %u extent chain holds %u fewer extents than its count", index, remaining);
+    }
+}
+
+typedef struct {
+    uint32_t parent;
+    uint32_t index;
+    const char* name;
+} name_t;
+
+static int name_order(const void* a, const void* b) {
+    const name_t* x = a;
+    const name_t* y = b;
+    if (x->parent != y->parent) {
+        return x->parent < y->parent ? -1 : 1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <image>\n", argv[0]);
+        return 2;
+    }
+    FILE* file = fopen(argv[1], "rb");
+    if (!file) {
+        perror(argv[1]);
+        return 2;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    image_sectors = size / FS_DISK_SECTOR;
+    image = malloc(image_sectors * FS_DISK_SECTOR + FS_DISK_SECTOR);
+    if (!image || image_sectors == 0 || fread(image, FS_DISK_SECTOR, image_sectors, file) != image_sectors) {
+        fprintf(stderr, "%s: cannot read the image\n", argv[1]);
+        return 2;
+    }
+    fclose(file);
+
+    memcpy(&super, image, sizeof(super));
+    if (check_super() != 0) {
+        return 1;
+    }
+    unsigned int replayed = journal_replay();
+    if (replayed > 0) {
+        printf("fsck: %u committed journal transactions replayed in memory\n", replayed);
+        memcpy(&super, image, sizeof(super));
+        if (check_super() != 0) {
+            return 1;
+        }
+    }
+
+    fs_disk_inode_t* root = disk_inode(0);
+    if (!root->used || root->type != FS_DISK_DIRECTORY || root->parent != 0) {
+        error("root directory missing");
+        return 1;
+    }
+
+    uint32_t* owners = calloc(super.data_blocks, sizeof(uint32_t));
+    block_refs = calloc(super.data_blocks, sizeof(uint32_t));
+    chain_blocks = calloc(super.data_blocks, 1);
+    name_t* names = malloc(super.inode_limit * sizeof(name_t));
+    uint32_t name_count = 0;
+    uint32_t files = 0;
+    uint32_t directories = 0;
+    for (uint32_t i = 0; i < super.inode_limit; i++) {
+        fs_disk_inode_t* inode = disk_inode(i);
+        if (!inode->used) {
+            continue;
+        }
+        check_inode(i, inode, owners);
+        if (inode->type == FS_DISK_DIRECTORY) {
+            directories++;
+        } else {
+            files++;
+        }
+        if (i != 0) {
+            names[name_count].parent = inode->parent;
+            names[name_count].index = i;
+            names[name_count++].name = inode->name;
+        }
+    }
+
+    // Every entry must lead back to the root
+    for (uint32_t i = 1; i < super.inode_limit; i++) {
+        uint32_t at = i;
+        uint32_t steps = 0;
+        while (at != 0 && at < super.inode_limit && disk_inode(at)->used && steps++ < super.inode_limit) {
+            at = disk_inode(at)->parent;
+        }
+        if (disk_inode(i)->used && at != 0) {
+            error("inode %u is not reachable from the root", i);
+        }
+    }
+
+    qsort(names, name_count, sizeof(name_t), name_order);
+    for (uint32_t i = 1; i < name_count; i++) {
+        if (name_order(&names[i - 1], &names[i]) == 0) {
+            error("inodes %u and %u are both named %s in directory %u", names[i - 1].index, names[i].index,
+                  names[i].name, names[i].parent);
+        }
+    }
+
+    uint8_t* bitmap = sector(super.bitmap_start);
+    uint32_t used = 0;
+    uint32_t shared = 0;
+    unsigned int unmarked = 0;
+    unsigned int leaked = 0;
+    for (uint32_t block = 0; block < super.data_blocks; block++) {
+        int marked = (bitmap[block / 8] >> (block % 8)) & 1;
+        used += marked;
+        shared += block_refs[block] > 1;
+        if (owners[block] && !marked && unmarked++ < MAX_REPORTS) {
+            error("block %u used by inode %u but free in the bitmap", block, owners[block] - 1);
+        } else if (!owners[block] && marked && leaked++ < MAX_REPORTS) {
+            error("block %u allocated in the bitmap but not used", block);
+        }
+    }
+    if (unmarked > MAX_REPORTS || leaked > MAX_REPORTS) {
+        error("%u blocks in use but free, %u allocated but unused", unmarked, leaked);
+    }
+
+    const uint32_t* csums = sector(super.csum_start);
+    unsigned int damaged = 0;
+    for (uint32_t block = 0; block < super.data_blocks; block++) {
+        if (owners[block] && !chain_blocks[block] &&
+            crc32c(0, sector(super.data_start + block), FS_DISK_SECTOR) != csums[block] &&
+            damaged++ < MAX_REPORTS) {
+            error("block %u of inode %u fails its checksum", block, owners[block] - 1);
+        }
+    }
+    if (damaged > MAX_REPORTS) {
+        error("%u blocks fail their checksums", damaged);
+    }
+
+    printf("fsck: %s: %u files, %u directories, %u of %u blocks used (%u shared), %s\n", argv[1], files,
+           directories, used, super.data_blocks, shared, errors ? "errors found" : "clean");
+    free(owners);
+    free(block_refs);
+    free(chain_blocks);
+    free(names);
+    free(image);
+    return errors ? 1 : 0;
+}
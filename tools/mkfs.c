@@ -0,0 +1,87 @@
+// Host tool: write an empty FrogOS file system to a disk image.
+//
+//   mkfs <image> [size in MB]
+//
+// With a size the image is created or resized first; otherwise the file's
+// current size is used. The layout matches fs_format in src/kernel/fs.c.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "kernel/fs_format.h"
+
+#define INODES_PER_CHUNK 64 // Inode slots the kernel's table grows by
+
+static int write_at(int fd, uint64_t sector, const void* data, size_t size) {
+    return pwrite(fd, data, size, (off_t)(sector * FS_DISK_SECTOR)) == (ssize_t)size ? 0 : -1;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <image> [size in MB]\n", argv[0]);
+        return 2;
+    }
+    int fd = open(argv[1], O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (argc == 3 && ftruncate(fd, (off_t)strtoull(argv[2], NULL, 0) * 1024 * 1024) != 0) {
+        perror("ftruncate");
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("fstat");
+        return 1;
+    }
+
+    fs_disk_super_t super;
+    memset(&super, 0, sizeof(super));
+    if (fs_disk_layout((uint64_t)st.st_size / FS_DISK_SECTOR, &super) != 0) {
+        fprintf(stderr, "%s: image too small for a file system\n", argv[1]);
+        return 1;
+    }
+    super.inode_limit = INODES_PER_CHUNK;
+    super.journal_sequence = 1;
+    // Start past any sequence an old journal in the image could still hold
+    fs_disk_super_t old;
+    if (pread(fd, &old, sizeof(old), 0) == sizeof(old) && old.magic == FS_DISK_MAGIC) {
+        super.journal_sequence = old.journal_sequence + old.journal_sectors + 1;
+    }
+
+    static uint8_t zero[FS_DISK_SECTOR];
+    fs_disk_inode_t inodes[FS_DISK_INODES_PER_SECTOR];
+    memset(inodes, 0, sizeof(inodes));
+    strcpy(inodes[0].name, "/");
+    inodes[0].type = FS_DISK_DIRECTORY;
+    inodes[0].used = 1;
+    inodes[0].parent = 0;
+    inodes[0].extent_chain = FS_DISK_NO_BLOCK;
+
+    int result = write_at(fd, super.journal_start, zero, sizeof(zero));
+    for (uint32_t i = 1; i < INODES_PER_CHUNK / FS_DISK_INODES_PER_SECTOR && result == 0; i++) {
+        result = write_at(fd, super.inode_start + i, zero, sizeof(zero));
+    }
+    for (uint32_t i = 0; i < super.bitmap_sectors + super.csum_sectors && result == 0; i++) {
+        result = write_at(fd, super.bitmap_start + i, zero, sizeof(zero)); // Checksums follow the bitmap
+    }
+    if (result == 0) {
+        result = write_at(fd, super.inode_start, inodes, sizeof(inodes));
+    }
+    if (result == 0) {
+        result = write_at(fd, 0, &super, sizeof(super));
+    }
+    if (result != 0 || fsync(fd) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    close(fd);
+
+    printf("%s: %u data blocks (%u KB), %u inodes, %u journal sectors\n", argv[1], super.data_blocks,
+           super.data_blocks / 2, super.inode_count, super.journal_sectors);
+    return 0;
+}
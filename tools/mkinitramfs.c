@@ -0,0 +1,165 @@
+// Host tool: pack a directory tree into an initramfs archive for the kernel.
+//
+//   mkinitramfs <directory> <archive>
+//
+// Entries are written breadth first with names sorted, so parents always come
+// before their children and the same tree always gives the same archive. An
+// empty or missing directory gives an archive with no entries.
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "kernel/initramfs.h"
+
+#define DATA_ALIGN 16
+
+typedef struct {
+    char* path; // On the host
+    initramfs_entry_t record;
+} node_t;
+
+static node_t* nodes;
+static uint32_t node_count;
+static uint32_t node_capacity;
+
+static int name_order(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void add_node(const char* path, const char* name, uint32_t parent, const struct stat* st) {
+    if (node_count == node_capacity) {
+        node_capacity = node_capacity ? node_capacity * 2 : 64;
+        nodes = realloc(nodes, node_capacity * sizeof(node_t));
+        if (!nodes) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    node_t* node = &nodes[node_count++];
+    memset(node, 0, sizeof(*node));
+    node->path = strdup(path);
+    strcpy(node->record.name, name);
+    node->record.parent = parent;
+    node->record.type = S_ISDIR(st->st_mode) ? INITRAMFS_DIRECTORY : INITRAMFS_FILE;
+    node->record.size = S_ISDIR(st->st_mode) ? 0 : (uint32_t)st->st_size;
+}
+
+// Append the children of directory 'path', whose record is 'parent'
+static void scan(const char* path, uint32_t parent) {
+    DIR* dir = opendir(path);
+    if (!dir) {
+        perror(path);
+        exit(1);
+    }
+    char** names = NULL;
+    size_t count = 0;
+    struct dirent* dirent;
+    while ((dirent = readdir(dir)) != NULL) {
+        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) {
+            continue;
+        }
+        names = realloc(names, (count + 1) * sizeof(char*));
+        names[count++] = strdup(dirent->d_name);
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(char*), name_order);
+
+    for (size_t i = 0; i < count; i++) {
+        char child[4096];
+        snprintf(child, sizeof(child), "%s/%s", path, names[i]);
+        struct stat st;
+        if (stat(child, &st) != 0) {
+            perror(child);
+            exit(1);
+        }
+        if (!S_ISDIR(st.st_mode) && !S_ISREG(st.st_mode)) {
+            fprintf(stderr, "%s: skipping, not a file or directory\n", child);
+        } else if (strlen(names[i]) >= INITRAMFS_NAME_LENGTH) {
+            fprintf(stderr, "%s: name longer than %d characters\n", child, INITRAMFS_NAME_LENGTH - 1);
+            exit(1);
+        } else if (S_ISREG(st.st_mode) && st.st_size > UINT32_MAX) {
+            fprintf(stderr, "%s: file too large\n", child);
+            exit(1);
+        } else {
+            add_node(child, names[i], parent, &st);
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <directory> <archive>\n", argv[0]);
+        return 2;
+    }
+    struct stat st;
+    if (stat(argv[1], &st) == 0 && S_ISDIR(st.st_mode)) {
+        scan(argv[1], INITRAMFS_ROOT);
+        for (uint32_t i = 0; i < node_count; i++) {
+            if (nodes[i].record.type == INITRAMFS_DIRECTORY) {
+                scan(nodes[i].path, i);
+            }
+        }
+    }
+
+    uint64_t offset = sizeof(initramfs_header_t) + (uint64_t)node_count * sizeof(initramfs_entry_t);
+    for (uint32_t i = 0; i < node_count; i++) {
+        if (nodes[i].record.type == INITRAMFS_FILE) {
+            offset = (offset + DATA_ALIGN - 1) & ~(uint64_t)(DATA_ALIGN - 1);
+            nodes[i].record.offset = (uint32_t)offset;
+            offset += nodes[i].record.size;
+        }
+    }
+    if (offset > UINT32_MAX) {
+        fprintf(stderr, "%s: archive would be larger than 4 GB\n", argv[1]);
+        return 1;
+    }
+
+    FILE* out = fopen(argv[2], "wb");
+    if (!out) {
+        perror(argv[2]);
+        return 1;
+    }
+    initramfs_header_t header = {INITRAMFS_MAGIC, INITRAMFS_VERSION, node_count, (uint32_t)offset};
+    fwrite(&header, sizeof(header), 1, out);
+    for (uint32_t i = 0; i < node_count; i++) {
+        fwrite(&nodes[i].record, sizeof(initramfs_entry_t), 1, out);
+    }
+    static char buffer[65536];
+    uint32_t files = 0;
+    for (uint32_t i = 0; i < node_count; i++) {
+        if (nodes[i].record.type != INITRAMFS_FILE) {
+            continue;
+        }
+        // Pad to the recorded offset
+        while ((uint64_t)ftell(out) < nodes[i].record.offset) {
+            fputc(0, out);
+        }
+        FILE* in = fopen(nodes[i].path, "rb");
+        if (!in) {
+            perror(nodes[i].path);
+            return 1;
+        }
+        uint32_t left = nodes[i].record.size;
+        while (left > 0) {
+            size_t chunk = left < sizeof(buffer) ? left : sizeof(buffer);
+            if (fread(buffer, 1, chunk, in) != chunk) {
+                fprintf(stderr, "%s: changed while packing\n", nodes[i].path);
+                return 1;
+            }
+            fwrite(buffer, 1, chunk, out);
+            left -= chunk;
+        }
+        fclose(in);
+        files++;
+    }
+    if (fclose(out) != 0) {
+        perror(argv[2]);
+        return 1;
+    }
+    printf("%s: %u files, %u directories, %u bytes\n", argv[2], files, node_count - files, header.size);
+    return 0;
+}
@@ -0,0 +1,93 @@
+// Host tool: turn "nm -n" output for the kernel into the assembly source of its
+// function symbol table.
+//
+//   nm -n build/kernel.elf | mkksyms > ksyms.S
+//
+// Only text symbols are kept, sorted by address, with assembler-generated
+// mapping symbols ($x, $d) and local labels (.L) left out. Where several names
+// share an address the first is kept. Empty input gives an empty table, which
+// the first pass of the kernel link uses.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_NAME 256
+
+typedef struct {
+    uint64_t address;
+    size_t order; // Position in the input
+    char name[MAX_NAME];
+} symbol_t;
+
+static symbol_t* symbols;
+static size_t count;
+static size_t capacity;
+
+static int by_address(const void* a, const void* b) {
+    const symbol_t* x = a;
+    const symbol_t* y = b;
+    if (x->address != y->address) {
+        return x->address < y->address ? -1 : 1;
+    }
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+int main(void) {
+    char line[512];
+    while (fgets(line, sizeof(line), stdin)) {
+        uint64_t address;
+        char type;
+        char name[MAX_NAME];
+        if (sscanf(line, "%" SCNx64 " %c %255s", &address, &type, name) != 3) {
+            continue; // Undefined symbols have no address
+        }
+        if ((type != 'T' && type != 't' && type != 'W') || name[0] == '$' ||
+            strncmp(name, ".L", 2) == 0) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            symbols = realloc(symbols, capacity * sizeof(symbol_t));
+            if (!symbols) {
+                perror("realloc");
+                return 1;
+            }
+        }
+        symbols[count].address = address;
+        symbols[count].order = count;
+        strcpy(symbols[count].name, name);
+        count++;
+    }
+
+    // Equal addresses stay in input order, so the first name is the one kept
+    qsort(symbols, count, sizeof(symbol_t), by_address);
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (unique == 0 || symbols[i].address != symbols[unique - 1].address) {
+            symbols[unique++] = symbols[i];
+        }
+    }
+
+    printf("// Kernel function symbols generated by tools/mkksyms; do not edit\n");
+    printf(".section \".ksyms\", \"a\"\n");
+    printf(".balign 8\n");
+    printf(".global ksyms_table_count\nksyms_table_count:\n    .quad %zu\n", unique);
+    printf(".global ksyms_table_addresses\nksyms_table_addresses:\n");
+    for (size_t i = 0; i < unique; i++) {
+        printf("    .quad 0x%" PRIx64 "\n", symbols[i].address);
+    }
+    printf(".global ksyms_table_name_offsets\nksyms_table_name_offsets:\n");
+    uint32_t offset = 0;
+    for (size_t i = 0; i < unique; i++) {
+        printf("    .4byte %" PRIu32 "\n", offset);
+        offset += strlen(symbols[i].name) + 1;
+    }
+    printf(".global ksyms_table_names\nksyms_table_names:\n");
+    for (size_t i = 0; i < unique; i++) {
+        printf("    .asciz \"%s\"\n", symbols[i].name);
+    }
+    free(symbols);
+    return 0;
+}
@@ -0,0 +1,121 @@
+// Host tool: turn the output of the kernel's "trace raw" command back into a
+// readable timeline.
+//
+//   tracedecode [log]
+//
+// Reads a captured console log, or stdin, and decodes every trace in it (see
+// kernel/trace_format.h). Other console output around the trace is skipped.
+// Each trace is followed by a count of records per event.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "kernel/trace_format.h"
+
+static const char* const event_names[TRACE_EVENTS] = TRACE_EVENT_NAMES;
+static const trace_event_format_t event_formats[TRACE_EVENTS] = TRACE_EVENT_FORMATS;
+
+static uint64_t freq;
+static uint64_t start;
+static uint64_t previous;
+static uint64_t records;
+static uint64_t counts[TRACE_EVENTS];
+
+static uint64_t ticks_to_us(uint64_t ticks) {
+    return ticks / freq * 1000000 + ticks % freq * 1000000 / freq;
+}
+
+static void describe(const trace_record_t* record, char* out, size_t size) {
+    const uint64_t* args = record->args;
+    if (record->event >= TRACE_EVENTS) {
+        snprintf(out, size, "%" PRIx64 " %" PRIx64 " %" PRIx64 " %" PRIx64, args[0], args[1],
+                 args[2], args[3]);
+        return;
+    }
+    const trace_event_format_t* format = &event_formats[record->event];
+    if (format->layout == TRACE_LAYOUT_ARGS) {
+        snprintf(out, size, format->format, (unsigned long long)args[0], (unsigned long long)args[1],
+                 (unsigned long long)args[2], (unsigned long long)args[3]);
+    } else {
+        char text[TRACE_TEXT_SIZE];
+        trace_event_text(record, format->layout, text);
+        snprintf(out, size, format->format, text, (unsigned long long)args[0]);
+    }
+}
+
+static void summary(void) {
+    if (!freq) {
+        return;
+    }
+    printf("\n%" PRIu64 " records over %" PRIu64 " us\n", records, ticks_to_us(previous - start));
+    for (int i = 0; i < TRACE_EVENTS; i++) {
+        if (counts[i]) {
+            printf("  %-10s %" PRIu64 "\n", event_names[i], counts[i]);
+        }
+    }
+}
+
+static void begin(uint64_t frequency, uint64_t expected) {
+    summary();
+    freq = frequency;
+    records = 0;
+    memset(counts, 0, sizeof(counts));
+    printf("Trace of %" PRIu64 " records, counter at %" PRIu64 " Hz\n", expected, freq);
+    printf("%12s %10s  %-10s %s\n", "time (us)", "delta", "event", "details");
+}
+
+static void record(const trace_record_t* record) {
+    if (records == 0) {
+        start = previous = record->timestamp;
+    }
+    char details[128];
+    describe(record, details, sizeof(details));
+    const char* name = record->event < TRACE_EVENTS ? event_names[record->event] : "?";
+    printf("%12" PRIu64 " %10" PRIu64 "  %-10s %s\n", ticks_to_us(record->timestamp - start),
+           ticks_to_us(record->timestamp - previous), name, details);
+    previous = record->timestamp;
+    records++;
+    if (record->event < TRACE_EVENTS) {
+        counts[record->event]++;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [log]\n", argv[0]);
+        return 2;
+    }
+    FILE* file = stdin;
+    if (argc == 2 && !(file = fopen(argv[1], "r"))) {
+        perror(argv[1]);
+        return 2;
+    }
+
+    char line[512];
+    int found = 0;
+    while (fgets(line, sizeof(line), file)) {
+        // Serial console lines may start with a carriage return
+        char* text = line + strspn(line, "\r");
+        uint64_t frequency;
+        uint64_t expected;
+        trace_record_t r = { 0 };
+        if (sscanf(text, "TRACE %" SCNu64 " %" SCNu64, &frequency, &expected) == 2 && frequency) {
+            begin(frequency, expected);
+            found = 1;
+        } else if (freq && sscanf(text, "T %" SCNx64 " %" SCNx32 " %" SCNx64 " %" SCNx64 " %" SCNx64 " %" SCNx64,
+                                  &r.timestamp, &r.event, &r.args[0], &r.args[1], &r.args[2],
+                                  &r.args[3]) == 6) {
+            record(&r);
+        }
+    }
+    summary();
+
+    if (file != stdin) {
+        fclose(file);
+    }
+    if (!found) {
+        fprintf(stderr, "no trace found; capture the output of \"trace raw\"\n");
+        return 1;
+    }
+    return 0;
+}